@@ -0,0 +1,75 @@
+/*
+ * bsdmon.h - bsdmon: options and small helpers shared by all modules
+ */
+
+#ifndef BSDMON_H
+#define BSDMON_H
+
+#include <time.h>
+
+#define GB (1024.0 * 1024.0 * 1024.0)
+#define MB (1024.0 * 1024.0)
+#define KB_PER_GB (1024.0 * 1024.0)
+
+#define BSDMON_MAX_OVERRIDES 16
+
+// Command line options. Collectors receive them in their init callback.
+typedef struct {
+    double interval;            // seconds between reports
+    long count;                 // reports to print, 0 = unlimited
+    int per_core;               // print per-core CPU usage
+    int use_snapshot;           // first CPU report against the saved sample
+    char snapshot_path[4096];
+    double max_age;             // seconds a snapshot stays usable
+    int disk_timeout_ms;        // statvfs deadline per disk sample
+    int top;                    // busiest processes to report, 0 = none
+    int top_mem;                // largest processes by memory to report
+    int top_io;                 // busiest processes by disk I/O to report
+    int proc_threads;           // process scan threads, 0 = one per CPU up to 8
+    struct {
+        char name[32];          // collector name
+        int interval_ms;        // sampling period
+    } every[BSDMON_MAX_OVERRIDES];
+    int nevery;
+    long history_mb;            // history budget, 0 = no history
+    const char *store_dir;      // persistent store, NULL = none
+    long store_mb;              // store budget
+    const char *query;          // --query NAME[{LABEL}], NULL = monitor
+    double since;               // query range in seconds before now
+    const char *shm_name;       // shared-memory export, NULL = none
+    const char *listen_addr;    // Prometheus endpoint, NULL = none
+    int json;                   // reports as NDJSON instead of text
+    const char *binary_path;    // reports as a binary stream, "-" = stdout
+    const char *decode_path;    // --decode a binary stream, "-" = stdin
+    int delta;                  // stream only the metrics that changed
+    double epsilon;             // change threshold with --delta
+    int epsilon_relative;       // epsilon is a fraction of the last value
+    long keyframe;              // full report every keyframe reports
+} bsdmon_options_t;
+
+static inline struct timespec timespec_from_sec(double sec) {
+    struct timespec ts;
+    ts.tv_sec = (time_t)sec;
+    ts.tv_nsec = (long)((sec - (double)ts.tv_sec) * 1e9);
+    if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+    }
+    return ts;
+}
+
+static inline void timespec_add(struct timespec *a, const struct timespec *b) {
+    a->tv_sec += b->tv_sec;
+    a->tv_nsec += b->tv_nsec;
+    if (a->tv_nsec >= 1000000000L) {
+        a->tv_sec++;
+        a->tv_nsec -= 1000000000L;
+    }
+}
+
+// Seconds elapsed between two monotonic timestamps.
+static inline double timespec_diff(const struct timespec *from, const struct timespec *to) {
+    return (double)(to->tv_sec - from->tv_sec) + (to->tv_nsec - from->tv_nsec) / 1e9;
+}
+
+#endif
@@ -0,0 +1,179 @@
+/*
+ * bsdmon_shm.h - bsdmon: shared-memory export of the latest sample
+ *
+ * With --shm NAME, bsdmon publishes the latest value of every metric in a
+ * POSIX shared-memory object (shm_open(NAME), i.e. /dev/shm/NAME on Linux).
+ * This header describes the layout and is also a self-contained reader:
+ * include it, map the object once and every read after that is a few loads
+ * from memory, with no system calls and no locks shared with the sampler.
+ *
+ * The region is a header followed by a fixed array of metric slots. Slots
+ * are assigned in the order metrics first appear and keep their position
+ * while the metric exists, so an index returned by bsdmon_shm_find() stays
+ * valid. When a metric goes away (a process exits, an interface is removed)
+ * its slot is emptied, bsdmon_shm_read() fails for it, and a later metric
+ * may take it over; a reader should find a metric again once reading its
+ * index fails. The writer stages the metrics of a scheduler tick privately
+ * and copies the changed slots in inside one seqlock write section: seq is
+ * odd only during that copy and advances by two per update, and readers
+ * copy what they need and retry if seq was odd or changed meanwhile, so
+ * they always see one complete tick and never wait for a sample.
+ *
+ * The writer unlinks the object when it exits and sets pid to 0; a new
+ * writer creates a new object, so readers holding an old mapping should
+ * remap when bsdmon_shm_alive() turns false or time_ms stops advancing.
+ *
+ *   const bsdmon_shm_t *shm = bsdmon_shm_map("/bsdmon");
+ *   int cpu = bsdmon_shm_find(shm, "cpu_usage_percent", "");
+ *   double value;
+ *   if (cpu >= 0 && bsdmon_shm_read(shm, cpu, &value, NULL) == 0)
+ *       printf("%.1f%%\n", value);
+ */
+
+#ifndef BSDMON_SHM_H
+#define BSDMON_SHM_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define BSDMON_SHM_MAGIC 0x48534d42u    // "BMSH"
+#define BSDMON_SHM_VERSION 1
+#define BSDMON_SHM_CAPACITY 1024
+#define BSDMON_SHM_NAME_SIZE 64
+#define BSDMON_SHM_LABEL_SIZE 48
+
+typedef struct {
+    char name[BSDMON_SHM_NAME_SIZE];    // "" while the slot is empty
+    char label[BSDMON_SHM_LABEL_SIZE];  // "" for host-wide values
+    int64_t time_ms;                    // CLOCK_REALTIME of the sample
+    double value;
+} bsdmon_shm_metric_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t size;              // bytes mapped, header included
+    uint32_t capacity;          // metric slots
+    _Atomic uint64_t seq;       // odd while the writer updates the region
+    int64_t time_ms;            // CLOCK_REALTIME of the latest update
+    uint32_t count;             // slots in use
+    _Atomic uint32_t pid;       // writer, 0 once it has exited
+    uint8_t reserved[24];
+    bsdmon_shm_metric_t metrics[];
+} bsdmon_shm_t;
+
+// Map the object published by a bsdmon process. Returns NULL if it does not
+// exist or has an unknown layout.
+static inline const bsdmon_shm_t *bsdmon_shm_map(const char *name) {
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    void *p = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(bsdmon_shm_t))
+        p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    const bsdmon_shm_t *shm = p;
+    if (shm->magic != BSDMON_SHM_MAGIC || shm->version != BSDMON_SHM_VERSION ||
+        shm->size != (uint64_t)st.st_size ||
+        sizeof(bsdmon_shm_t) + (size_t)shm->capacity * sizeof(bsdmon_shm_metric_t) > shm->size) {
+        munmap(p, (size_t)st.st_size);
+        return NULL;
+    }
+    return shm;
+}
+
+static inline void bsdmon_shm_unmap(const bsdmon_shm_t *shm) {
+    if (shm)
+        munmap((void *)shm, shm->size);
+}
+
+// Whether the writer of this mapping is still running.
+static inline int bsdmon_shm_alive(const bsdmon_shm_t *shm) {
+    return atomic_load_explicit(&((bsdmon_shm_t *)shm)->pid, memory_order_relaxed) != 0;
+}
+
+// Seqlock read side: wait for an even seq, read, then check that seq did not
+// move. The reads in between may race with the writer; their result is only
+// used when the check passes.
+static inline uint64_t bsdmon_shm_read_begin(const bsdmon_shm_t *shm) {
+    uint64_t seq;
+    while ((seq = atomic_load_explicit(&((bsdmon_shm_t *)shm)->seq, memory_order_acquire)) & 1)
+        ;
+    return seq;
+}
+
+static inline int bsdmon_shm_read_retry(const bsdmon_shm_t *shm, uint64_t seq) {
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&((bsdmon_shm_t *)shm)->seq, memory_order_relaxed) != seq;
+}
+
+// Index of the slot holding name{label}, or -1 if it has not been published.
+static inline int bsdmon_shm_find(const bsdmon_shm_t *shm, const char *name, const char *label) {
+    int index;
+    uint64_t seq;
+    do {
+        seq = bsdmon_shm_read_begin(shm);
+        uint32_t count = shm->count < shm->capacity ? shm->count : shm->capacity;
+        index = -1;
+        for (uint32_t i = 0; i < count; i++) {
+            const bsdmon_shm_metric_t *m = &shm->metrics[i];
+            if (strncmp(m->name, name, sizeof(m->name)) == 0 &&
+                strncmp(m->label, label, sizeof(m->label)) == 0) {
+                index = (int)i;
+                break;
+            }
+        }
+    } while (bsdmon_shm_read_retry(shm, seq));
+    return index;
+}
+
+// Latest value (and optionally its sample time) of a slot. Returns -1 if the
+// index is not in use or its metric went away.
+static inline int bsdmon_shm_read(const bsdmon_shm_t *shm, int index, double *value,
+                                  int64_t *time_ms) {
+    double v = 0;
+    int64_t t = 0;
+    int used;
+    uint64_t seq;
+    do {
+        seq = bsdmon_shm_read_begin(shm);
+        used = index >= 0 && (uint32_t)index < shm->count && (uint32_t)index < shm->capacity &&
+               shm->metrics[index].name[0];
+        if (used) {
+            v = shm->metrics[index].value;
+            t = shm->metrics[index].time_ms;
+        }
+    } while (bsdmon_shm_read_retry(shm, seq));
+    if (!used)
+        return -1;
+    *value = v;
+    if (time_ms)
+        *time_ms = t;
+    return 0;
+}
+
+// Copy up to max metrics, all from the same update, empty slots included.
+// Returns the number copied.
+static inline size_t bsdmon_shm_snapshot(const bsdmon_shm_t *shm, bsdmon_shm_metric_t *out,
+                                         size_t max) {
+    size_t n;
+    uint64_t seq;
+    do {
+        seq = bsdmon_shm_read_begin(shm);
+        n = shm->count < shm->capacity ? shm->count : shm->capacity;
+        if (n > max)
+            n = max;
+        memcpy(out, shm->metrics, n * sizeof(*out));
+    } while (bsdmon_shm_read_retry(shm, seq));
+    return n;
+}
+
+#endif
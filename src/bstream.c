@@ -0,0 +1,501 @@
+/*
+ * bstream.c - bsdmon: binary report stream
+ *
+ * See bstream.h.
+ */
+
+#include "bstream.h"
+#include "series.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#define BSTREAM_MAGIC "BSDMON"
+#define BSTREAM_MAGIC_LEN 6
+
+enum {
+    BSTREAM_SCHEMA = 1,
+    BSTREAM_TICK = 2,
+    BSTREAM_KEYFRAME = 3,
+};
+
+// Records longer than this are taken as corruption by the decoder.
+#define BSTREAM_MAX_RECORD (64u << 20)
+
+static uint64_t zigzag(int64_t v) {
+    return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static int64_t unzigzag(uint64_t v) {
+    return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+static uint64_t double_bits(double v) {
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    return bits;
+}
+
+static double bits_double(uint64_t bits) {
+    double v;
+    memcpy(&v, &bits, sizeof(v));
+    return v;
+}
+
+// Whether v is a whole number small enough to be exact as a double.
+static int whole(double v, int64_t *out) {
+    if (!(v > -9007199254740992.0 && v < 9007199254740992.0))
+        return 0;
+    *out = (int64_t)v;
+    return (double)*out == v;
+}
+
+// --- Writer ---
+// Series are keyed by collector, name and label; a series id is its id in
+// the stream. The id of a removed series goes to a later one, which is then
+// described again.
+typedef struct {
+    double prev;
+    int described;              // sent in a SCHEMA record
+    int removed;                // forget it at the end of the tick
+} bstream_series_t;
+
+struct bstream_writer {
+    FILE *out;
+    series_table_t table;
+    bstream_series_t *series;   // by series id
+    uint32_t cap;
+    int64_t last_ms, time_ms;
+    // The tick being built.
+    int keyframe;
+    uint32_t *ids;
+    double *values;
+    size_t nvalues, capvalues;
+    // The record being built; reused from tick to tick.
+    uint8_t *buf;
+    size_t len, bufcap;
+    int failed;                 // out of memory during this tick
+};
+
+// Id of a series, assigning the next one to a new series. Returns -1 when
+// out of memory.
+static int64_t bstream_id(bstream_writer_t *w, const char *collector, const char *name,
+                          const char *label) {
+    int added;
+    int id = series_get(&w->table, collector, name, label, &added);
+    if (id < 0)
+        return id;
+    if (!added) {
+        w->series[id].removed = 0;
+        return id;
+    }
+    if (w->cap < w->table.cap) {
+        bstream_series_t *series = realloc(w->series, w->table.cap * sizeof(*series));
+        if (!series) {
+            series_remove(&w->table, id);
+            return -1;
+        }
+        w->series = series;
+        w->cap = w->table.cap;
+    }
+    w->series[id].prev = 0;
+    w->series[id].described = 0;
+    w->series[id].removed = 0;
+    return id;
+}
+
+// The ids of a tick must stay unique until it is written, so removals wait
+// for its end.
+void bstream_remove(bstream_writer_t *w, const char *collector, const char *name,
+                    const char *label) {
+    int id = series_find(&w->table, collector, name, label);
+    if (id >= 0)
+        w->series[id].removed = 1;
+}
+
+static void put_bytes(bstream_writer_t *w, const void *p, size_t n) {
+    if (w->len + n > w->bufcap) {
+        size_t cap = w->bufcap ? w->bufcap : 4096;
+        while (cap < w->len + n)
+            cap *= 2;
+        uint8_t *buf = realloc(w->buf, cap);
+        if (!buf) {
+            w->failed = 1;
+            return;
+        }
+        w->buf = buf;
+        w->bufcap = cap;
+    }
+    memcpy(w->buf + w->len, p, n);
+    w->len += n;
+}
+
+static size_t varint(uint8_t *out, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        out[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    out[n++] = (uint8_t)v;
+    return n;
+}
+
+static void put_u8(bstream_writer_t *w, uint8_t v) {
+    put_bytes(w, &v, 1);
+}
+
+static void put_varint(bstream_writer_t *w, uint64_t v) {
+    uint8_t tmp[10];
+    put_bytes(w, tmp, varint(tmp, v));
+}
+
+static void put_string(bstream_writer_t *w, const char *s) {
+    size_t len = strlen(s);
+    put_varint(w, len);
+    put_bytes(w, s, len);
+}
+
+// Write the record built in buf with its length prefix.
+static int bstream_flush_record(bstream_writer_t *w) {
+    uint8_t prefix[10];
+    size_t n = varint(prefix, w->len);
+    int ok = !w->failed && fwrite(prefix, 1, n, w->out) == n &&
+             fwrite(w->buf, 1, w->len, w->out) == w->len;
+    w->len = 0;
+    return ok ? 0 : -1;
+}
+
+void bstream_begin(bstream_writer_t *w, int64_t time_ms, int keyframe) {
+    w->time_ms = time_ms;
+    w->keyframe = keyframe;
+    w->nvalues = 0;
+    w->failed = 0;
+}
+
+void bstream_add(bstream_writer_t *w, const char *collector, const char *name, const char *label,
+                 double value) {
+    int64_t id = bstream_id(w, collector, name, label);
+    if (id < 0) {
+        w->failed = 1;
+        return;
+    }
+    if (w->nvalues == w->capvalues) {
+        size_t cap = w->capvalues ? w->capvalues * 2 : 256;
+        uint32_t *ids = realloc(w->ids, cap * sizeof(*ids));
+        if (ids)
+            w->ids = ids;
+        double *values = ids ? realloc(w->values, cap * sizeof(*values)) : NULL;
+        if (!values) {
+            w->failed = 1;
+            return;
+        }
+        w->values = values;
+        w->capvalues = cap;
+    }
+    w->ids[w->nvalues] = (uint32_t)id;
+    w->values[w->nvalues++] = value;
+}
+
+int bstream_end(bstream_writer_t *w) {
+    if (w->failed)
+        return -1;
+
+    // One SCHEMA record per run of new series. Ids below the end of the
+    // ones described so far redefine a removed series.
+    for (uint32_t first = 0; first < w->table.n; first++) {
+        if (!series_live(&w->table, first) || w->series[first].described)
+            continue;
+        uint32_t end = first + 1;
+        while (end < w->table.n && series_live(&w->table, end) && !w->series[end].described)
+            end++;
+        put_u8(w, BSTREAM_SCHEMA);
+        put_varint(w, first);
+        put_varint(w, end - first);
+        for (uint32_t i = first; i < end; i++) {
+            const series_key_t *k = &w->table.keys[i];
+            put_string(w, k->collector);
+            put_string(w, k->name);
+            put_string(w, k->label);
+            w->series[i].described = 1;
+        }
+        if (bstream_flush_record(w) != 0)
+            return -1;
+        first = end;
+    }
+
+    if (w->keyframe) {
+        put_u8(w, BSTREAM_KEYFRAME);
+        if (bstream_flush_record(w) != 0)
+            return -1;
+    }
+
+    put_u8(w, BSTREAM_TICK);
+    put_varint(w, zigzag(w->time_ms - w->last_ms));
+    put_varint(w, w->nvalues);
+    int64_t prev_id = -1;
+    for (size_t i = 0; i < w->nvalues; i++) {
+        put_varint(w, zigzag((int64_t)w->ids[i] - prev_id - 1));
+        prev_id = w->ids[i];
+    }
+
+    // Flags first, then the values, so each value is a plain varint.
+    size_t flags_at = w->len;
+    for (size_t i = 0; i < (w->nvalues + 7) / 8; i++)
+        put_u8(w, 0);
+    for (size_t i = 0; i < w->nvalues && !w->failed; i++) {
+        double *prev = &w->series[w->ids[i]].prev;
+        double v = w->values[i];
+        int64_t a, b;
+        if (whole(v, &a) && whole(*prev, &b)) {
+            put_varint(w, zigzag(a - b));
+        } else {
+            w->buf[flags_at + i / 8] |= (uint8_t)(1u << (i % 8));
+            put_varint(w, double_bits(v) ^ double_bits(*prev));
+        }
+        *prev = v;
+    }
+    if (bstream_flush_record(w) != 0)
+        return -1;
+    w->last_ms = w->time_ms;
+    for (uint32_t id = 0; id < w->table.n; id++)
+        if (series_live(&w->table, id) && w->series[id].removed)
+            series_remove(&w->table, (int)id);
+    return fflush(w->out) == 0 ? 0 : -1;
+}
+
+bstream_writer_t *bstream_writer_create(FILE *out) {
+    bstream_writer_t *w = calloc(1, sizeof(*w));
+    if (!w) {
+        perror("calloc");
+        return NULL;
+    }
+    w->out = out;
+    uint8_t header[BSTREAM_MAGIC_LEN + 2];
+    memcpy(header, BSTREAM_MAGIC, BSTREAM_MAGIC_LEN);
+    header[BSTREAM_MAGIC_LEN] = BSTREAM_VERSION;
+    header[BSTREAM_MAGIC_LEN + 1] = 0;
+    if (fwrite(header, 1, sizeof(header), out) != sizeof(header) || fflush(out) != 0) {
+        perror("write");
+        free(w);
+        return NULL;
+    }
+    return w;
+}
+
+void bstream_writer_destroy(bstream_writer_t *w) {
+    if (!w)
+        return;
+    series_table_free(&w->table);
+    free(w->series);
+    free(w->ids);
+    free(w->values);
+    free(w->buf);
+    free(w);
+}
+
+// --- Decoder ---
+typedef struct {
+    const uint8_t *p, *end;
+    int bad;                    // read past the end of the record
+} cursor_t;
+
+static uint64_t get_varint(cursor_t *c) {
+    uint64_t v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (c->p == c->end) {
+            c->bad = 1;
+            return 0;
+        }
+        uint8_t b = *c->p++;
+        v |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return v;
+    }
+    c->bad = 1;
+    return 0;
+}
+
+typedef struct {
+    char *key;                  // "collector\0name\0label"
+    const char *name, *label;
+    double prev;
+} decoded_series_t;
+
+typedef struct {
+    decoded_series_t *series;
+    uint32_t n, cap;
+    bstream_value_t *values;
+    uint32_t *ids;
+    size_t capvalues;
+    int64_t time_ms;
+    int keyframe;               // a KEYFRAME record precedes the next tick
+} decoder_t;
+
+// Define the series [first, first + count), new ones or, below d->n, ones
+// that replace a removed series.
+static int decode_schema(decoder_t *d, cursor_t *c) {
+    uint64_t first = get_varint(c), count = get_varint(c);
+    if (c->bad || first > d->n || count > (uint64_t)(c->end - c->p))
+        return -1;
+    for (uint64_t id = first; id < first + count; id++) {
+        uint64_t len[3];
+        const uint8_t *str[3];
+        for (int j = 0; j < 3; j++) {
+            len[j] = get_varint(c);
+            if (c->bad || len[j] > (uint64_t)(c->end - c->p))
+                return -1;
+            str[j] = c->p;
+            c->p += len[j];
+        }
+        if (id == d->n && d->n == d->cap) {
+            uint32_t cap = d->cap ? d->cap * 2 : 64;
+            decoded_series_t *s = realloc(d->series, cap * sizeof(*s));
+            if (!s)
+                return -1;
+            d->series = s;
+            d->cap = cap;
+        }
+        char *key = malloc(len[0] + len[1] + len[2] + 3);
+        if (!key)
+            return -1;
+        char *p = key;
+        for (int j = 0; j < 3; j++) {
+            memcpy(p, str[j], len[j]);
+            p[len[j]] = '\0';
+            p += len[j] + 1;
+        }
+        decoded_series_t *s = &d->series[id];
+        if (id < d->n)
+            free(s->key);
+        else
+            d->n++;
+        s->key = key;
+        s->name = key + len[0] + 1;
+        s->label = s->name + len[1] + 1;
+        s->prev = 0;
+    }
+    return 0;
+}
+
+static int decode_tick(decoder_t *d, cursor_t *c, bstream_tick_t fn, void *ctx) {
+    // Arithmetic on decoded deltas is unsigned, so corrupt input cannot
+    // overflow; ids are range-checked.
+    d->time_ms = (int64_t)((uint64_t)d->time_ms + (uint64_t)unzigzag(get_varint(c)));
+    uint64_t count = get_varint(c);
+    if (c->bad || count > (uint64_t)(c->end - c->p))
+        return -1;
+    if (count > d->capvalues) {
+        bstream_value_t *v = realloc(d->values, count * sizeof(*v));
+        if (v)
+            d->values = v;
+        uint32_t *ids = v ? realloc(d->ids, count * sizeof(*ids)) : NULL;
+        if (!ids)
+            return -1;
+        d->ids = ids;
+        d->capvalues = count;
+    }
+    uint64_t id = UINT64_MAX;
+    for (uint64_t i = 0; i < count; i++) {
+        id += (uint64_t)unzigzag(get_varint(c)) + 1;
+        if (c->bad || id >= d->n)
+            return -1;
+        d->ids[i] = (uint32_t)id;
+    }
+    const uint8_t *flags = c->p;
+    if ((count + 7) / 8 > (uint64_t)(c->end - c->p))
+        return -1;
+    c->p += (count + 7) / 8;
+    for (uint64_t i = 0; i < count; i++) {
+        decoded_series_t *s = &d->series[d->ids[i]];
+        uint64_t raw = get_varint(c);
+        if (c->bad)
+            return -1;
+        int64_t prev;
+        double v;
+        if (flags[i / 8] & (1u << (i % 8)))
+            v = bits_double(double_bits(s->prev) ^ raw);
+        else if (whole(s->prev, &prev))
+            v = (double)(int64_t)((uint64_t)prev + (uint64_t)unzigzag(raw));
+        else
+            return -1;
+        s->prev = v;
+        d->values[i].collector = s->key;
+        d->values[i].name = s->name;
+        d->values[i].label = s->label;
+        d->values[i].value = v;
+    }
+    fn(ctx, d->time_ms, d->keyframe, d->values, (size_t)count);
+    d->keyframe = 0;
+    return 0;
+}
+
+// Read a varint length prefix from the file. Returns 0, or -1 at the end of
+// the file (also in the middle of a prefix).
+static int read_length(FILE *in, uint64_t *len) {
+    *len = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        int b = getc(in);
+        if (b == EOF)
+            return -1;
+        *len |= (uint64_t)(b & 0x7f) << shift;
+        if (!(b & 0x80))
+            return 0;
+    }
+    return -1;
+}
+
+int bstream_decode(FILE *in, bstream_tick_t fn, void *ctx) {
+    uint8_t header[BSTREAM_MAGIC_LEN + 2];
+    if (fread(header, 1, sizeof(header), in) != sizeof(header) ||
+        memcmp(header, BSTREAM_MAGIC, BSTREAM_MAGIC_LEN) != 0) {
+        fprintf(stderr, "Not a bsdmon binary stream\n");
+        return -1;
+    }
+    if (header[BSTREAM_MAGIC_LEN] > BSTREAM_VERSION) {
+        fprintf(stderr, "Unsupported stream version %u\n", header[BSTREAM_MAGIC_LEN]);
+        return -1;
+    }
+
+    decoder_t d;
+    memset(&d, 0, sizeof(d));
+    uint8_t *rec = NULL;
+    size_t reccap = 0;
+    int status = 0;
+    uint64_t len;
+    while (read_length(in, &len) == 0) {
+        if (len == 0 || len > BSTREAM_MAX_RECORD) {
+            status = -1;
+            break;
+        }
+        if (len > reccap) {
+            uint8_t *r = realloc(rec, len);
+            if (!r) {
+                status = -1;
+                break;
+            }
+            rec = r;
+            reccap = len;
+        }
+        if (fread(rec, 1, len, in) != len)
+            break;
+        cursor_t c = { rec + 1, rec + len, 0 };
+        if (rec[0] == BSTREAM_SCHEMA)
+            status = decode_schema(&d, &c);
+        else if (rec[0] == BSTREAM_TICK)
+            status = decode_tick(&d, &c, fn, ctx);
+        else if (rec[0] == BSTREAM_KEYFRAME)
+            d.keyframe = 1;
+        if (status != 0)
+            break;
+    }
+    if (status != 0)
+        fprintf(stderr, "Corrupt binary stream\n");
+
+    for (uint32_t i = 0; i < d.n; i++)
+        free(d.series[i].key);
+    free(d.series);
+    free(d.values);
+    free(d.ids);
+    free(rec);
+    return status;
+}
@@ -0,0 +1,83 @@
+/*
+ * bstream.h - bsdmon: binary report stream
+ *
+ * A compact alternative to the text and JSON reports for high sampling
+ * rates. A stream is a file header followed by length-prefixed records:
+ *
+ *   header   "BSDMON" version:u8 flags:u8
+ *   record   length:varint type:u8 payload[length - 1]
+ *
+ * All integers are LEB128 varints, signed ones zigzag encoded first. Readers
+ * skip record types they do not know.
+ *
+ *   SCHEMA   first_id count, then count x (collector name label), each a
+ *            varint length and bytes. Series ids are assigned in order of
+ *            first appearance and a SCHEMA record precedes the first tick
+ *            using them, so the schema is sent once, not per tick. The id
+ *            of a series that went away is given to a later series: a
+ *            SCHEMA record naming an id that is already defined replaces
+ *            that series, whose previous value starts over at 0.
+ *   TICK     time delta (ms since the previous tick, zigzag), count, count x
+ *            id delta (zigzag of id - previous id - 1, so series in their
+ *            usual order cost one byte), a bitmap of one bit per value (set
+ *            for XOR encoding), then count values. A value is encoded
+ *            against the previous value of its series (0 before the first):
+ *            if both are whole numbers, as the zigzag integer difference;
+ *            otherwise as the XOR of their IEEE-754 bit patterns, which is
+ *            small when the two are close and 0 when equal.
+ *   KEYFRAME (empty) the next tick has every series, not only the ones that
+ *            changed (see delta.h); a reader can start from there.
+ *
+ * A tick may hold any subset of the series; the ones it leaves out keep
+ * their previous value. With --delta, a NaN value is a tombstone: the series
+ * went away (see delta.h).
+ */
+
+#ifndef BSDMON_BSTREAM_H
+#define BSDMON_BSTREAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define BSTREAM_VERSION 2     // 2: SCHEMA records may redefine ids
+
+typedef struct bstream_writer bstream_writer_t;
+
+// Write the stream header to out and return a writer for it.
+bstream_writer_t *bstream_writer_create(FILE *out);
+
+// Start a tick at time_ms (CLOCK_REALTIME), add its values, then write it.
+// keyframe marks a tick that has every series.
+void bstream_begin(bstream_writer_t *w, int64_t time_ms, int keyframe);
+void bstream_add(bstream_writer_t *w, const char *collector, const char *name, const char *label,
+                 double value);
+// Returns -1 if writing failed.
+int bstream_end(bstream_writer_t *w);
+
+// Forget a series that went away, so its id can be reused, at the end of
+// the current tick (or the next one, between ticks). Adding a value to it
+// before then keeps it.
+void bstream_remove(bstream_writer_t *w, const char *collector, const char *name,
+                    const char *label);
+
+void bstream_writer_destroy(bstream_writer_t *w);
+
+typedef struct {
+    const char *collector;
+    const char *name;
+    const char *label;
+    double value;
+} bstream_value_t;
+
+// Called with every tick of a stream; the values point into the decoder.
+typedef void (*bstream_tick_t)(void *ctx, int64_t time_ms, int keyframe,
+                               const bstream_value_t *values, size_t n);
+
+// Decode the stream in, calling fn for every tick. Returns 0 at the end of
+// the stream, -1 (with a message on stderr) if it is not a stream or is
+// corrupt. A record cut short at the end, as left by an interrupted writer,
+// ends the stream.
+int bstream_decode(FILE *in, bstream_tick_t fn, void *ctx);
+
+#endif
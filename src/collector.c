@@ -0,0 +1,239 @@
+/*
+ * collector.c - bsdmon: collector registry and scheduler
+ *
+ * See collector.h.
+ */
+
+#include "collector.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+static const collector_t *registry[COLLECTOR_MAX];
+static int nregistered;
+
+int collector_register(const collector_t *c) {
+    if (nregistered == COLLECTOR_MAX || collector_find(c->name))
+        return -1;
+    registry[nregistered++] = c;
+    return 0;
+}
+
+void collector_register_builtin(void) {
+    collector_register(&cpu_collector);
+    collector_register(&memory_collector);
+    collector_register(&disk_collector);
+    collector_register(&diskio_collector);
+    collector_register(&net_collector);
+    collector_register(&proc_collector);
+    // The views that share the process scan come after the ones that run it.
+    collector_register(&procio_collector);
+    collector_register(&procmem_collector);
+}
+
+const collector_t *collector_find(const char *name) {
+    for (int i = 0; i < nregistered; i++)
+        if (strcmp(registry[i]->name, name) == 0)
+            return registry[i];
+    return NULL;
+}
+
+int scheduler_init(scheduler_t *s, const bsdmon_options_t *opts) {
+    memset(s, 0, sizeof(*s));
+    int report_ms = (int)(opts->interval * 1000.0 + 0.5);
+    if (report_ms < 1)
+        report_ms = 1;
+
+    s->report_ms = report_ms;
+    for (int i = 0; i < nregistered; i++) {
+        collector_slot_t *slot = &s->slots[s->n];
+        slot->c = registry[i];
+        slot->interval_ms = registry[i]->interval_ms;
+        for (int j = 0; j < opts->nevery; j++)
+            if (strcmp(opts->every[j].name, slot->c->name) == 0)
+                slot->interval_ms = opts->every[j].interval_ms;
+        if (slot->interval_ms <= 0)
+            slot->interval_ms = report_ms;
+        if (!(slot->state = slot->c->init(opts))) {
+            fprintf(stderr, "Failed to initialize the %s collector\n", slot->c->name);
+            scheduler_destroy(s);
+            return -1;
+        }
+        s->n++;
+    }
+    return 0;
+}
+
+int scheduler_observe(scheduler_t *s, metric_observer_t fn, void *ctx) {
+    if (s->nobservers == SCHEDULER_MAX_OBSERVERS)
+        return -1;
+    s->observers[s->nobservers].fn = fn;
+    s->observers[s->nobservers].ctx = ctx;
+    s->nobservers++;
+    return 0;
+}
+
+typedef struct {
+    const scheduler_t *s;
+    collector_slot_t *slot; // tracks the series emitted, NULL when collecting
+    metric_observer_t fn;   // NULL for every registered observer
+    void *ctx;
+    metric_t m;
+} scheduler_emit_ctx_t;
+
+// Note that the slot's collector emitted name{label} in the current run.
+static void scheduler_seen(collector_slot_t *slot, const char *name, const char *label) {
+    int added;
+    int id = series_get(&slot->series, NULL, name, label, &added);
+    if (id < 0)
+        return;
+    if (slot->seen_cap < slot->series.cap) {
+        uint64_t *seen = realloc(slot->seen, slot->series.cap * sizeof(*seen));
+        if (!seen) {
+            series_remove(&slot->series, id);
+            return;
+        }
+        slot->seen = seen;
+        slot->seen_cap = slot->series.cap;
+    }
+    slot->seen[id] = slot->runs;
+}
+
+static void scheduler_emit(void *arg, const char *name, const char *label, double value) {
+    scheduler_emit_ctx_t *e = arg;
+    if (e->slot)
+        scheduler_seen(e->slot, name, label);
+    e->m.name = name;
+    e->m.label = label;
+    e->m.value = value;
+    if (e->fn) {
+        e->fn(e->ctx, &e->m);
+        return;
+    }
+    for (int i = 0; i < e->s->nobservers; i++)
+        e->s->observers[i].fn(e->s->observers[i].ctx, &e->m);
+}
+
+static int64_t scheduler_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+// Tell the observers about the series the slot's collector stopped emitting
+// and forget them.
+static void scheduler_sweep(scheduler_t *s, collector_slot_t *slot, scheduler_emit_ctx_t *e) {
+    e->m.value = NAN;
+    e->m.gone = 1;
+    for (uint32_t id = 0; id < slot->series.n; id++) {
+        if (!series_live(&slot->series, id) || slot->runs - slot->seen[id] < SCHEDULER_GONE_RUNS)
+            continue;
+        e->m.name = slot->series.keys[id].name;
+        e->m.label = slot->series.keys[id].label;
+        for (int i = 0; i < s->nobservers; i++)
+            s->observers[i].fn(s->observers[i].ctx, &e->m);
+        series_remove(&slot->series, (int)id);
+    }
+}
+
+static void scheduler_run(scheduler_t *s, collector_slot_t *slot) {
+    int ok = slot->c->sample(slot->state) == 0;
+    slot->ready = slot->c->compute(slot->state) == 0;
+    if (!ok || !slot->ready || !slot->c->metrics || !s->nobservers)
+        return;
+    scheduler_emit_ctx_t e;
+    e.s = s;
+    e.slot = slot;
+    e.fn = NULL;
+    e.m.time_ms = scheduler_now_ms();
+    e.m.collector = slot->c->name;
+    e.m.gone = 0;
+    slot->runs++;
+    slot->c->metrics(slot->state, scheduler_emit, &e);
+    scheduler_sweep(s, slot, &e);
+}
+
+void scheduler_prime(scheduler_t *s) {
+    for (int i = 0; i < s->n; i++)
+        scheduler_run(s, &s->slots[i]);
+}
+
+void scheduler_attach(scheduler_t *s, reactor_t *r) {
+    for (int i = 0; i < s->n; i++) {
+        const collector_t *c = s->slots[i].c;
+        if (c->attach && c->attach(s->slots[i].state, r) != 0)
+            fprintf(stderr, "Failed to attach the %s collector; polling instead\n", c->name);
+    }
+}
+
+void scheduler_start(scheduler_t *s, int64_t now_ms) {
+    for (int i = 0; i < s->n; i++)
+        s->slots[i].next_ms = now_ms + s->slots[i].interval_ms;
+    s->report_next_ms = now_ms + s->report_ms;
+}
+
+int64_t scheduler_next(const scheduler_t *s) {
+    int64_t next = s->report_next_ms;
+    for (int i = 0; i < s->n; i++)
+        if (s->slots[i].next_ms < next)
+            next = s->slots[i].next_ms;
+    return next;
+}
+
+// Whether a deadline has come; if so, move it past now_ms by whole periods,
+// so it keeps its phase instead of drifting by the callback latency.
+static int scheduler_due(int64_t *next_ms, int interval_ms, int64_t now_ms) {
+    if (*next_ms > now_ms)
+        return 0;
+    *next_ms += ((now_ms - *next_ms) / interval_ms + 1) * interval_ms;
+    return 1;
+}
+
+int scheduler_advance(scheduler_t *s, int64_t now_ms) {
+    for (int i = 0; i < s->n; i++) {
+        collector_slot_t *slot = &s->slots[i];
+        if (scheduler_due(&slot->next_ms, slot->interval_ms, now_ms))
+            scheduler_run(s, slot);
+    }
+    return scheduler_due(&s->report_next_ms, s->report_ms, now_ms);
+}
+
+int scheduler_ready(const scheduler_t *s, const char *name) {
+    for (int i = 0; i < s->n; i++)
+        if (strcmp(s->slots[i].c->name, name) == 0)
+            return s->slots[i].ready;
+    return 0;
+}
+
+void scheduler_render(scheduler_t *s, FILE *out) {
+    for (int i = 0; i < s->n; i++)
+        if (s->slots[i].ready)
+            s->slots[i].c->render(s->slots[i].state, out);
+}
+
+void scheduler_collect(const scheduler_t *s, metric_observer_t fn, void *ctx) {
+    scheduler_emit_ctx_t e;
+    e.s = s;
+    e.slot = NULL;
+    e.fn = fn;
+    e.ctx = ctx;
+    e.m.time_ms = scheduler_now_ms();
+    e.m.gone = 0;
+    for (int i = 0; i < s->n; i++) {
+        if (!s->slots[i].ready || !s->slots[i].c->metrics)
+            continue;
+        e.m.collector = s->slots[i].c->name;
+        s->slots[i].c->metrics(s->slots[i].state, scheduler_emit, &e);
+    }
+}
+
+void scheduler_destroy(scheduler_t *s) {
+    for (int i = 0; i < s->n; i++) {
+        s->slots[i].c->destroy(s->slots[i].state);
+        series_table_free(&s->slots[i].series);
+        free(s->slots[i].seen);
+    }
+    s->n = 0;
+}
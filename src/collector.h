@@ -0,0 +1,158 @@
+/*
+ * collector.h - bsdmon: collector interface, registry and scheduler
+ *
+ * Each metric source is a collector_t with five required callbacks and two
+ * optional ones:
+ *
+ *   init     allocate state (may return NULL to fail startup)
+ *   sample   read the raw kernel counters
+ *   compute  derive reportable values from the samples taken so far; returns
+ *            0 when values are available, -1 while more samples are needed
+ *   render   print the collector's report section
+ *   destroy  release the state
+ *   attach   optional: register event sources (kernel notification sockets)
+ *            with the reactor, so the collector learns about changes between
+ *            samples instead of polling for them
+ *   metrics  optional: emit the current values as named numeric metrics
+ *            (name, label, value), for consumers other than the text report
+ *
+ * Collectors are registered by name and sampled on their own period: cheap
+ * ones can run every 100 ms while mount scans run every 10 s. Every collector
+ * and the report have their own next deadline on CLOCK_MONOTONIC; the caller
+ * sleeps until the earliest one (scheduler_next()), then the scheduler runs
+ * whichever collectors are due and tells it whether a report is due, so
+ * periods that share no common divisor cost no extra wakeups. A report
+ * renders the latest values of all collectors, whenever they were last
+ * sampled.
+ *
+ * Series come and go (a process exits or leaves the top list, an interface is
+ * removed). The scheduler remembers which series each collector emitted and,
+ * once one has been missing from SCHEDULER_GONE_RUNS samples in a row, tells
+ * the observers with a final metric marked gone, so they can drop the state
+ * they keep for it.
+ */
+
+#ifndef BSDMON_COLLECTOR_H
+#define BSDMON_COLLECTOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "bsdmon.h"
+#include "reactor.h"
+#include "series.h"
+
+// Receives one value from a collector's metrics callback. label tells
+// instances apart (a core, mount, device or interface) and is "" for
+// host-wide values.
+typedef void (*metric_emit_t)(void *ctx, const char *name, const char *label, double value);
+
+typedef struct collector {
+    const char *name;
+    int interval_ms;    // default sampling period, 0 = once per report
+    void *(*init)(const bsdmon_options_t *opts);
+    int (*sample)(void *state);
+    int (*compute)(void *state);
+    void (*render)(void *state, FILE *out);
+    void (*destroy)(void *state);
+    int (*attach)(void *state, reactor_t *r);
+    void (*metrics)(void *state, metric_emit_t emit, void *ctx);
+} collector_t;
+
+// A metric value as seen by scheduler observers.
+typedef struct {
+    int64_t time_ms;        // CLOCK_REALTIME of the sample
+    const char *collector;
+    const char *name;
+    const char *label;
+    double value;           // NaN when gone
+    int gone;               // the collector stopped emitting this series
+} metric_t;
+
+// Called for every metric of a collector after each successful sample, and
+// once more, marked gone, for every series the collector stopped emitting.
+typedef void (*metric_observer_t)(void *ctx, const metric_t *m);
+
+#define COLLECTOR_MAX 32
+#define SCHEDULER_MAX_OBSERVERS 8
+#define SCHEDULER_GONE_RUNS 3  // samples a series may miss before it is gone
+
+typedef struct {
+    const collector_t *c;
+    void *state;
+    int interval_ms;
+    int64_t next_ms;    // deadline of the next sample, see scheduler_next()
+    int ready;          // compute() has produced values
+    uint64_t runs;      // samples whose metrics went to the observers
+    series_table_t series;  // series emitted to the observers
+    uint64_t *seen;     // run a series was last emitted in, by series id
+    uint32_t seen_cap;
+} collector_slot_t;
+
+typedef struct {
+    collector_slot_t slots[COLLECTOR_MAX];
+    int n;
+    int report_ms;
+    int64_t report_next_ms; // deadline of the next report
+    struct {
+        metric_observer_t fn;
+        void *ctx;
+    } observers[SCHEDULER_MAX_OBSERVERS];
+    int nobservers;
+} scheduler_t;
+
+// Built-in collectors.
+extern const collector_t cpu_collector;
+extern const collector_t memory_collector;
+extern const collector_t disk_collector;
+extern const collector_t diskio_collector;
+extern const collector_t net_collector;
+extern const collector_t proc_collector;
+extern const collector_t procio_collector;
+extern const collector_t procmem_collector;
+
+// Add a collector to the registry. Collectors render in registration order.
+int collector_register(const collector_t *c);
+
+// Register the built-in collectors.
+void collector_register_builtin(void);
+
+const collector_t *collector_find(const char *name);
+
+// Instantiate every registered collector and apply the per-collector
+// interval overrides from opts.
+int scheduler_init(scheduler_t *s, const bsdmon_options_t *opts);
+
+// Feed the metrics of every sample to fn. Returns -1 if too many observers
+// are registered.
+int scheduler_observe(scheduler_t *s, metric_observer_t fn, void *ctx);
+
+// Take the first sample of every collector.
+void scheduler_prime(scheduler_t *s);
+
+// Let every collector register its event sources with the reactor.
+void scheduler_attach(scheduler_t *s, reactor_t *r);
+
+// Start every period, the report's included, at now_ms (reactor_now_ms()).
+void scheduler_start(scheduler_t *s, int64_t now_ms);
+
+// The earliest deadline, on the clock of reactor_now_ms().
+int64_t scheduler_next(const scheduler_t *s);
+
+// Run the collectors whose deadline is at or before now_ms. Missed periods
+// collapse into a single sample. Returns 1 if a report is due.
+int scheduler_advance(scheduler_t *s, int64_t now_ms);
+
+// Whether the named collector has values to report.
+int scheduler_ready(const scheduler_t *s, const char *name);
+
+// Render every collector that has values.
+void scheduler_render(scheduler_t *s, FILE *out);
+
+// Pass the latest metrics of every collector that has values to fn, in
+// registration order (the machine-readable counterpart of a report).
+void scheduler_collect(const scheduler_t *s, metric_observer_t fn, void *ctx);
+
+void scheduler_destroy(scheduler_t *s);
+
+#endif
@@ -0,0 +1,545 @@
+/*
+ * cpu.c - bsdmon: CPU usage collector
+ *
+ * Reports overall CPU usage, the share of every CPU state and optionally the
+ * usage of each core, computed from the counters of the last two samples. With
+ * --snapshot the last sample is persisted on exit and the next run reports
+ * against it without waiting.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#ifdef __FreeBSD__
+#include <sys/sysctl.h>
+#endif
+
+#ifdef __linux__
+#include "procfs.h"
+#endif
+
+#include "collector.h"
+
+// --- CPU usage ---
+// CPU time counters are kept per core as a structure of arrays: one contiguous
+// array per CPU state, indexed by core. The usage computation then walks each
+// state array linearly across all cores, which the compiler vectorizes, and the
+// aggregate counters are kept alongside for the overall figure.
+//
+// State order matches the kernel's own layout so parsing can fill slots in
+// sequence: /proc/stat on Linux, kern.cp_times (CP_USER, CP_NICE, CP_SYS,
+// CP_INTR, CP_IDLE) on FreeBSD.
+enum {
+    CPU_USER,
+    CPU_NICE,
+    CPU_SYSTEM,
+#ifdef __FreeBSD__
+    CPU_INTR,       // interrupt time (from kern.cp_times)
+#endif
+    CPU_IDLE,
+#ifdef __linux__
+    CPU_IOWAIT,     // idle with outstanding I/O
+    CPU_IRQ,
+    CPU_SOFTIRQ,
+    CPU_STEAL,      // time taken by the hypervisor for other guests
+    CPU_GUEST,      // running a guest; already included in user
+    CPU_GUEST_NICE, // running a niced guest; already included in nice
+#endif
+    CPU_NSTATES
+};
+
+// States that make up the interval. On Linux guest time is already accounted
+// in user/nice, so summing it again would inflate the total.
+#ifdef __linux__
+#define CPU_NACCOUNTED CPU_GUEST
+#else
+#define CPU_NACCOUNTED CPU_NSTATES
+#endif
+
+static const char *const cpu_state_names[CPU_NSTATES] = {
+#ifdef __linux__
+    "user", "nice", "system", "idle", "iowait",
+    "irq", "softirq", "steal", "guest", "guest_nice",
+#else
+    "user", "nice", "system", "intr", "idle",
+#endif
+};
+
+typedef struct {
+    int ncpu;                                  // number of per-core slots
+    unsigned long long total[CPU_NSTATES];     // aggregate over all cores
+    unsigned long long *state[CPU_NSTATES];    // state[s][core]
+} cpu_times_t;
+
+// Function prototypes
+static int cpu_count(void);
+static int cpu_times_init(cpu_times_t *times, int ncpu);
+static void cpu_times_free(cpu_times_t *times);
+static int get_cpu_times(cpu_times_t *times);
+static double calc_cpu_usage(const cpu_times_t *prev, const cpu_times_t *curr);
+static void calc_cpu_usage_cores(const cpu_times_t *prev, const cpu_times_t *curr, double *usage);
+static void calc_cpu_breakdown(const cpu_times_t *prev, const cpu_times_t *curr, double *percent);
+
+// Allocate the per-core arrays for ncpu cores in a single block.
+static int cpu_times_init(cpu_times_t *times, int ncpu) {
+    memset(times, 0, sizeof(*times));
+    unsigned long long *block = calloc((size_t)ncpu * CPU_NSTATES, sizeof(*block));
+    if (!block) {
+        perror("calloc");
+        return -1;
+    }
+    times->ncpu = ncpu;
+    for (int s = 0; s < CPU_NSTATES; s++)
+        times->state[s] = block + (size_t)s * ncpu;
+    return 0;
+}
+
+static void cpu_times_free(cpu_times_t *times) {
+    free(times->state[0]);
+    memset(times, 0, sizeof(*times));
+}
+
+// On Linux, we parse /proc/stat
+#ifdef __linux__
+static int cpu_count(void) {
+    long n = sysconf(_SC_NPROCESSORS_CONF);
+    return n > 0 ? (int)n : 1;
+}
+
+static procfs_file_t proc_stat = PROCFS_FILE_INIT;
+
+static int get_cpu_times(cpu_times_t *times) {
+    if (proc_stat.fd < 0 && procfs_open(&proc_stat, "/proc/stat", 0) < 0) {
+        perror("open /proc/stat");
+        return -1;
+    }
+    if (procfs_read(&proc_stat) < 0) {
+        perror("read /proc/stat");
+        return -1;
+    }
+    // Offline cores have no line; leave their slots at zero.
+    memset(times->state[0], 0, (size_t)times->ncpu * CPU_NSTATES * sizeof(unsigned long long));
+
+    // Expected format: the aggregate "cpu  user nice system idle iowait irq
+    // softirq steal guest guest_nice" line followed by one "cpuN ..." line per
+    // online core. Older kernels print fewer fields; missing ones stay zero.
+    const char *p = proc_stat.buf;
+    int have_total = 0;
+    while (p[0] == 'c' && p[1] == 'p' && p[2] == 'u') {
+        unsigned long long fields[CPU_NSTATES] = { 0 };
+        unsigned long long cpu = 0;
+        int is_total = p[3] == ' ';
+        p += 3;
+        if (!is_total && !procfs_u64(&p, &cpu))
+            break;
+        int n = 0;
+        while (n < CPU_NSTATES && procfs_u64(&p, &fields[n]))
+            n++;
+        if (n < 4)
+            break;
+        if (is_total) {
+            memcpy(times->total, fields, sizeof(fields));
+            have_total = 1;
+        } else if (cpu < (unsigned long long)times->ncpu) {
+            for (int s = 0; s < CPU_NSTATES; s++)
+                times->state[s][cpu] = fields[s];
+        }
+        p = procfs_next_line(p);
+    }
+
+    if (!have_total) {
+        fprintf(stderr, "Failed to parse /proc/stat cpu line\n");
+        return -1;
+    }
+    return 0;
+}
+#endif
+
+// On FreeBSD, we use sysctl "kern.cp_times"
+// Note: kern.cp_times returns an array of (usually 5) counters per CPU core.
+// The order is: CP_USER, CP_NICE, CP_SYS, CP_INTR, CP_IDLE.
+#ifdef __FreeBSD__
+
+#ifndef KERN_CP_TIME
+#define KERN_CP_TIME 12
+#endif
+
+#define CPUSTATES 5
+
+static int cpu_count(void) {
+    size_t len;
+    int mib[2] = { CTL_KERN, KERN_CP_TIME };
+    if (sysctl(mib, 2, NULL, &len, NULL, 0) < 0) {
+        perror("sysctl (get size of kern.cp_times)");
+        return 1;
+    }
+    int n = (int)(len / sizeof(long) / CPUSTATES);
+    return n > 0 ? n : 1;
+}
+
+static int get_cpu_times(cpu_times_t *times) {
+    // The raw buffer is kept across calls; it only grows if cores appear.
+    static long *cp_times;
+    static size_t cp_times_size;
+    size_t len;
+    int mib[2] = { CTL_KERN, KERN_CP_TIME };
+
+    // First, determine the size of the data
+    if (sysctl(mib, 2, NULL, &len, NULL, 0) < 0) {
+        perror("sysctl (get size of kern.cp_times)");
+        return -1;
+    }
+    if (len > cp_times_size) {
+        long *p = realloc(cp_times, len);
+        if (!p) {
+            perror("realloc");
+            return -1;
+        }
+        cp_times = p;
+        cp_times_size = len;
+    }
+
+    // Now get the actual CPU times
+    if (sysctl(mib, 2, cp_times, &len, NULL, 0) < 0) {
+        perror("sysctl (get kern.cp_times)");
+        return -1;
+    }
+
+    int num_cpus = (int)(len / sizeof(long) / CPUSTATES);
+    if (num_cpus > times->ncpu)
+        num_cpus = times->ncpu;
+
+    // Transpose the per-core rows into per-state arrays and aggregate
+    // values across all CPU cores.
+    for (int s = 0; s < CPU_NSTATES; s++) {
+        unsigned long long *dst = times->state[s];
+        unsigned long long sum = 0;
+        for (int i = 0; i < num_cpus; i++) {
+            dst[i] = (unsigned long)cp_times[i * CPUSTATES + s];
+            sum += dst[i];
+        }
+        times->total[s] = sum;
+    }
+    return 0;
+}
+#endif
+
+// Compute CPU usage percent between two samples.
+// Active time is every accounted state except idle (and iowait on Linux, which
+// is idle time spent waiting for I/O). Steal, irq and softirq count as active.
+static double calc_cpu_usage(const cpu_times_t *prev, const cpu_times_t *curr) {
+    unsigned long long total_delta = 0;
+    for (int s = 0; s < CPU_NACCOUNTED; s++)
+        total_delta += curr->total[s] - prev->total[s];
+    unsigned long long idle_delta = curr->total[CPU_IDLE] - prev->total[CPU_IDLE];
+#ifdef __linux__
+    idle_delta += curr->total[CPU_IOWAIT] - prev->total[CPU_IOWAIT];
+#endif
+    if (total_delta == 0) return 0.0;
+    return ((double)(total_delta - idle_delta) / total_delta) * 100.0;
+}
+
+// Compute the share of the interval spent in each state into
+// percent[CPU_NSTATES]. Accounted states sum to 100; guest states are a
+// subset of user/nice.
+static void calc_cpu_breakdown(const cpu_times_t *prev, const cpu_times_t *curr, double *percent) {
+    unsigned long long total_delta = 0;
+    for (int s = 0; s < CPU_NACCOUNTED; s++)
+        total_delta += curr->total[s] - prev->total[s];
+    for (int s = 0; s < CPU_NSTATES; s++)
+        percent[s] = total_delta ?
+            (double)(curr->total[s] - prev->total[s]) / total_delta * 100.0 : 0.0;
+}
+
+// Compute per-core CPU usage percent between two samples into usage[ncpu].
+// Each pass is a straight loop over one state array so it vectorizes; deltas
+// are signed so a core that went offline (counters reset to zero) reads 0%.
+static void calc_cpu_usage_cores(const cpu_times_t *prev, const cpu_times_t *curr, double *usage) {
+    int n = curr->ncpu;
+    for (int i = 0; i < n; i++)
+        usage[i] = 0.0;
+    for (int s = 0; s < CPU_NACCOUNTED; s++) {
+        const unsigned long long *p = prev->state[s];
+        const unsigned long long *c = curr->state[s];
+        for (int i = 0; i < n; i++)
+            usage[i] += (double)(long long)(c[i] - p[i]);
+    }
+    const unsigned long long *p = prev->state[CPU_IDLE];
+    const unsigned long long *c = curr->state[CPU_IDLE];
+#ifdef __linux__
+    const unsigned long long *pw = prev->state[CPU_IOWAIT];
+    const unsigned long long *cw = curr->state[CPU_IOWAIT];
+#endif
+    for (int i = 0; i < n; i++) {
+        double total = usage[i];
+        double idle = (double)(long long)(c[i] - p[i]);
+#ifdef __linux__
+        idle += (double)(long long)(cw[i] - pw[i]);
+#endif
+        usage[i] = total > 0.0 ? (total - idle) / total * 100.0 : 0.0;
+    }
+}
+
+// --- CPU snapshot cache ---
+// To report CPU usage without sampling for a full second, the last sample can
+// be persisted to a small fixed-layout file together with the CLOCK_MONOTONIC
+// time it was taken. The next invocation computes usage against it directly.
+// The file lives on a tmpfs (XDG_RUNTIME_DIR or /run) so it never outlives a
+// reboot; counters that went backwards are rejected anyway.
+#define SNAPSHOT_MAGIC   "BSDMSNAP"
+#define SNAPSHOT_VERSION 2
+
+// A snapshot younger than this gives too few clock ticks for a meaningful
+// percentage; we sleep out the remainder instead of a full interval.
+#define SNAPSHOT_MIN_AGE 0.25
+
+// The header is followed by the aggregate counters and then the per-core
+// state arrays exactly as laid out in memory (state-major).
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t nstates;           // CPU_NSTATES of the writer
+    uint32_t ncpu;              // per-core slots of the writer
+    uint32_t reserved;
+    int64_t taken_sec;          // CLOCK_MONOTONIC time of the sample
+    int64_t taken_nsec;
+} snapshot_header_t;
+
+// Pick the default snapshot location for this user.
+static const char *snapshot_default_path(char *buf, size_t len) {
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    if (runtime && runtime[0] == '/')
+        snprintf(buf, len, "%s/bsdmon.snapshot", runtime);
+    else if (geteuid() == 0)
+        snprintf(buf, len, "/run/bsdmon.snapshot");
+    else
+        snprintf(buf, len, "/tmp/bsdmon-%u.snapshot", (unsigned)geteuid());
+    return buf;
+}
+
+// Load a snapshot into an initialized cpu_times_t. Returns -1 if it is
+// missing, foreign, malformed or was taken with a different core count.
+static int snapshot_load(const char *path, cpu_times_t *times, struct timespec *taken) {
+    int fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    size_t per_core = (size_t)times->ncpu * CPU_NSTATES * sizeof(unsigned long long);
+    snapshot_header_t hdr;
+    struct stat st;
+    int ok = 0;
+    // Only trust files we own; /tmp is shared with other users.
+    if (fstat(fd, &st) == 0 && st.st_uid == geteuid() &&
+        st.st_size == (off_t)(sizeof(hdr) + sizeof(times->total) + per_core) &&
+        read(fd, &hdr, sizeof(hdr)) == (ssize_t)sizeof(hdr) &&
+        memcmp(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic)) == 0 &&
+        hdr.version == SNAPSHOT_VERSION &&
+        hdr.nstates == CPU_NSTATES &&
+        hdr.ncpu == (uint32_t)times->ncpu &&
+        read(fd, times->total, sizeof(times->total)) == (ssize_t)sizeof(times->total) &&
+        read(fd, times->state[0], per_core) == (ssize_t)per_core)
+        ok = 1;
+    close(fd);
+    if (!ok)
+        return -1;
+    taken->tv_sec = (time_t)hdr.taken_sec;
+    taken->tv_nsec = (long)hdr.taken_nsec;
+    return 0;
+}
+
+// Atomically replace the snapshot with the given sample.
+static int snapshot_save(const char *path, const cpu_times_t *times, const struct timespec *taken) {
+    snapshot_header_t hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, SNAPSHOT_MAGIC, sizeof(hdr.magic));
+    hdr.version = SNAPSHOT_VERSION;
+    hdr.nstates = CPU_NSTATES;
+    hdr.ncpu = (uint32_t)times->ncpu;
+    hdr.taken_sec = taken->tv_sec;
+    hdr.taken_nsec = taken->tv_nsec;
+
+    struct iovec iov[3] = {
+        { &hdr, sizeof(hdr) },
+        { (void *)times->total, sizeof(times->total) },
+        { times->state[0], (size_t)times->ncpu * CPU_NSTATES * sizeof(unsigned long long) },
+    };
+    size_t size = iov[0].iov_len + iov[1].iov_len + iov[2].iov_len;
+
+    // Write to a temporary file next to the target and rename it into place,
+    // so concurrent readers never observe a partial snapshot.
+    char tmp[4096];
+    if (snprintf(tmp, sizeof(tmp), "%s.XXXXXX", path) >= (int)sizeof(tmp))
+        return -1;
+    int fd = mkstemp(tmp);
+    if (fd < 0)
+        return -1;
+    ssize_t w = writev(fd, iov, 3);
+    close(fd);
+    if (w != (ssize_t)size || rename(tmp, path) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+// Sum of all counters in a sample; used to detect counter resets.
+static unsigned long long cpu_times_total(const cpu_times_t *t) {
+    unsigned long long total = 0;
+    for (int s = 0; s < CPU_NACCOUNTED; s++)
+        total += t->total[s];
+    return total;
+}
+
+// --- Collector ---
+// The state keeps the last two samples and swaps them on every sample, so
+// nothing is copied. A snapshot, when usable, is loaded as the older sample.
+typedef struct {
+    cpu_times_t prev, curr;
+    struct timespec prev_taken, curr_taken;
+    int nsamples;               // samples held, 0..2
+    int failed;                 // the last sample could not be read
+    double usage;
+    double breakdown[CPU_NSTATES];
+    double *core_usage;         // per-core usage with --per-core, else NULL
+    int use_snapshot;
+    char snapshot_path[4096];
+} cpu_state_t;
+
+static void cpu_destroy(void *state);
+
+static void *cpu_init(const bsdmon_options_t *opts) {
+    cpu_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    int ncpu = cpu_count();
+    if (cpu_times_init(&s->prev, ncpu) != 0 || cpu_times_init(&s->curr, ncpu) != 0 ||
+        (opts->per_core && !(s->core_usage = calloc(ncpu, sizeof(*s->core_usage))))) {
+        cpu_destroy(s);
+        return NULL;
+    }
+    if (!opts->use_snapshot)
+        return s;
+
+    s->use_snapshot = 1;
+    if (opts->snapshot_path[0])
+        snprintf(s->snapshot_path, sizeof(s->snapshot_path), "%s", opts->snapshot_path);
+    else
+        snapshot_default_path(s->snapshot_path, sizeof(s->snapshot_path));
+    // The snapshot goes into curr so that the first sample swaps it into prev.
+    if (snapshot_load(s->snapshot_path, &s->curr, &s->curr_taken) == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        double age = timespec_diff(&s->curr_taken, &now);
+        if (age >= 0 && age <= opts->max_age) {
+            if (age < SNAPSHOT_MIN_AGE) {
+                struct timespec wake = s->curr_taken;
+                struct timespec min_age = timespec_from_sec(SNAPSHOT_MIN_AGE);
+                timespec_add(&wake, &min_age);
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR)
+                    ;
+            }
+            s->nsamples = 1;
+        }
+    }
+    return s;
+}
+
+static int cpu_sample(void *state) {
+    cpu_state_t *s = state;
+    cpu_times_t tmp = s->prev;
+    s->prev = s->curr;
+    s->curr = tmp;
+    s->prev_taken = s->curr_taken;
+    if (get_cpu_times(&s->curr) != 0) {
+        // Start over; the buffer swapped into curr no longer holds a sample.
+        s->nsamples = 0;
+        s->failed = 1;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &s->curr_taken);
+    s->failed = 0;
+    if (s->nsamples < 2)
+        s->nsamples++;
+    return 0;
+}
+
+static int cpu_compute(void *state) {
+    cpu_state_t *s = state;
+    if (s->failed)
+        return 0;
+    // A snapshot from before a reboot has larger counters than now.
+    if (s->nsamples < 2 || cpu_times_total(&s->curr) <= cpu_times_total(&s->prev))
+        return -1;
+    s->usage = calc_cpu_usage(&s->prev, &s->curr);
+    calc_cpu_breakdown(&s->prev, &s->curr, s->breakdown);
+    if (s->core_usage)
+        calc_cpu_usage_cores(&s->prev, &s->curr, s->core_usage);
+    return 0;
+}
+
+// Print usage, the state breakdown and, with --per-core, eight cores per line.
+static void cpu_render(void *state, FILE *out) {
+    cpu_state_t *s = state;
+    if (s->failed) {
+        fprintf(out, "CPU Usage: Error retrieving information\n");
+        return;
+    }
+    fprintf(out, "CPU Usage: %.2f%%\n", s->usage);
+    fprintf(out, " ");
+    for (int i = 0; i < CPU_NSTATES; i++)
+        fprintf(out, " %s %.2f%%", cpu_state_names[i], s->breakdown[i]);
+    fprintf(out, "\n");
+    if (s->core_usage) {
+        int ncpu = s->curr.ncpu;
+        for (int i = 0; i < ncpu; i++) {
+            fprintf(out, "  cpu%-4d%6.2f%%", i, s->core_usage[i]);
+            if (i % 8 == 7 || i == ncpu - 1)
+                fprintf(out, "\n");
+        }
+    }
+}
+
+static void cpu_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const cpu_state_t *s = state;
+    if (s->failed)
+        return;
+    emit(ctx, "cpu_usage_percent", "", s->usage);
+    for (int i = 0; i < CPU_NSTATES; i++)
+        emit(ctx, "cpu_state_percent", cpu_state_names[i], s->breakdown[i]);
+    for (int i = 0; s->core_usage && i < s->curr.ncpu; i++) {
+        char label[16];
+        snprintf(label, sizeof(label), "cpu%d", i);
+        emit(ctx, "cpu_core_usage_percent", label, s->core_usage[i]);
+    }
+}
+
+static void cpu_destroy(void *state) {
+    cpu_state_t *s = state;
+    if (s->use_snapshot && s->nsamples > 0 && !s->failed &&
+        snapshot_save(s->snapshot_path, &s->curr, &s->curr_taken) != 0)
+        fprintf(stderr, "Failed to save CPU snapshot to %s\n", s->snapshot_path);
+    cpu_times_free(&s->prev);
+    cpu_times_free(&s->curr);
+    free(s->core_usage);
+    free(s);
+}
+
+const collector_t cpu_collector = {
+    .name = "cpu",
+    .interval_ms = 0,
+    .init = cpu_init,
+    .sample = cpu_sample,
+    .compute = cpu_compute,
+    .render = cpu_render,
+    .destroy = cpu_destroy,
+    .metrics = cpu_metrics,
+};
@@ -0,0 +1,112 @@
+/*
+ * delta.c - bsdmon: change detection for streamed reports
+ *
+ * See delta.h.
+ */
+
+#include "delta.h"
+#include "series.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+typedef struct {
+    double last;                // last value emitted
+    long report;                // last report the series was part of
+} delta_series_t;
+
+struct delta {
+    double epsilon;
+    int relative;
+    long keyframe;
+    long reports;               // reports begun
+    int full;                   // the current report is a keyframe
+    series_table_t table;
+    delta_series_t *series;     // by series id
+    uint32_t cap;
+};
+
+// The state of a series, or NULL if it is new (it is added then) or memory
+// ran out; either way the value is emitted.
+static delta_series_t *delta_series(delta_t *d, const char *collector, const char *name,
+                                    const char *label, double value) {
+    int added;
+    int id = series_get(&d->table, collector, name, label, &added);
+    if (id < 0)
+        return NULL;
+    if (!added)
+        return &d->series[id];
+    if (d->cap < d->table.cap) {
+        delta_series_t *series = realloc(d->series, d->table.cap * sizeof(*series));
+        if (!series) {
+            series_remove(&d->table, id);
+            return NULL;
+        }
+        d->series = series;
+        d->cap = d->table.cap;
+    }
+    d->series[id].last = value;
+    d->series[id].report = d->reports;
+    return NULL;
+}
+
+int delta_begin(delta_t *d) {
+    d->full = d->reports++ % d->keyframe == 0;
+    return d->full;
+}
+
+static double delta_abs(double v) {
+    return v < 0 ? -v : v;
+}
+
+int delta_changed(delta_t *d, const char *collector, const char *name, const char *label,
+                  double value) {
+    delta_series_t *s = delta_series(d, collector, name, label, value);
+    if (!s)
+        return 1;
+    s->report = d->reports;
+    double *last = &s->last;
+    int changed;
+    if (isnan(value) || isnan(*last))
+        changed = isnan(value) != isnan(*last);
+    else
+        changed = delta_abs(value - *last) >
+                  (d->relative ? d->epsilon * delta_abs(*last) : d->epsilon);
+    if (!changed && !d->full)
+        return 0;
+    *last = value;
+    return 1;
+}
+
+void delta_end(delta_t *d, const char *collector, delta_gone_t fn, void *ctx) {
+    for (uint32_t id = 0; id < d->table.n; id++) {
+        const series_key_t *k = &d->table.keys[id];
+        if (!series_live(&d->table, id) || d->series[id].report == d->reports ||
+            (collector && k->collector != collector))
+            continue;
+        fn(ctx, k->collector, k->name, k->label);
+        series_remove(&d->table, (int)id);
+    }
+}
+
+delta_t *delta_create(double epsilon, int relative, long keyframe) {
+    delta_t *d = calloc(1, sizeof(*d));
+    if (!d) {
+        perror("calloc");
+        return NULL;
+    }
+    d->epsilon = epsilon;
+    d->relative = relative;
+    d->keyframe = keyframe > 0 ? keyframe : 1;
+    return d;
+}
+
+void delta_destroy(delta_t *d) {
+    if (!d)
+        return;
+    series_table_free(&d->table);
+    free(d->series);
+    free(d);
+}
@@ -0,0 +1,46 @@
+/*
+ * delta.h - bsdmon: change detection for streamed reports
+ *
+ * Decides which metrics of a report are worth emitting: a value is emitted
+ * when it moved from the last value emitted for its series by more than an
+ * epsilon, absolute or relative to that last value. Every keyframe-th
+ * report emits every value, so a consumer that starts late or dropped data
+ * has a full state again after at most that many reports.
+ *
+ * A series that was part of the previous report but not of this one (a
+ * process that exited, an interface that went away) is reported once more
+ * as a tombstone, a NaN value, and then forgotten; no collector emits NaN
+ * otherwise. A consumer drops the series when it sees one.
+ */
+
+#ifndef BSDMON_DELTA_H
+#define BSDMON_DELTA_H
+
+typedef struct delta delta_t;
+
+// relative: epsilon is a fraction of the last emitted value instead of an
+// absolute difference. keyframe: every keyframe-th report is full, the
+// first one included.
+delta_t *delta_create(double epsilon, int relative, long keyframe);
+
+// Start the next report. Returns 1 if it is a keyframe.
+int delta_begin(delta_t *d);
+
+// Whether to emit this value in the current report. Values that are emitted
+// become the reference for the next reports. Series are told apart by
+// collector (compared by pointer), name and label.
+int delta_changed(delta_t *d, const char *collector, const char *name, const char *label,
+                  double value);
+
+// Called with every series that left the report; its tombstone is due.
+typedef void (*delta_gone_t)(void *ctx, const char *collector, const char *name,
+                             const char *label);
+
+// Pass the series of collector (every collector if NULL) that were not part
+// of the current report to fn, and forget them. Called after the last value
+// of the collector, so tombstones stay with its other values.
+void delta_end(delta_t *d, const char *collector, delta_gone_t fn, void *ctx);
+
+void delta_destroy(delta_t *d);
+
+#endif
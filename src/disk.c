@@ -0,0 +1,93 @@
+/*
+ * disk.c - bsdmon: filesystem capacity collector
+ *
+ * Every real filesystem is sampled through a mount_table_t (see mounts.h),
+ * which bounds the time spent waiting on unresponsive mounts. Capacity
+ * changes slowly and a scan touches every mount, so by default this collector
+ * runs far less often than the report.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "collector.h"
+#include "mounts.h"
+
+#define DISK_WORKERS 4
+
+typedef struct {
+    mount_table_t *table;
+    const mount_usage_t *mounts;    // owned by table, valid until the next sample
+    int nmounts;                    // -1 if the last sample failed
+} disk_state_t;
+
+static void *disk_init(const bsdmon_options_t *opts) {
+    disk_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    if (!(s->table = mount_table_create(DISK_WORKERS, opts->disk_timeout_ms))) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
+
+static int disk_sample(void *state) {
+    disk_state_t *s = state;
+    s->nmounts = mount_table_sample(s->table, &s->mounts);
+    return s->nmounts < 0 ? -1 : 0;
+}
+
+static int disk_compute(void *state) {
+    (void)state;
+    return 0;
+}
+
+// One line per mounted filesystem.
+static void disk_render(void *state, FILE *out) {
+    const disk_state_t *s = state;
+    if (s->nmounts < 0)
+        fprintf(out, "Disk Usage: Error retrieving information\n");
+    for (int i = 0; i < s->nmounts; i++) {
+        const mount_usage_t *m = &s->mounts[i];
+        fprintf(out, "Disk Usage (\"%s\"): ", m->dir);
+        if (m->status == MOUNT_OK)
+            fprintf(out, "%.2f GB / %.2f GB (%.2f%% used)\n", m->used / GB, m->total / GB,
+                    m->total ? (double)m->used / m->total * 100.0 : 0.0);
+        else if (m->status == MOUNT_TIMEOUT)
+            fprintf(out, "timed out\n");
+        else
+            fprintf(out, "Error retrieving information\n");
+    }
+}
+
+static void disk_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const disk_state_t *s = state;
+    for (int i = 0; i < s->nmounts; i++) {
+        const mount_usage_t *m = &s->mounts[i];
+        if (m->status != MOUNT_OK)
+            continue;
+        emit(ctx, "disk_total_bytes", m->dir, (double)m->total);
+        emit(ctx, "disk_used_bytes", m->dir, (double)m->used);
+        emit(ctx, "disk_avail_bytes", m->dir, (double)m->avail);
+    }
+}
+
+static void disk_destroy(void *state) {
+    disk_state_t *s = state;
+    mount_table_destroy(s->table);
+    free(s);
+}
+
+const collector_t disk_collector = {
+    .name = "disk",
+    .interval_ms = 10000,
+    .init = disk_init,
+    .sample = disk_sample,
+    .compute = disk_compute,
+    .render = disk_render,
+    .destroy = disk_destroy,
+    .metrics = disk_metrics,
+};
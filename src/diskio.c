@@ -0,0 +1,313 @@
+/*
+ * diskio.c - bsdmon: block device I/O collector
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+
+#ifdef __linux__
+#include "procfs.h"
+#endif
+
+#include "collector.h"
+
+// --- Disk I/O ---
+// Block device throughput, IOPS, latency and utilization follow the same
+// two-sample model as CPU usage: get_disk_io() reads the cumulative counters
+// from /proc/diskstats and calc_disk_io() turns the delta between two samples
+// into rates over the elapsed time.
+typedef struct {
+    char name[32];
+    unsigned long long rd_ios;      // reads completed
+    unsigned long long rd_sectors;  // 512-byte sectors read
+    unsigned long long rd_ticks;    // ms spent reading
+    unsigned long long wr_ios;
+    unsigned long long wr_sectors;
+    unsigned long long wr_ticks;
+    unsigned long long io_ticks;    // ms with I/O in flight
+    unsigned long long queue_ticks; // weighted ms with I/O in flight
+} disk_stat_t;
+
+typedef struct {
+    int n, cap;
+    disk_stat_t *dev;
+} disk_io_t;
+
+typedef struct {
+    const char *name;
+    double rd_bytes;    // per second
+    double wr_bytes;
+    double rd_iops;
+    double wr_iops;
+    double await_ms;    // average time per completed request
+    double queue_depth; // average number of requests in flight
+    double util;        // % of time the device was busy
+} disk_io_rate_t;
+
+static void disk_io_free(disk_io_t *io) {
+    free(io->dev);
+    memset(io, 0, sizeof(*io));
+}
+
+#ifdef __linux__
+static procfs_file_t proc_diskstats = PROCFS_FILE_INIT;
+
+// Partitions and whole disks are mixed in /proc/diskstats; only whole disks
+// have an entry in /sys/block. The answer is cached per device name, in the
+// order the devices are listed, and devices missing from the latest read are
+// dropped so the cache follows hotplugged disks instead of growing with them.
+static struct {
+    char name[32];
+    int whole;
+    int seen;           // listed in the current read
+} *disk_kinds;
+static int disk_nkinds, disk_kinds_cap;
+
+// *next is the cache slot expected for the next listed device.
+static int disk_is_whole(const char *name, int *next) {
+    int i = *next;
+    if (i >= disk_nkinds || strcmp(disk_kinds[i].name, name) != 0)
+        for (i = 0; i < disk_nkinds; i++)
+            if (strcmp(disk_kinds[i].name, name) == 0)
+                break;
+    if (i < disk_nkinds) {
+        disk_kinds[i].seen = 1;
+        *next = i + 1;
+        return disk_kinds[i].whole;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "/sys/block/%s", name);
+    for (char *c = path + 11; *c; c++)
+        if (*c == '/')
+            *c = '!';   // e.g. cciss/c0d0 is /sys/block/cciss!c0d0
+    int whole = access(path, F_OK) == 0;
+    if (disk_nkinds == disk_kinds_cap) {
+        int cap = disk_kinds_cap ? disk_kinds_cap * 2 : 16;
+        void *p = realloc(disk_kinds, cap * sizeof(*disk_kinds));
+        if (!p)
+            return whole;
+        disk_kinds = p;
+        disk_kinds_cap = cap;
+    }
+    snprintf(disk_kinds[disk_nkinds].name, sizeof(disk_kinds[0].name), "%s", name);
+    disk_kinds[disk_nkinds].whole = whole;
+    disk_kinds[disk_nkinds].seen = 1;
+    *next = ++disk_nkinds;
+    return whole;
+}
+
+// Forget the devices that were not listed since the previous call.
+static void disk_kinds_prune(void) {
+    int n = 0;
+    for (int i = 0; i < disk_nkinds; i++) {
+        if (!disk_kinds[i].seen)
+            continue;
+        disk_kinds[n] = disk_kinds[i];
+        disk_kinds[n++].seen = 0;
+    }
+    disk_nkinds = n;
+}
+
+// Lines look like "   8       0 sda 4470 1592 316806 1731 ...": major, minor,
+// name, then reads, reads merged, sectors read, ms reading, writes, writes
+// merged, sectors written, ms writing, in flight, ms doing I/O, weighted ms.
+static int get_disk_io(disk_io_t *io) {
+    if (proc_diskstats.fd < 0 && procfs_open(&proc_diskstats, "/proc/diskstats", 0) < 0) {
+        perror("open /proc/diskstats");
+        return -1;
+    }
+    if (procfs_read(&proc_diskstats) < 0) {
+        perror("read /proc/diskstats");
+        return -1;
+    }
+    io->n = 0;
+    int next = 0;
+    for (const char *p = proc_diskstats.buf; *p; p = procfs_next_line(p)) {
+        unsigned long long major, minor, f[11];
+        if (!procfs_u64(&p, &major) || !procfs_u64(&p, &minor))
+            continue;
+        p = procfs_skip_blanks(p);
+        const char *name = p;
+        while (*p && *p != ' ' && *p != '\n')
+            p++;
+        size_t len = (size_t)(p - name);
+        int nf = 0;
+        while (nf < 11 && procfs_u64(&p, &f[nf]))
+            nf++;
+        if (nf < 11 || len == 0 || len >= sizeof(io->dev[0].name))
+            continue;
+        // Devices that never did any I/O (unused loop and ram devices).
+        if (f[0] == 0 && f[4] == 0)
+            continue;
+        char devname[32];
+        memcpy(devname, name, len);
+        devname[len] = '\0';
+        if (!disk_is_whole(devname, &next))
+            continue;
+        if (io->n == io->cap) {
+            int cap = io->cap ? io->cap * 2 : 8;
+            disk_stat_t *d = realloc(io->dev, cap * sizeof(*d));
+            if (!d) {
+                perror("realloc");
+                return -1;
+            }
+            io->dev = d;
+            io->cap = cap;
+        }
+        disk_stat_t *d = &io->dev[io->n++];
+        memcpy(d->name, devname, len + 1);
+        d->rd_ios = f[0];
+        d->rd_sectors = f[2];
+        d->rd_ticks = f[3];
+        d->wr_ios = f[4];
+        d->wr_sectors = f[6];
+        d->wr_ticks = f[7];
+        d->io_ticks = f[9];
+        d->queue_ticks = f[10];
+    }
+    disk_kinds_prune();
+    return 0;
+}
+#else
+// Per-device statistics on FreeBSD live in libdevstat, which this tool does
+// not link against.
+static int get_disk_io(disk_io_t *io) {
+    io->n = 0;
+    return -1;
+}
+#endif
+
+// Compute per-device rates between two samples taken seconds apart into
+// rates[curr->n]. Returns the number of devices present in both samples.
+static int calc_disk_io(const disk_io_t *prev, const disk_io_t *curr, double seconds,
+                 disk_io_rate_t *rates) {
+    int n = 0;
+    if (seconds <= 0)
+        return 0;
+    for (int i = 0; i < curr->n; i++) {
+        const disk_stat_t *c = &curr->dev[i];
+        // Devices are listed in a stable order; try the same slot first.
+        const disk_stat_t *p = NULL;
+        if (i < prev->n && strcmp(prev->dev[i].name, c->name) == 0)
+            p = &prev->dev[i];
+        for (int j = 0; !p && j < prev->n; j++)
+            if (strcmp(prev->dev[j].name, c->name) == 0)
+                p = &prev->dev[j];
+        if (!p || c->rd_ios < p->rd_ios || c->wr_ios < p->wr_ios)
+            continue;
+        unsigned long long ios = (c->rd_ios - p->rd_ios) + (c->wr_ios - p->wr_ios);
+        unsigned long long ticks = (c->rd_ticks - p->rd_ticks) + (c->wr_ticks - p->wr_ticks);
+        disk_io_rate_t *r = &rates[n++];
+        r->name = c->name;
+        r->rd_bytes = (c->rd_sectors - p->rd_sectors) * 512.0 / seconds;
+        r->wr_bytes = (c->wr_sectors - p->wr_sectors) * 512.0 / seconds;
+        r->rd_iops = (c->rd_ios - p->rd_ios) / seconds;
+        r->wr_iops = (c->wr_ios - p->wr_ios) / seconds;
+        r->await_ms = ios ? (double)ticks / ios : 0.0;
+        r->queue_depth = (c->queue_ticks - p->queue_ticks) / (seconds * 1000.0);
+        r->util = (c->io_ticks - p->io_ticks) / (seconds * 10.0);
+        if (r->util > 100.0)
+            r->util = 100.0;
+    }
+    return n;
+}
+
+// --- Collector ---
+typedef struct {
+    disk_io_t prev, curr;
+    struct timespec prev_taken, curr_taken;
+    int nsamples;               // consecutive successful samples, 0..2
+    disk_io_rate_t *rates;
+    int nrates, rates_cap;
+} diskio_state_t;
+
+static void *diskio_init(const bsdmon_options_t *opts) {
+    (void)opts;
+    diskio_state_t *s = calloc(1, sizeof(*s));
+    if (!s)
+        perror("calloc");
+    return s;
+}
+
+static int diskio_sample(void *state) {
+    diskio_state_t *s = state;
+    disk_io_t tmp = s->prev;
+    s->prev = s->curr;
+    s->curr = tmp;
+    s->prev_taken = s->curr_taken;
+    if (get_disk_io(&s->curr) != 0) {
+        s->nsamples = 0;
+        return -1;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &s->curr_taken);
+    if (s->nsamples < 2)
+        s->nsamples++;
+    return 0;
+}
+
+static int diskio_compute(void *state) {
+    diskio_state_t *s = state;
+    if (s->nsamples < 2)
+        return -1;
+    if (s->curr.n > s->rates_cap) {
+        disk_io_rate_t *r = realloc(s->rates, s->curr.n * sizeof(*r));
+        if (!r) {
+            perror("realloc");
+            return -1;
+        }
+        s->rates = r;
+        s->rates_cap = s->curr.n;
+    }
+    s->nrates = calc_disk_io(&s->prev, &s->curr,
+                             timespec_diff(&s->prev_taken, &s->curr_taken), s->rates);
+    return 0;
+}
+
+// One line per block device.
+static void diskio_render(void *state, FILE *out) {
+    const diskio_state_t *s = state;
+    fprintf(out, "Disk I/O:%s\n", s->nrates ? "" : " none");
+    for (int i = 0; i < s->nrates; i++) {
+        const disk_io_rate_t *r = &s->rates[i];
+        fprintf(out, "  %s: read %.2f MB/s (%.1f IOPS) write %.2f MB/s (%.1f IOPS)"
+                " await %.2f ms queue %.2f util %.2f%%\n",
+                r->name, r->rd_bytes / MB, r->rd_iops, r->wr_bytes / MB, r->wr_iops,
+                r->await_ms, r->queue_depth, r->util);
+    }
+}
+
+static void diskio_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const diskio_state_t *s = state;
+    for (int i = 0; i < s->nrates; i++) {
+        const disk_io_rate_t *r = &s->rates[i];
+        emit(ctx, "diskio_read_bytes_per_second", r->name, r->rd_bytes);
+        emit(ctx, "diskio_write_bytes_per_second", r->name, r->wr_bytes);
+        emit(ctx, "diskio_read_iops", r->name, r->rd_iops);
+        emit(ctx, "diskio_write_iops", r->name, r->wr_iops);
+        emit(ctx, "diskio_await_ms", r->name, r->await_ms);
+        emit(ctx, "diskio_queue_depth", r->name, r->queue_depth);
+        emit(ctx, "diskio_util_percent", r->name, r->util);
+    }
+}
+
+static void diskio_destroy(void *state) {
+    diskio_state_t *s = state;
+    disk_io_free(&s->prev);
+    disk_io_free(&s->curr);
+    free(s->rates);
+    free(s);
+}
+
+const collector_t diskio_collector = {
+    .name = "diskio",
+    .interval_ms = 0,
+    .init = diskio_init,
+    .sample = diskio_sample,
+    .compute = diskio_compute,
+    .render = diskio_render,
+    .destroy = diskio_destroy,
+    .metrics = diskio_metrics,
+};
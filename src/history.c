@@ -0,0 +1,348 @@
+/*
+ * history.c - bsdmon: compressed in-memory metric history
+ *
+ * See history.h.
+ */
+
+#include "history.h"
+#include "series.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+    int64_t t0;             // first sample, stored uncompressed
+    uint64_t v0;
+    uint32_t count;         // samples in the block, including the first
+    uint32_t nbits;         // bits of data in use
+    uint8_t *data;          // HISTORY_BLOCK_SIZE bytes
+} history_block_t;
+
+typedef struct {
+    history_block_t blocks[HISTORY_BLOCKS];
+    int nblocks;            // blocks allocated
+    int head;               // block being written; the oldest follows it
+    // Encoder state for the head block.
+    int64_t last_t;
+    int64_t last_delta;
+    uint64_t last_v;
+    uint8_t lead, trail;    // window of the last XOR stored with a header
+} history_series_t;
+
+struct history {
+    series_table_t table;
+    history_series_t **series;  // by series id
+    uint32_t cap;
+    size_t budget, used;
+    int warned;                 // budget exhaustion already reported
+};
+
+// Worst case of one sample: a 36-bit timestamp and a 77-bit value.
+#define HISTORY_MAX_SAMPLE_BITS 113
+#define HISTORY_NO_WINDOW 0xff
+
+// --- Bit streams ---
+// Bits are packed MSB first; blocks are zeroed before use so writes only OR.
+static void bits_put(uint8_t *buf, uint32_t *pos, uint64_t v, int n) {
+    while (n > 0) {
+        int off = (int)(*pos & 7);
+        int room = 8 - off;
+        int take = n < room ? n : room;
+        uint8_t chunk = (uint8_t)((v >> (n - take)) & ((1u << take) - 1));
+        buf[*pos >> 3] |= (uint8_t)(chunk << (room - take));
+        *pos += (uint32_t)take;
+        n -= take;
+    }
+}
+
+static uint64_t bits_get(const uint8_t *buf, uint32_t *pos, int n) {
+    uint64_t v = 0;
+    while (n > 0) {
+        int off = (int)(*pos & 7);
+        int room = 8 - off;
+        int take = n < room ? n : room;
+        uint8_t chunk = (uint8_t)((buf[*pos >> 3] >> (room - take)) & ((1u << take) - 1));
+        v = (v << take) | chunk;
+        *pos += (uint32_t)take;
+        n -= take;
+    }
+    return v;
+}
+
+static uint64_t double_bits(double d) {
+    uint64_t u;
+    memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static double bits_double(uint64_t u) {
+    double d;
+    memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+// --- Series table ---
+static history_series_t *history_find(const history_t *h, const char *name, const char *label) {
+    int id = series_find(&h->table, NULL, name, label);
+    return id >= 0 ? h->series[id] : NULL;
+}
+
+static history_series_t *history_series(history_t *h, const char *name, const char *label) {
+    int added;
+    int id = series_get(&h->table, NULL, name, label, &added);
+    if (id < 0)
+        return NULL;
+    if (!added)
+        return h->series[id];
+    // A series is only worth its memory if the budget also covers a block.
+    history_series_t *s = NULL;
+    if (h->used + sizeof(*s) + HISTORY_BLOCK_SIZE > h->budget) {
+        series_remove(&h->table, id);
+        return NULL;
+    }
+    if (h->cap < h->table.cap) {
+        history_series_t **p = realloc(h->series, h->table.cap * sizeof(*p));
+        if (p) {
+            h->series = p;
+            h->cap = h->table.cap;
+        }
+    }
+    if ((uint32_t)id < h->cap)
+        s = calloc(1, sizeof(*s));
+    if (!s) {
+        series_remove(&h->table, id);
+        return NULL;
+    }
+    s->head = -1;
+    h->series[id] = s;
+    h->used += sizeof(*s);
+    return s;
+}
+
+void history_remove(history_t *h, const char *name, const char *label) {
+    int id = series_find(&h->table, NULL, name, label);
+    if (id < 0)
+        return;
+    history_series_t *s = h->series[id];
+    for (int j = 0; j < s->nblocks; j++)
+        free(s->blocks[j].data);
+    h->used -= sizeof(*s) + (size_t)s->nblocks * HISTORY_BLOCK_SIZE;
+    free(s);
+    series_remove(&h->table, id);
+}
+
+// --- Encoding ---
+// Move the head to a fresh block: a new one while the ring is growing and the
+// budget allows, otherwise the oldest one.
+static history_block_t *history_next_block(history_t *h, history_series_t *s) {
+    if (s->nblocks < HISTORY_BLOCKS && s->head == s->nblocks - 1 &&
+        h->used + HISTORY_BLOCK_SIZE <= h->budget) {
+        uint8_t *data = malloc(HISTORY_BLOCK_SIZE);
+        if (data) {
+            h->used += HISTORY_BLOCK_SIZE;
+            s->blocks[s->nblocks].data = data;
+            s->head = s->nblocks++;
+            return &s->blocks[s->head];
+        }
+    }
+    if (s->nblocks == 0)
+        return NULL;
+    s->head = (s->head + 1) % s->nblocks;
+    return &s->blocks[s->head];
+}
+
+static void history_start_block(history_series_t *s, history_block_t *b, int64_t t, uint64_t v) {
+    memset(b->data, 0, HISTORY_BLOCK_SIZE);
+    b->t0 = t;
+    b->v0 = v;
+    b->count = 1;
+    b->nbits = 0;
+    s->last_t = t;
+    s->last_delta = 0;
+    s->last_v = v;
+    s->lead = HISTORY_NO_WINDOW;
+    s->trail = 0;
+}
+
+// Delta-of-delta buckets: 0 -> '0', then '10' + 7 bits, '110' + 9 bits,
+// '1110' + 12 bits (biased to be non-negative) and '1111' + 32 bits.
+static void history_put_time(uint8_t *buf, uint32_t *pos, int64_t dod) {
+    if (dod == 0) {
+        bits_put(buf, pos, 0, 1);
+    } else if (dod >= -63 && dod <= 64) {
+        bits_put(buf, pos, 0x2, 2);
+        bits_put(buf, pos, (uint64_t)(dod + 63), 7);
+    } else if (dod >= -255 && dod <= 256) {
+        bits_put(buf, pos, 0x6, 3);
+        bits_put(buf, pos, (uint64_t)(dod + 255), 9);
+    } else if (dod >= -2047 && dod <= 2048) {
+        bits_put(buf, pos, 0xe, 4);
+        bits_put(buf, pos, (uint64_t)(dod + 2047), 12);
+    } else {
+        bits_put(buf, pos, 0xf, 4);
+        bits_put(buf, pos, (uint32_t)(int32_t)dod, 32);
+    }
+}
+
+static int64_t history_get_time(const uint8_t *buf, uint32_t *pos) {
+    if (!bits_get(buf, pos, 1))
+        return 0;
+    if (!bits_get(buf, pos, 1))
+        return (int64_t)bits_get(buf, pos, 7) - 63;
+    if (!bits_get(buf, pos, 1))
+        return (int64_t)bits_get(buf, pos, 9) - 255;
+    if (!bits_get(buf, pos, 1))
+        return (int64_t)bits_get(buf, pos, 12) - 2047;
+    return (int32_t)(uint32_t)bits_get(buf, pos, 32);
+}
+
+// XOR against the previous value: '0' for no change, '10' + the bits inside
+// the previous window, or '11' + 5 bits of leading zeros + 6 bits of length
+// - 1 + the meaningful bits.
+static void history_put_value(history_series_t *s, uint8_t *buf, uint32_t *pos, uint64_t v) {
+    uint64_t x = v ^ s->last_v;
+    if (x == 0) {
+        bits_put(buf, pos, 0, 1);
+        return;
+    }
+    int lead = __builtin_clzll(x), trail = __builtin_ctzll(x);
+    if (lead > 31)
+        lead = 31;
+    if (s->lead != HISTORY_NO_WINDOW && lead >= s->lead && trail >= s->trail) {
+        bits_put(buf, pos, 0x2, 2);
+        bits_put(buf, pos, x >> s->trail, 64 - s->lead - s->trail);
+        return;
+    }
+    int len = 64 - lead - trail;
+    bits_put(buf, pos, 0x3, 2);
+    bits_put(buf, pos, (uint64_t)lead, 5);
+    bits_put(buf, pos, (uint64_t)(len - 1), 6);
+    bits_put(buf, pos, x >> trail, len);
+    s->lead = (uint8_t)lead;
+    s->trail = (uint8_t)trail;
+}
+
+void history_add(history_t *h, int64_t time_ms, const char *name, const char *label,
+                 double value) {
+    history_series_t *s = history_series(h, name, label);
+    if (!s) {
+        if (!h->warned) {
+            fprintf(stderr, "History budget exhausted; new series are not recorded\n");
+            h->warned = 1;
+        }
+        return;
+    }
+    uint64_t v = double_bits(value);
+
+    history_block_t *b = s->head >= 0 ? &s->blocks[s->head] : NULL;
+    int64_t delta = time_ms - s->last_t;
+    int64_t dod = delta - s->last_delta;
+    if (b && (delta < 0 || dod < INT32_MIN || dod > INT32_MAX ||
+              b->nbits + HISTORY_MAX_SAMPLE_BITS > HISTORY_BLOCK_SIZE * 8))
+        b = NULL;
+    if (!b) {
+        if (!(b = history_next_block(h, s)))
+            return;
+        history_start_block(s, b, time_ms, v);
+        return;
+    }
+    history_put_time(b->data, &b->nbits, dod);
+    history_put_value(s, b->data, &b->nbits, v);
+    b->count++;
+    s->last_t = time_ms;
+    s->last_delta = delta;
+    s->last_v = v;
+}
+
+// --- Decoding ---
+static void history_decode(const history_block_t *b, history_visit_t fn, void *ctx) {
+    int64_t t = b->t0, delta = 0;
+    uint64_t v = b->v0;
+    int lead = 0, trail = 0;
+    uint32_t pos = 0;
+    fn(ctx, t, bits_double(v));
+    for (uint32_t i = 1; i < b->count; i++) {
+        delta += history_get_time(b->data, &pos);
+        t += delta;
+        if (bits_get(b->data, &pos, 1)) {
+            if (bits_get(b->data, &pos, 1)) {
+                lead = (int)bits_get(b->data, &pos, 5);
+                int len = (int)bits_get(b->data, &pos, 6) + 1;
+                trail = 64 - lead - len;
+            }
+            v ^= bits_get(b->data, &pos, 64 - lead - trail) << trail;
+        }
+        fn(ctx, t, bits_double(v));
+    }
+}
+
+static void history_visit_series(const history_series_t *s, history_visit_t fn, void *ctx) {
+    for (int i = 1; i <= s->nblocks; i++) {
+        const history_block_t *b = &s->blocks[(s->head + i) % s->nblocks];
+        if (b->count)
+            history_decode(b, fn, ctx);
+    }
+}
+
+int history_read(const history_t *h, const char *name, const char *label,
+                 history_visit_t fn, void *ctx) {
+    const history_series_t *s = history_find(h, name, label);
+    if (!s)
+        return -1;
+    history_visit_series(s, fn, ctx);
+    return 0;
+}
+
+typedef struct {
+    FILE *out;
+    const series_key_t *k;
+} history_dump_ctx_t;
+
+static void history_dump_sample(void *arg, int64_t time_ms, double value) {
+    const history_dump_ctx_t *d = arg;
+    if (d->k->label[0])
+        fprintf(d->out, "%lld %s{%s} %.15g\n", (long long)time_ms, d->k->name, d->k->label, value);
+    else
+        fprintf(d->out, "%lld %s %.15g\n", (long long)time_ms, d->k->name, value);
+}
+
+void history_dump(const history_t *h, FILE *out) {
+    history_dump_ctx_t d = { out, NULL };
+    for (uint32_t id = 0; id < h->table.n; id++) {
+        if (!series_live(&h->table, id))
+            continue;
+        d.k = &h->table.keys[id];
+        history_visit_series(h->series[id], history_dump_sample, &d);
+    }
+}
+
+// --- Lifetime ---
+history_t *history_create(size_t budget) {
+    history_t *h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("calloc");
+        return NULL;
+    }
+    h->budget = budget;
+    return h;
+}
+
+size_t history_memory(const history_t *h) {
+    return h->used;
+}
+
+void history_destroy(history_t *h) {
+    if (!h)
+        return;
+    for (uint32_t id = 0; id < h->table.n; id++) {
+        if (!series_live(&h->table, id))
+            continue;
+        history_series_t *s = h->series[id];
+        for (int j = 0; j < s->nblocks; j++)
+            free(s->blocks[j].data);
+        free(s);
+    }
+    series_table_free(&h->table);
+    free(h->series);
+    free(h);
+}
@@ -0,0 +1,58 @@
+/*
+ * history.h - bsdmon: compressed in-memory metric history
+ *
+ * Every metric series (name plus label, e.g. "diskio_util_percent" on "sda")
+ * keeps its recent samples in a fixed-size ring of blocks compressed the way
+ * Gorilla (Pelkonen et al., VLDB 2015) compresses time series:
+ *
+ *   timestamps  delta-of-delta of the millisecond time, so a steady sampling
+ *               period costs one bit per sample
+ *   values      XOR against the previous double, storing only the bits
+ *               between the leading and trailing zeros; a repeated value
+ *               costs one bit
+ *
+ * Each block starts with an uncompressed first sample, so blocks decode on
+ * their own and the oldest one can be overwritten when the ring is full.
+ * Blocks are allocated as they fill, so idle series cost almost nothing.
+ */
+
+#ifndef BSDMON_HISTORY_H
+#define BSDMON_HISTORY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define HISTORY_BLOCK_SIZE 1024     // bytes of compressed data per block
+#define HISTORY_BLOCKS 32           // blocks per series
+
+typedef struct history history_t;
+
+// Called for every stored sample of a series, oldest first.
+typedef void (*history_visit_t)(void *ctx, int64_t time_ms, double value);
+
+// Create a history that holds at most budget bytes of series and their
+// compressed blocks. Series beyond the budget are not recorded.
+history_t *history_create(size_t budget);
+
+// Append one sample. Samples of a series must arrive in time order.
+void history_add(history_t *h, int64_t time_ms, const char *name, const char *label,
+                 double value);
+
+// Forget a series and free its blocks, e.g. once its collector stopped
+// emitting it.
+void history_remove(history_t *h, const char *name, const char *label);
+
+// Decode the stored samples of one series. Returns -1 if it is unknown.
+int history_read(const history_t *h, const char *name, const char *label,
+                 history_visit_t fn, void *ctx);
+
+// Write every stored sample as "TIME_MS NAME{LABEL} VALUE" lines.
+void history_dump(const history_t *h, FILE *out);
+
+// Bytes currently allocated for series and their compressed blocks.
+size_t history_memory(const history_t *h);
+
+void history_destroy(history_t *h);
+
+#endif
@@ -0,0 +1,207 @@
+/*
+ * json.c - bsdmon: streaming JSON writer
+ *
+ * See json.h.
+ */
+
+#include "json.h"
+
+#include <math.h>
+#include <string.h>
+
+void json_init(json_writer_t *w, FILE *out) {
+    w->out = out;
+    w->len = 0;
+    w->depth = 0;
+    w->has_member = 0;
+}
+
+static void json_drain(json_writer_t *w) {
+    if (w->len)
+        fwrite(w->buf, 1, w->len, w->out);
+    w->len = 0;
+}
+
+static void json_put(json_writer_t *w, const char *s, size_t n) {
+    if (w->len + n > sizeof(w->buf)) {
+        json_drain(w);
+        if (n > sizeof(w->buf)) {
+            fwrite(s, 1, n, w->out);
+            return;
+        }
+    }
+    memcpy(w->buf + w->len, s, n);
+    w->len += n;
+}
+
+static void json_putc(json_writer_t *w, char c) {
+    if (w->len == sizeof(w->buf))
+        json_drain(w);
+    w->buf[w->len++] = c;
+}
+
+// Separate a value from the previous member of its container. A value right
+// after its key (marked in bit 31, above the deepest level) needs no comma.
+#define JSON_AFTER_KEY (1u << 31)
+
+static void json_sep(json_writer_t *w) {
+    if (w->has_member & JSON_AFTER_KEY) {
+        w->has_member &= ~JSON_AFTER_KEY;
+        return;
+    }
+    if (w->depth == 0)
+        return;
+    uint32_t bit = 1u << (w->depth - 1);
+    if (w->has_member & bit)
+        json_putc(w, ',');
+    w->has_member |= bit;
+}
+
+void json_begin_object(json_writer_t *w) {
+    json_sep(w);
+    json_putc(w, '{');
+    if (w->depth < JSON_MAX_DEPTH - 1)
+        w->depth++;
+    w->has_member &= ~(1u << (w->depth - 1));
+}
+
+void json_end_object(json_writer_t *w) {
+    if (w->depth > 0)
+        w->depth--;
+    json_putc(w, '}');
+}
+
+static void json_escape(json_writer_t *w, const char *s) {
+    static const char hex[] = "0123456789abcdef";
+    const char *run = s;
+    for (; *s; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c >= 0x20 && c != '"' && c != '\\')
+            continue;
+        json_put(w, run, (size_t)(s - run));
+        run = s + 1;
+        if (c == '"' || c == '\\') {
+            char esc[2] = { '\\', (char)c };
+            json_put(w, esc, 2);
+        } else if (c == '\n') {
+            json_put(w, "\\n", 2);
+        } else if (c == '\t') {
+            json_put(w, "\\t", 2);
+        } else {
+            char esc[6] = { '\\', 'u', '0', '0', hex[c >> 4], hex[c & 15] };
+            json_put(w, esc, 6);
+        }
+    }
+    json_put(w, run, (size_t)(s - run));
+}
+
+void json_key(json_writer_t *w, const char *key) {
+    json_sep(w);
+    json_putc(w, '"');
+    json_escape(w, key);
+    json_put(w, "\":", 2);
+    w->has_member |= JSON_AFTER_KEY;
+}
+
+void json_key_labelled(json_writer_t *w, const char *name, const char *label) {
+    json_sep(w);
+    json_putc(w, '"');
+    json_escape(w, name);
+    if (label[0]) {
+        json_putc(w, '{');
+        json_escape(w, label);
+        json_putc(w, '}');
+    }
+    json_put(w, "\":", 2);
+    w->has_member |= JSON_AFTER_KEY;
+}
+
+void json_string(json_writer_t *w, const char *s) {
+    json_sep(w);
+    json_putc(w, '"');
+    json_escape(w, s);
+    json_putc(w, '"');
+}
+
+void json_bool(json_writer_t *w, int v) {
+    json_sep(w);
+    if (v)
+        json_put(w, "true", 4);
+    else
+        json_put(w, "false", 5);
+}
+
+// Digits of v, right-aligned so that they end at end.
+static char *json_digits(char *end, uint64_t v) {
+    do {
+        *--end = (char)('0' + v % 10);
+        v /= 10;
+    } while (v);
+    return end;
+}
+
+void json_int(json_writer_t *w, int64_t v) {
+    char tmp[24];
+    char *end = tmp + sizeof(tmp);
+    char *p = json_digits(end, v < 0 ? 0 - (uint64_t)v : (uint64_t)v);
+    if (v < 0)
+        *--p = '-';
+    json_sep(w);
+    json_put(w, p, (size_t)(end - p));
+}
+
+// Whole numbers (byte counts) are written as integers and other values in
+// [1e-3, 1e12) (percentages, rates) with up to six decimals from a scaled
+// integer; only the rest go through printf.
+#define JSON_FRAC_DIGITS 6
+#define JSON_FRAC_SCALE 1000000.0
+
+void json_number(json_writer_t *w, double v) {
+    if (!isfinite(v)) {
+        json_sep(w);
+        json_put(w, "null", 4);
+        return;
+    }
+    double a = v < 0 ? -v : v;
+    if (a < 9e18 && a == (double)(int64_t)a) {
+        json_int(w, (int64_t)v);
+        return;
+    }
+    if (a < 1e-3 || a >= 1e12) {
+        char tmp[32];
+        int n = snprintf(tmp, sizeof(tmp), "%.17g", v);
+        json_sep(w);
+        json_put(w, tmp, (size_t)n);
+        return;
+    }
+
+    uint64_t scaled = (uint64_t)(a * JSON_FRAC_SCALE + 0.5);
+    uint64_t ip = scaled / (uint64_t)JSON_FRAC_SCALE, fp = scaled % (uint64_t)JSON_FRAC_SCALE;
+    char tmp[40];
+    char *end = tmp + sizeof(tmp), *p = end;
+    if (fp) {
+        int digits = JSON_FRAC_DIGITS;
+        while (fp % 10 == 0) {
+            fp /= 10;
+            digits--;
+        }
+        for (int i = 0; i < digits; i++) {
+            *--p = (char)('0' + fp % 10);
+            fp /= 10;
+        }
+        *--p = '.';
+    }
+    p = json_digits(p, ip);
+    if (v < 0 && scaled)
+        *--p = '-';
+    json_sep(w);
+    json_put(w, p, (size_t)(end - p));
+}
+
+void json_flush_line(json_writer_t *w) {
+    json_putc(w, '\n');
+    json_drain(w);
+    fflush(w->out);
+    w->depth = 0;
+    w->has_member = 0;
+}
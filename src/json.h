@@ -0,0 +1,46 @@
+/*
+ * json.h - bsdmon: streaming JSON writer
+ *
+ * Writes JSON into a fixed buffer embedded in the writer and hands full
+ * buffers to a FILE, so producing a document never allocates. Commas are
+ * tracked per nesting level. Numbers in the usual range of metric values are
+ * formatted with integer arithmetic instead of printf.
+ */
+
+#ifndef BSDMON_JSON_H
+#define BSDMON_JSON_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#define JSON_BUFFER_SIZE 8192
+#define JSON_MAX_DEPTH 32
+
+typedef struct {
+    FILE *out;
+    size_t len;
+    int depth;
+    uint32_t has_member;    // bit per level: a value was already written
+    char buf[JSON_BUFFER_SIZE];
+} json_writer_t;
+
+void json_init(json_writer_t *w, FILE *out);
+
+void json_begin_object(json_writer_t *w);
+void json_end_object(json_writer_t *w);
+
+// Object key; the value follows with one of the calls below.
+void json_key(json_writer_t *w, const char *key);
+// Key "name{label}", or "name" when label is empty.
+void json_key_labelled(json_writer_t *w, const char *name, const char *label);
+
+void json_string(json_writer_t *w, const char *s);
+void json_bool(json_writer_t *w, int v);
+void json_int(json_writer_t *w, int64_t v);
+// Non-finite values are written as null.
+void json_number(json_writer_t *w, double v);
+
+// End the current line (for NDJSON) and write everything buffered to out.
+void json_flush_line(json_writer_t *w);
+
+#endif
@@ -2,15 +2,36 @@
  * main.c - bsdmon: a simple CLI system monitor for FreeBSD and Linux (Ubuntu/Debian)
  *
  * Features:
- *  - CPU usage (average over all cores, %)
+ *  - CPU usage (average over all cores and per core, %) with a breakdown of
+ *    every CPU state (user, system, iowait, irq, steal, ...)
  *  - Memory usage (total and used in GB, %)
- *  - Disk usage (of "/" partition, total and used in GB, %)
- *  - Network interface information (name, IPv4 address and mask) excluding localhost.
+ *  - Disk usage (of every mounted filesystem, total and used in GB, %)
+ *  - Disk I/O per block device (throughput, IOPS, latency, queue depth, %util)
+ *  - Network interface information (name, link state, MTU, speed, IPv4 and IPv6
+ *    addresses) excluding localhost.
+ *  - Network I/O per interface (bytes, packets, errors and drops per second)
+ *  - Optionally the processes using the most CPU (--top), memory (--top-mem)
+ *    and disk I/O (--top-io)
+ *  - Reports as text, as one JSON object per line (--json) or as a compact
+ *    binary stream (--binary) that --decode turns back into text or JSON,
+ *    optionally with only the metrics that changed (--delta)
+ *  - Optional Prometheus endpoint serving every metric at /metrics (--listen)
+ *  - Optional shared-memory export of the latest values (--shm, see
+ *    bsdmon_shm.h for the reader)
+ *  - Optional on-disk store of every sample with 1m and 1h rollups, and a
+ *    query mode reading them back (--store, --query)
+ *
+ * Each of these is a collector (see collector.h) sampled on its own period.
+ * By default a single report is printed after a one second sample. With
+ * --interval and/or --count bsdmon keeps running and prints a report on every
+ * report tick of a drift-free monotonic timer, rendering the latest values of
+ * every collector. SIGINT and SIGTERM stop it cleanly (saving the CPU
+ * snapshot); SIGHUP samples every collector immediately.
  *
  * This code minimizes dependencies by using only standard C and OS-native libraries.
  *
- * Compile on Linux: gcc main.c -o bsdmon
- * Compile on FreeBSD: cc main.c -o bsdmon
+ * Compile on Linux: gcc -O2 *.c -o bsdmon -pthread
+ * Compile on FreeBSD: cc -O2 *.c -o bsdmon -pthread
  */
 
 #include <stdio.h>
@@ -18,304 +39,920 @@
 #include <string.h>
 #include <unistd.h>
 #include <errno.h>
-#include <sys/types.h>
-#include <sys/statvfs.h>
-#include <ifaddrs.h>
-#include <arpa/inet.h>
-#include <netinet/in.h>
-#include <net/if.h>
-
-#ifdef __FreeBSD__
-#include <sys/sysctl.h>
-#endif
-
-#ifdef __linux__
-#include <ctype.h>
-#endif
-
-// --- CPU usage ---
-// We define a structure to hold CPU time counters.
+#include <getopt.h>
+#include <stdint.h>
+#include <signal.h>
+#include <time.h>
+#include <math.h>
+
+#include "bsdmon.h"
+#include "bstream.h"
+#include "collector.h"
+#include "delta.h"
+#include "history.h"
+#include "json.h"
+#include "prom.h"
+#include "reactor.h"
+#include "rollup.h"
+#include "shm.h"
+#include "store.h"
+
+// --- Event loop ---
+// Everything after startup happens in reactor callbacks (see reactor.h): a
+// one-shot timer is armed for the scheduler's next deadline, SIGINT/SIGTERM
+// end the run cleanly, SIGHUP samples every collector right away and SIGUSR1
+// dumps the metric history (see history.h). Between events the process
+// sleeps in a single epoll_wait()/kevent() call.
 typedef struct {
-    unsigned long long user;
-    unsigned long long nice;
-    unsigned long long system;
-    unsigned long long idle;
-#ifdef __FreeBSD__
-    unsigned long long intr;  // interrupt time (from kern.cp_times)
-#endif
-} cpu_times_t;
-
-// Function prototypes
-int get_cpu_times(cpu_times_t *times);
-double calc_cpu_usage(const cpu_times_t *prev, const cpu_times_t *curr);
-
-// On Linux, we parse /proc/stat
-#ifdef __linux__
-int get_cpu_times(cpu_times_t *times) {
-    FILE *fp = fopen("/proc/stat", "r");
-    if (!fp) {
-        perror("fopen /proc/stat");
-        return -1;
-    }
-    // The first line begins with "cpu " followed by fields.
-    char buf[256];
-    if (!fgets(buf, sizeof(buf), fp)) {
-        perror("fgets");
-        fclose(fp);
-        return -1;
+    scheduler_t sched;
+    history_t *history;         // NULL with --history-mb 0
+    store_t *store;             // NULL without --store
+    store_t *tiers[ROLLUP_TIERS];   // rollup stores, NULL without --store
+    rollup_t *rollup;
+    shm_export_t *shm;          // NULL without --shm
+    prom_t *prom;               // NULL without --listen
+    long count;                 // reports to print, 0 = unlimited
+    long n;                     // reports printed
+    int json;                   // --json
+    json_writer_t out;          // report writer with --json
+    const char *json_collector; // collector object being written
+    bstream_writer_t *bstream;  // NULL without --binary
+    FILE *bstream_out;
+    delta_t *delta;             // NULL without --delta
+    const char *delta_collector;    // collector of the last value through delta
+    int64_t report_time_ms;     // time of the report being written
+    int failed;                 // writing a report failed, stop
+    int timer;                  // one-shot timer for scheduler_next()
+} monitor_t;
+
+// One point per line, as in the history dump: TIME_MS NAME{LABEL} VALUE.
+static void print_point(int64_t time_ms, const char *name, const char *label, double value) {
+    if (label[0])
+        printf("%lld %s{%s} %.15g\n", (long long)time_ms, name, label, value);
+    else
+        printf("%lld %s %.15g\n", (long long)time_ms, name, value);
+}
+
+// --- JSON reports ---
+// One object per report and line:
+//   {"time_ms":T,"cpu":{"cpu_usage_percent":3.9,"cpu_state_percent{user}":2,...},...}
+// with one member per collector that has values, keyed like the history and
+// store dumps (NAME or NAME{LABEL}).
+static void report_json_metric(void *ctx, const metric_t *mt) {
+    monitor_t *m = ctx;
+    if (!m->json_collector || strcmp(m->json_collector, mt->collector) != 0) {
+        if (m->json_collector)
+            json_end_object(&m->out);
+        json_key(&m->out, mt->collector);
+        json_begin_object(&m->out);
+        m->json_collector = mt->collector;
     }
-    fclose(fp);
+    json_key_labelled(&m->out, mt->name, mt->label);
+    json_number(&m->out, mt->value);
+}
 
-    // Expected format: cpu  user nice system idle iowait irq softirq steal guest guest_nice
-    // We will sum only the first four fields (or five if you want iowait) for simplicity.
-    unsigned long long user, nice, system, idle;
-    // Optionally include iowait: unsigned long long iowait;
-    int ret = sscanf(buf, "cpu  %llu %llu %llu %llu", &user, &nice, &system, &idle);
-    if (ret < 4) {
-        fprintf(stderr, "Failed to parse /proc/stat cpu line\n");
-        return -1;
+// With --delta, keyframes (reports with every metric) carry "keyframe":true.
+static void report_json_begin(monitor_t *m, int64_t time_ms, int keyframe) {
+    json_begin_object(&m->out);
+    json_key(&m->out, "time_ms");
+    json_int(&m->out, time_ms);
+    if (keyframe) {
+        json_key(&m->out, "keyframe");
+        json_bool(&m->out, 1);
     }
-    times->user = user;
-    times->nice = nice;
-    times->system = system;
-    times->idle = idle;
-    return 0;
+    m->json_collector = NULL;
 }
-#endif
 
-// On FreeBSD, we use sysctl "kern.cp_times"
-// Note: kern.cp_times returns an array of (usually 5) counters per CPU core.
-// The order is: CP_USER, CP_NICE, CP_SYS, CP_INTR, CP_IDLE.
-#ifdef __FreeBSD__
+static void report_json_end(monitor_t *m) {
+    if (m->json_collector)
+        json_end_object(&m->out);
+    json_end_object(&m->out);
+    json_flush_line(&m->out);
+}
 
-#ifndef KERN_CP_TIME
-#define KERN_CP_TIME 12
-#endif
+static int64_t now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
 
-#define CPUSTATES 5
+// --- Streamed reports ---
+// Binary, JSON and --delta reports are a stream of metrics rather than the
+// rendered text. --delta (see delta.h) drops the metrics that did not move;
+// as text it prints the remaining ones as points. Series that left the report
+// get a tombstone: NaN in text and binary, null in JSON.
+static void report_write(monitor_t *m, const metric_t *mt) {
+    if (m->bstream) {
+        bstream_add(m->bstream, mt->collector, mt->name, mt->label, mt->value);
+        if (mt->gone)
+            bstream_remove(m->bstream, mt->collector, mt->name, mt->label);
+    } else if (m->json) {
+        report_json_metric(m, mt);
+    } else {
+        print_point(mt->time_ms, mt->name, mt->label, mt->value);
+    }
+}
 
-int get_cpu_times(cpu_times_t *times) {
-    size_t len;
-    int mib[2] = { CTL_KERN, KERN_CP_TIME };
+static void report_gone(void *ctx, const char *collector, const char *name, const char *label) {
+    monitor_t *m = ctx;
+    metric_t mt = { m->report_time_ms, collector, name, label, NAN, 1 };
+    report_write(m, &mt);
+}
 
-    // First, determine the size of the data
-    if (sysctl(mib, 2, NULL, &len, NULL, 0) < 0) {
-        perror("sysctl (get size of kern.cp_times)");
-        return -1;
+static void report_metric(void *ctx, const metric_t *mt) {
+    monitor_t *m = ctx;
+    if (m->delta) {
+        // Tombstones of a collector follow its last value.
+        if (m->delta_collector && m->delta_collector != mt->collector)
+            delta_end(m->delta, m->delta_collector, report_gone, m);
+        m->delta_collector = mt->collector;
+        if (!delta_changed(m->delta, mt->collector, mt->name, mt->label, mt->value))
+            return;
     }
+    report_write(m, mt);
+}
 
-    int num_entries = len / sizeof(long);
-    int num_cpus = num_entries / CPUSTATES;  // CPUSTATES is usually 5
-    long *cp_times = malloc(len);
-    if (!cp_times) {
-        perror("malloc");
-        return -1;
+static void monitor_report(monitor_t *m) {
+    m->n++;
+    if (!m->bstream && !m->json && !m->delta) {
+        if (m->n > 1)
+            printf("\n");
+        scheduler_render(&m->sched, stdout);
+        fflush(stdout);
+        return;
     }
 
-    // Now get the actual CPU times
-    if (sysctl(mib, 2, cp_times, &len, NULL, 0) < 0) {
-        perror("sysctl (get kern.cp_times)");
-        free(cp_times);
-        return -1;
+    int64_t time_ms = now_ms();
+    int keyframe = m->delta && delta_begin(m->delta);
+    if (m->bstream)
+        bstream_begin(m->bstream, time_ms, keyframe);
+    else if (m->json)
+        report_json_begin(m, time_ms, keyframe);
+    m->report_time_ms = time_ms;
+    m->delta_collector = NULL;
+    scheduler_collect(&m->sched, report_metric, m);
+    if (m->delta)
+        delta_end(m->delta, NULL, report_gone, m);
+    if (m->bstream) {
+        if (bstream_end(m->bstream) != 0) {
+            fprintf(stderr, "Failed to write the binary stream\n");
+            m->failed = 1;
+        }
+    } else if (m->json) {
+        report_json_end(m);
+    } else {
+        fflush(stdout);
     }
+}
+
+// Release everything but the reactor. Safe on a partially set up monitor.
+static void monitor_close(monitor_t *m) {
+    scheduler_destroy(&m->sched);
+    prom_destroy(m->prom);
+    shm_export_destroy(m->shm);
+    rollup_destroy(m->rollup);
+    for (int t = 0; t < ROLLUP_TIERS; t++)
+        store_close(m->tiers[t]);
+    store_close(m->store);
+    history_destroy(m->history);
+    delta_destroy(m->delta);
+    bstream_writer_destroy(m->bstream);
+    if (m->bstream_out && m->bstream_out != stdout)
+        fclose(m->bstream_out);
+}
+
+// Hand the values of the samples just taken to the exporters as a whole.
+static void monitor_publish(monitor_t *m) {
+    if (m->shm)
+        shm_export_publish(m->shm);
+    if (m->prom)
+        prom_publish(m->prom);
+}
 
-    // Aggregate values across all CPU cores
-    unsigned long long user = 0, nice = 0, system = 0, intr = 0, idle = 0;
-    for (int i = 0; i < num_cpus; i++) {
-        user   += cp_times[i * CPUSTATES + 0];
-        nice   += cp_times[i * CPUSTATES + 1];
-        system += cp_times[i * CPUSTATES + 2];
-        intr   += cp_times[i * CPUSTATES + 3];
-        idle   += cp_times[i * CPUSTATES + 4];
+static void on_tick(reactor_t *r, void *arg) {
+    monitor_t *m = arg;
+    int report = scheduler_advance(&m->sched, reactor_now_ms());
+    if (m->rollup)
+        rollup_advance(m->rollup, now_ms());
+    monitor_publish(m);
+    if (report) {
+        monitor_report(m);
+        if (m->failed || (m->count && m->n >= m->count)) {
+            reactor_stop(r);
+            return;
+        }
     }
+    if (reactor_set_deadline(r, m->timer, scheduler_next(&m->sched)) != 0)
+        reactor_stop(r);
+}
+
+static void on_terminate(reactor_t *r, int signo, void *arg) {
+    (void)signo;
+    (void)arg;
+    reactor_stop(r);
+}
+
+// SIGUSR1 writes the recorded history to stderr.
+static void on_dump(reactor_t *r, int signo, void *arg) {
+    (void)r;
+    (void)signo;
+    monitor_t *m = arg;
+    history_dump(m->history, stderr);
+    fflush(stderr);
+}
+
+// Series that went away (see collector.h) are dropped from every sink that
+// keeps state for them; the stores keep what was already written.
+static void record_history(void *ctx, const metric_t *m) {
+    if (m->gone)
+        history_remove(ctx, m->name, m->label);
+    else
+        history_add(ctx, m->time_ms, m->name, m->label, m->value);
+}
+
+// Values of one tick are published together, see monitor_publish().
+static void record_shm(void *ctx, const metric_t *m) {
+    if (m->gone)
+        shm_export_remove(ctx, m->name, m->label);
+    else
+        shm_export_set(ctx, m->time_ms, m->name, m->label, m->value);
+}
 
-    // Free the allocated memory
-    free(cp_times);
+static void record_prom(void *ctx, const metric_t *m) {
+    if (m->gone)
+        prom_remove(ctx, m->name, m->label);
+    else
+        prom_set(ctx, m->time_ms, m->collector, m->name, m->label, m->value);
+}
 
-    // Store the aggregated CPU times
-    times->user = user;
-    times->nice = nice;
-    times->system = system;
-    times->intr = intr;
-    times->idle = idle;
+static void record_store(void *ctx, const metric_t *m) {
+    if (!m->gone)
+        store_append(ctx, m->time_ms, m->name, m->label, m->value);
+}
+
+// Reports write the binary stream; this only frees the ids of gone series.
+static void record_bstream(void *ctx, const metric_t *m) {
+    if (m->gone)
+        bstream_remove(ctx, m->collector, m->name, m->label);
+}
 
+// Seed the in-memory history from the store, so it covers the time before
+// a restart.
+static int replay_store(void *ctx, const store_segment_t *seg, const store_record_t *recs,
+                        size_t n) {
+    int64_t base = store_segment_base(seg);
+    for (size_t i = 0; i < n; i++) {
+        const char *name, *label;
+        store_segment_series(seg, recs[i].series, &name, &label);
+        history_add(ctx, base + recs[i].dt_ms, name, label, recs[i].value);
+    }
     return 0;
 }
-#endif
-
-// Compute CPU usage percent between two samples.
-double calc_cpu_usage(const cpu_times_t *prev, const cpu_times_t *curr) {
-    unsigned long long prev_active, curr_active, prev_total, curr_total;
-#ifdef __FreeBSD__
-    // On FreeBSD we include intr time in active
-    prev_active = prev->user + prev->nice + prev->system + prev->intr;
-    curr_active = curr->user + curr->nice + curr->system + curr->intr;
-#else
-    prev_active = prev->user + prev->nice + prev->system;
-    curr_active = curr->user + curr->nice + curr->system;
-#endif
-    prev_total = prev_active + prev->idle;
-    curr_total = curr_active + curr->idle;
-
-    unsigned long long total_delta = curr_total - prev_total;
-    unsigned long long active_delta = curr_active - prev_active;
-    if (total_delta == 0) return 0.0;
-    return ((double)active_delta / total_delta) * 100.0;
-}
-
-// --- Memory usage ---
-// On Linux: parse /proc/meminfo for MemTotal and MemAvailable.
-// On FreeBSD: use sysctl to get hw.physmem and free pages count.
-#ifdef __linux__
-int get_memory_usage(double *used_gb, double *total_gb, double *percent_used) {
-    FILE *fp = fopen("/proc/meminfo", "r");
-    if (!fp) {
-        perror("fopen /proc/meminfo");
+
+#define STORE_REPLAY_MS (3600 * 1000)
+
+// --- Rollups ---
+// With --store every sample is also folded into 1m and 1h buckets (see
+// rollup.h). Finished buckets are appended to their own stores in DIR/1m and
+// DIR/1h at the bucket start time, as one series per statistic:
+// NAME.min, NAME.max, NAME.avg and NAME.last, with the original label.
+//
+// Per-process series (labelled PID:COMM by the proc, procio and procmem
+// collectors) stay out of the tiers: they last minutes, each would take four
+// dictionary keys per tier segment, and long-range queries are about the
+// host, whose process totals are still rolled up.
+static const char *const rollup_stats[] = { "min", "max", "avg", "last" };
+#define ROLLUP_STATS (sizeof(rollup_stats) / sizeof(rollup_stats[0]))
+
+static void record_rollup(void *ctx, const metric_t *m) {
+    if (m->label[0] && strncmp(m->collector, "proc", 4) == 0)
+        return;
+    if (m->gone)
+        rollup_remove(ctx, m->name, m->label);
+    else
+        rollup_add(ctx, m->time_ms, m->name, m->label, m->value);
+}
+
+static void store_rollup(void *ctx, int tier, const char *name, const char *label,
+                         const rollup_bucket_t *b) {
+    monitor_t *m = ctx;
+    double values[ROLLUP_STATS] = { b->min, b->max, b->sum / (double)b->count, b->last };
+    char key[STORE_KEY_SIZE];
+    for (size_t i = 0; i < ROLLUP_STATS; i++) {
+        if (snprintf(key, sizeof(key), "%s.%s", name, rollup_stats[i]) >= (int)sizeof(key))
+            return;
+        store_append(m->tiers[tier], b->start_ms, key, label, values[i]);
+    }
+}
+
+// The tier stores get a quarter and an eighth of the raw store's budget.
+static store_t *open_tier(const bsdmon_options_t *opts, int tier, int flags) {
+    char path[4096];
+    if (snprintf(path, sizeof(path), "%s/%s", opts->store_dir, rollup_tier_names[tier]) >=
+        (int)sizeof(path)) {
+        fprintf(stderr, "Store path too long\n");
+        return NULL;
+    }
+    return store_open(path, ((size_t)opts->store_mb << 20) >> (2 + tier), flags);
+}
+
+// --- Queries ---
+// --query prints the stored points of one metric over the last --since
+// seconds and exits. Short ranges read the raw samples; longer ones read the
+// coarsest tier that still gives a useful resolution, so a week-long query
+// reads a few points per hour instead of every sample.
+typedef struct {
+    char name[STORE_KEY_SIZE];
+    const char *label;          // NULL matches every label
+    int tier;                   // -1 for the raw samples
+    const store_segment_t *seg; // segment the match table was built for
+    uint8_t match[STORE_MAX_SERIES];
+} query_t;
+
+static int query_parse(query_t *q, const char *arg) {
+    if (strlen(arg) >= sizeof(q->name)) {
+        fprintf(stderr, "Query too long: %s\n", arg);
         return -1;
     }
-    char line[256];
-    unsigned long mem_total = 0, mem_available = 0;
-    while (fgets(line, sizeof(line), fp)) {
-        if (sscanf(line, "MemTotal: %lu kB", &mem_total) == 1)
-            continue;
-        if (sscanf(line, "MemAvailable: %lu kB", &mem_available) == 1)
-            continue;
+    strcpy(q->name, arg);
+    q->label = NULL;
+    char *brace = strchr(q->name, '{');
+    if (brace) {
+        size_t len = strlen(brace);
+        if (brace[len - 1] != '}') {
+            fprintf(stderr, "Invalid query: %s\n", arg);
+            return -1;
+        }
+        brace[len - 1] = '\0';
+        *brace = '\0';
+        q->label = brace + 1;
     }
-    fclose(fp);
-    if (mem_total == 0) {
-        fprintf(stderr, "Failed to get MemTotal\n");
+    if (!q->name[0]) {
+        fprintf(stderr, "Invalid query: %s\n", arg);
         return -1;
     }
-    // Convert kB to GB.
-    *total_gb = mem_total / 1024.0 / 1024.0;
-    unsigned long mem_used = mem_total - mem_available;
-    *used_gb = mem_used / 1024.0 / 1024.0;
-    *percent_used = ((double)mem_used / mem_total) * 100.0;
     return 0;
 }
-#endif
 
-#ifdef __FreeBSD__
-#include <sys/param.h>
-#include <sys/mount.h>
-int get_memory_usage(double *used_gb, double *total_gb, double *percent_used) {
-    unsigned long total_mem = 0;
-    size_t len = sizeof(total_mem);
-    if (sysctlbyname("hw.physmem", &total_mem, &len, NULL, 0) < 0) {
-        perror("sysctl hw.physmem");
+static int query_match(const query_t *q, const char *name, const char *label) {
+    if (q->label && strcmp(label, q->label) != 0)
+        return 0;
+    if (q->tier < 0)
+        return strcmp(name, q->name) == 0;
+    size_t len = strlen(q->name);
+    if (strncmp(name, q->name, len) != 0 || name[len] != '.')
+        return 0;
+    for (size_t i = 0; i < ROLLUP_STATS; i++)
+        if (strcmp(name + len + 1, rollup_stats[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static int query_print(void *ctx, const store_segment_t *seg, const store_record_t *recs,
+                       size_t n) {
+    query_t *q = ctx;
+    // Series ids are per segment; resolve them once per segment.
+    if (q->seg != seg) {
+        for (uint32_t id = 0; id < STORE_MAX_SERIES; id++) {
+            const char *name, *label;
+            store_segment_series(seg, id, &name, &label);
+            q->match[id] = name[0] && query_match(q, name, label);
+        }
+        q->seg = seg;
+    }
+    int64_t base = store_segment_base(seg);
+    for (size_t i = 0; i < n; i++) {
+        if (recs[i].series >= STORE_MAX_SERIES || !q->match[recs[i].series])
+            continue;
+        const char *name, *label;
+        store_segment_series(seg, recs[i].series, &name, &label);
+        print_point(base + recs[i].dt_ms, name, label, recs[i].value);
+    }
+    return 0;
+}
+
+#define QUERY_RAW_MAX_MS (2 * 3600 * 1000LL)
+#define QUERY_1M_MAX_MS (2 * 86400 * 1000LL)
+
+static int run_query(const bsdmon_options_t *opts) {
+    static query_t q;
+    if (query_parse(&q, opts->query) != 0)
+        return -1;
+    int64_t range_ms = (int64_t)(opts->since * 1000.0);
+    q.tier = range_ms <= QUERY_RAW_MAX_MS ? -1
+             : range_ms <= QUERY_1M_MAX_MS ? ROLLUP_1M
+                                           : ROLLUP_1H;
+    store_t *s = q.tier < 0
+        ? store_open(opts->store_dir, (size_t)opts->store_mb << 20, STORE_READONLY)
+        : open_tier(opts, q.tier, STORE_READONLY);
+    if (!s)
         return -1;
+    int64_t to = now_ms();
+    store_read(s, to - range_ms, to, query_print, &q);
+    store_close(s);
+    return 0;
+}
+
+// --- Decoding ---
+// --decode prints a binary stream (see bstream.h) as text points or, with
+// --json, as the JSON reports the ticks were recorded from.
+static void decode_text(void *ctx, int64_t time_ms, int keyframe, const bstream_value_t *values,
+                        size_t n) {
+    (void)ctx;
+    (void)keyframe;
+    for (size_t i = 0; i < n; i++)
+        print_point(time_ms, values[i].name, values[i].label, values[i].value);
+}
+
+static void decode_json(void *ctx, int64_t time_ms, int keyframe, const bstream_value_t *values,
+                        size_t n) {
+    monitor_t *m = ctx;
+    report_json_begin(m, time_ms, keyframe);
+    for (size_t i = 0; i < n; i++) {
+        metric_t mt = { time_ms, values[i].collector, values[i].name, values[i].label,
+                        values[i].value, 0 };
+        report_json_metric(m, &mt);
     }
-    // Get page size.
-    long page_size = sysconf(_SC_PAGESIZE);
-    if (page_size < 0) {
-        perror("sysconf _SC_PAGESIZE");
+    report_json_end(m);
+}
+
+static int run_decode(const bsdmon_options_t *opts) {
+    FILE *in = strcmp(opts->decode_path, "-") == 0 ? stdin : fopen(opts->decode_path, "rb");
+    if (!in) {
+        perror(opts->decode_path);
         return -1;
     }
-    // Get free pages count.
-    unsigned long free_pages = 0;
-    len = sizeof(free_pages);
-    if (sysctlbyname("vm.stats.vm.v_free_count", &free_pages, &len, NULL, 0) < 0) {
-        perror("sysctl vm.stats.vm.v_free_count");
+    static monitor_t m;
+    json_init(&m.out, stdout);
+    int status = bstream_decode(in, opts->json ? decode_json : decode_text, &m);
+    if (in != stdin)
+        fclose(in);
+    fflush(stdout);
+    return status;
+}
+
+static void on_hangup(reactor_t *r, int signo, void *arg) {
+    (void)r;
+    (void)signo;
+    monitor_t *m = arg;
+    scheduler_prime(&m->sched);
+    monitor_publish(m);
+}
+
+static void usage(const char *prog) {
+    fprintf(stderr,
+            "Usage: %s [-i SECONDS] [-c COUNT] [-P] [-s] [--snapshot-path PATH]\n"
+            "          [--max-age SECONDS] [--disk-timeout MS] [--every NAME=SECONDS]...\n"
+            "          [-t N] [--top-mem N] [--top-io N] [--proc-threads N]\n"
+            "          [--history-mb MB] [--listen [HOST:]PORT] [--shm NAME]\n"
+            "          [--store DIR [--store-mb MB] [--query NAME [--since SECONDS]]]\n"
+            "          [-j] [-b FILE] [-d [--epsilon E[%%]] [--keyframe N]]\n"
+            "       %s --decode FILE [-j]\n"
+            "  -i, --interval SECONDS  print a report every SECONDS (default 1)\n"
+            "  -c, --count COUNT       stop after COUNT reports (default 1, or\n"
+            "                          unlimited when only --interval is given)\n"
+            "  -P, --per-core          also print usage of every CPU core\n"
+            "  -t, --top N             also print the N processes using the most CPU\n"
+            "      --top-mem N         also print the N processes using the most memory\n"
+            "                          (by PSS, with swap and anon/file split)\n"
+            "      --top-io N          also print the N processes reading and writing the\n"
+            "                          most bytes from storage\n"
+            "      --proc-threads N    read the processes of --top on N threads (default\n"
+            "                          one per CPU, up to 8)\n"
+            "  -s, --snapshot          compute the first report against the CPU sample\n"
+            "                          saved by the previous run instead of waiting\n"
+            "      --snapshot-path PATH  snapshot file (implies -s)\n"
+            "      --max-age SECONDS   ignore snapshots older than this (default 60)\n"
+            "      --disk-timeout MS   report a mount as timed out when statvfs takes\n"
+            "                          longer than MS milliseconds (default 500)\n"
+            "      --every NAME=SECONDS  sample collector NAME every SECONDS instead of\n"
+            "                          its default (cpu, memory, diskio, net, proc and\n"
+            "                          procio once per report, disk and procmem every 10\n"
+            "                          seconds)\n"
+            "      --history-mb MB     keep up to MB megabytes of compressed metric\n"
+            "                          history, dumped to stderr on SIGUSR1 (default 8,\n"
+            "                          0 disables)\n"
+            "      --listen [HOST:]PORT  serve every metric to Prometheus at\n"
+            "                          http://HOST:PORT/metrics\n"
+            "      --shm NAME          publish the latest value of every metric in the\n"
+            "                          POSIX shared-memory object NAME (e.g. /bsdmon),\n"
+            "                          read with the seqlock reader in bsdmon_shm.h\n"
+            "      --store DIR         also append every sample to memory-mapped segment\n"
+            "                          files in DIR; the last hour is loaded back into\n"
+            "                          the history on the next start\n"
+            "      --store-mb MB       delete the oldest segments beyond MB megabytes\n"
+            "                          (default 256); 1m and 1h rollups of every metric\n"
+            "                          but the per-process ones are kept in DIR/1m and\n"
+            "                          DIR/1h\n"
+            "      --query NAME[{LABEL}]  print the points of metric NAME stored in\n"
+            "                          --store DIR and exit: raw samples for up to two\n"
+            "                          hours, 1m rollups for up to two days, 1h beyond\n"
+            "      --since SECONDS     range of --query before now (default 3600)\n"
+            "  -j, --json              print every report as one JSON object per line\n"
+            "  -b, --binary FILE       write every report to FILE (- for stdout) in the\n"
+            "                          compact binary stream format instead\n"
+            "  -d, --delta             with -j, -b or text points: report only the metrics\n"
+            "                          that changed since they were last reported, and\n"
+            "                          metrics that went away once as null (nan in text)\n"
+            "      --epsilon E[%%]      ignore changes up to E, or up to E percent of the\n"
+            "                          last reported value (default 0)\n"
+            "      --keyframe N        with --delta, report every metric every N reports\n"
+            "                          (default 60)\n"
+            "      --decode FILE       print the binary stream FILE (- for stdin) as text,\n"
+            "                          or as JSON with --json, and exit\n"
+            "  -h, --help              show this help\n",
+            prog, prog);
+}
+
+// Parse a whole number in [min, max]; what names it in the error message.
+static int parse_count(const char *arg, long min, long max, const char *what, int *out) {
+    char *end;
+    errno = 0;
+    long n = strtol(arg, &end, 10);
+    if (errno || *end || end == arg || n < min || n > max) {
+        fprintf(stderr, "Invalid %s: %s\n", what, arg);
         return -1;
     }
-    unsigned long free_mem = free_pages * page_size;
-    unsigned long used_mem = total_mem > free_mem ? total_mem - free_mem : 0;
-    *total_gb = total_mem / 1024.0 / 1024.0 / 1024.0;
-    *used_gb = used_mem / 1024.0 / 1024.0 / 1024.0;
-    *percent_used = ((double)used_mem / total_mem) * 100.0;
+    *out = (int)n;
     return 0;
 }
-#endif
 
-// --- Disk usage ---
-// We use statvfs on the "/" mount point.
-int get_disk_usage(double *used_gb, double *total_gb, double *percent_used) {
-    struct statvfs vfs;
-    if (statvfs("/", &vfs) < 0) {
-        perror("statvfs");
+// Parse NAME=SECONDS into the next per-collector override.
+static int parse_every(bsdmon_options_t *opts, const char *arg) {
+    const char *eq = strchr(arg, '=');
+    if (!eq || eq == arg || (size_t)(eq - arg) >= sizeof(opts->every[0].name)) {
+        fprintf(stderr, "Invalid --every: %s\n", arg);
         return -1;
     }
-    unsigned long long total = vfs.f_blocks * vfs.f_frsize;
-    unsigned long long free = vfs.f_bfree * vfs.f_frsize;
-    unsigned long long used = total - free;
-    *total_gb = total / 1024.0 / 1024.0 / 1024.0;
-    *used_gb = used / 1024.0 / 1024.0 / 1024.0;
-    *percent_used = total ? ((double)used / total) * 100.0 : 0.0;
+    char name[sizeof(opts->every[0].name)];
+    memcpy(name, arg, (size_t)(eq - arg));
+    name[eq - arg] = '\0';
+    if (!collector_find(name)) {
+        fprintf(stderr, "Unknown collector: %s\n", name);
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    double sec = strtod(eq + 1, &end);
+    if (errno || *end || end == eq + 1 || !(sec >= 0.001) || sec > 86400) {
+        fprintf(stderr, "Invalid interval for %s: %s\n", name, eq + 1);
+        return -1;
+    }
+    int slot;
+    for (slot = 0; slot < opts->nevery; slot++)
+        if (strcmp(opts->every[slot].name, name) == 0)
+            break;
+    if (slot == BSDMON_MAX_OVERRIDES) {
+        fprintf(stderr, "Too many --every options\n");
+        return -1;
+    }
+    if (slot == opts->nevery)
+        opts->nevery++;
+    strcpy(opts->every[slot].name, name);
+    opts->every[slot].interval_ms = (int)(sec * 1000.0 + 0.5);
     return 0;
 }
 
-// --- Network interfaces ---
-// Use getifaddrs to list interfaces with an IPv4 address,
-// ignoring the loopback interface.
-void print_network_interfaces(void) {
-    struct ifaddrs *ifaddr, *ifa;
-    // Get list of network interfaces
-    if (getifaddrs(&ifaddr) < 0) {
-        perror("getifaddrs");
-        return;
+enum {
+    OPT_SNAPSHOT_PATH = 256,
+    OPT_MAX_AGE,
+    OPT_DISK_TIMEOUT,
+    OPT_EVERY,
+    OPT_HISTORY_MB,
+    OPT_STORE,
+    OPT_STORE_MB,
+    OPT_QUERY,
+    OPT_SINCE,
+    OPT_SHM,
+    OPT_LISTEN,
+    OPT_DECODE,
+    OPT_EPSILON,
+    OPT_KEYFRAME,
+    OPT_PROC_THREADS,
+    OPT_TOP_MEM,
+    OPT_TOP_IO,
+};
+
+int main(int argc, char **argv) {
+    bsdmon_options_t opts;
+    memset(&opts, 0, sizeof(opts));
+    opts.interval = 1.0;
+    opts.count = 1;
+    opts.max_age = 60.0;
+    opts.disk_timeout_ms = 500;
+    opts.history_mb = 8;
+    opts.store_mb = 256;
+    opts.since = 3600.0;
+    opts.keyframe = 60;
+    int have_interval = 0, have_count = 0;
+
+    collector_register_builtin();
+
+    static const struct option long_opts[] = {
+        { "interval",      required_argument, NULL, 'i' },
+        { "count",         required_argument, NULL, 'c' },
+        { "per-core",      no_argument,       NULL, 'P' },
+        { "top",           required_argument, NULL, 't' },
+        { "top-mem",       required_argument, NULL, OPT_TOP_MEM },
+        { "top-io",        required_argument, NULL, OPT_TOP_IO },
+        { "proc-threads",  required_argument, NULL, OPT_PROC_THREADS },
+        { "snapshot",      no_argument,       NULL, 's' },
+        { "snapshot-path", required_argument, NULL, OPT_SNAPSHOT_PATH },
+        { "max-age",       required_argument, NULL, OPT_MAX_AGE },
+        { "disk-timeout",  required_argument, NULL, OPT_DISK_TIMEOUT },
+        { "every",         required_argument, NULL, OPT_EVERY },
+        { "history-mb",    required_argument, NULL, OPT_HISTORY_MB },
+        { "store",         required_argument, NULL, OPT_STORE },
+        { "store-mb",      required_argument, NULL, OPT_STORE_MB },
+        { "query",         required_argument, NULL, OPT_QUERY },
+        { "since",         required_argument, NULL, OPT_SINCE },
+        { "shm",           required_argument, NULL, OPT_SHM },
+        { "listen",        required_argument, NULL, OPT_LISTEN },
+        { "json",          no_argument,       NULL, 'j' },
+        { "binary",        required_argument, NULL, 'b' },
+        { "decode",        required_argument, NULL, OPT_DECODE },
+        { "delta",         no_argument,       NULL, 'd' },
+        { "epsilon",       required_argument, NULL, OPT_EPSILON },
+        { "keyframe",      required_argument, NULL, OPT_KEYFRAME },
+        { "help",          no_argument,       NULL, 'h' },
+        { NULL, 0, NULL, 0 }
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "i:c:Pt:sjb:dh", long_opts, NULL)) != -1) {
+        char *end;
+        switch (opt) {
+        case 'i':
+            errno = 0;
+            opts.interval = strtod(optarg, &end);
+            if (errno || *end || !(opts.interval >= 0.001) || opts.interval > 86400) {
+                fprintf(stderr, "Invalid interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            have_interval = 1;
+            break;
+        case 'c':
+            errno = 0;
+            opts.count = strtol(optarg, &end, 10);
+            if (errno || *end || opts.count < 1) {
+                fprintf(stderr, "Invalid count: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            have_count = 1;
+            break;
+        case 'P':
+            opts.per_core = 1;
+            break;
+        case 't':
+            if (parse_count(optarg, 0, 1000, "process count", &opts.top) != 0)
+                return EXIT_FAILURE;
+            break;
+        case OPT_TOP_MEM:
+            if (parse_count(optarg, 0, 1000, "process count", &opts.top_mem) != 0)
+                return EXIT_FAILURE;
+            break;
+        case OPT_TOP_IO:
+            if (parse_count(optarg, 0, 1000, "process count", &opts.top_io) != 0)
+                return EXIT_FAILURE;
+            break;
+        case OPT_PROC_THREADS:
+            if (parse_count(optarg, 1, 64, "thread count", &opts.proc_threads) != 0)
+                return EXIT_FAILURE;
+            break;
+        case 's':
+            opts.use_snapshot = 1;
+            break;
+        case 'j':
+            opts.json = 1;
+            break;
+        case 'b':
+            opts.binary_path = optarg;
+            break;
+        case OPT_DECODE:
+            opts.decode_path = optarg;
+            break;
+        case 'd':
+            opts.delta = 1;
+            break;
+        case OPT_EPSILON:
+            errno = 0;
+            opts.epsilon = strtod(optarg, &end);
+            opts.epsilon_relative = *end == '%';
+            if (opts.epsilon_relative) {
+                end++;
+                opts.epsilon /= 100.0;
+            }
+            if (errno || *end || end == optarg || !(opts.epsilon >= 0)) {
+                fprintf(stderr, "Invalid epsilon: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_KEYFRAME:
+            errno = 0;
+            opts.keyframe = strtol(optarg, &end, 10);
+            if (errno || *end || opts.keyframe < 1) {
+                fprintf(stderr, "Invalid keyframe interval: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_SNAPSHOT_PATH:
+            if (strlen(optarg) >= sizeof(opts.snapshot_path) - 8) {
+                fprintf(stderr, "Snapshot path too long\n");
+                return EXIT_FAILURE;
+            }
+            strcpy(opts.snapshot_path, optarg);
+            opts.use_snapshot = 1;
+            break;
+        case OPT_MAX_AGE:
+            errno = 0;
+            opts.max_age = strtod(optarg, &end);
+            if (errno || *end || !(opts.max_age > 0)) {
+                fprintf(stderr, "Invalid max age: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_DISK_TIMEOUT:
+            if (parse_count(optarg, 1, 600000, "disk timeout", &opts.disk_timeout_ms) != 0)
+                return EXIT_FAILURE;
+            break;
+        case OPT_EVERY:
+            if (parse_every(&opts, optarg) != 0)
+                return EXIT_FAILURE;
+            break;
+        case OPT_HISTORY_MB:
+            errno = 0;
+            opts.history_mb = strtol(optarg, &end, 10);
+            if (errno || *end || opts.history_mb < 0 || opts.history_mb > 65536) {
+                fprintf(stderr, "Invalid history size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_STORE:
+            opts.store_dir = optarg;
+            break;
+        case OPT_STORE_MB:
+            errno = 0;
+            opts.store_mb = strtol(optarg, &end, 10);
+            if (errno || *end || opts.store_mb < 1 || opts.store_mb > (1L << 24)) {
+                fprintf(stderr, "Invalid store size: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_QUERY:
+            opts.query = optarg;
+            break;
+        case OPT_SINCE:
+            errno = 0;
+            opts.since = strtod(optarg, &end);
+            if (errno || *end || !(opts.since > 0) || opts.since > 10 * 365 * 86400.0) {
+                fprintf(stderr, "Invalid range: %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            break;
+        case OPT_SHM:
+            if (optarg[0] != '/' || strchr(optarg + 1, '/')) {
+                fprintf(stderr, "Invalid shared-memory name (expected /NAME): %s\n", optarg);
+                return EXIT_FAILURE;
+            }
+            opts.shm_name = optarg;
+            break;
+        case OPT_LISTEN:
+            opts.listen_addr = optarg;
+            break;
+        case 'h':
+            usage(argv[0]);
+            return EXIT_SUCCESS;
+        default:
+            usage(argv[0]);
+            return EXIT_FAILURE;
+        }
     }
-    printf("Network interfaces:\n");
-    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
-        // We only want interfaces with an address.
-        if (!ifa->ifa_addr)
-            continue;
-        if (ifa->ifa_addr->sa_family != AF_INET)
-            continue;
-        // Filter out loopback (by flag or name)
-        if (ifa->ifa_flags & IFF_LOOPBACK)
-            continue;
-        // (Alternatively, filter by name: if (strcmp(ifa->ifa_name, "lo") == 0) continue;)
-        char ip[INET_ADDRSTRLEN];
-        char netmask[INET_ADDRSTRLEN];
-        struct sockaddr_in *addr = (struct sockaddr_in *)ifa->ifa_addr;
-        struct sockaddr_in *mask = (struct sockaddr_in *)ifa->ifa_netmask;
-        if (!inet_ntop(AF_INET, &addr->sin_addr, ip, sizeof(ip)))
-            continue;
-        if (!inet_ntop(AF_INET, &mask->sin_addr, netmask, sizeof(netmask)))
-            continue;
-        printf("  %s: %s (mask: %s)\n", ifa->ifa_name, ip, netmask);
+    if (optind < argc) {
+        usage(argv[0]);
+        return EXIT_FAILURE;
     }
-    freeifaddrs(ifaddr);
-}
+    // --interval alone means "run until interrupted".
+    if (have_interval && !have_count)
+        opts.count = 0;
 
-int main(void) {
-    printf("bsdmon - System Monitor\n");
-    printf("=======================\n");
+    if (opts.query) {
+        if (!opts.store_dir) {
+            fprintf(stderr, "--query needs --store\n");
+            return EXIT_FAILURE;
+        }
+        return run_query(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+    if (opts.decode_path)
+        return run_decode(&opts) == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
 
-    // CPU usage: take two samples one second apart.
-    cpu_times_t prev, curr;
-    if (get_cpu_times(&prev) != 0) {
-        fprintf(stderr, "Failed to get initial CPU times\n");
+    if (!opts.json && !opts.binary_path && !opts.delta) {
+        printf("bsdmon - System Monitor\n");
+        printf("=======================\n");
+    }
+
+    // Signals must be routed to the reactor before any collector starts a
+    // thread, so that the threads inherit the blocked mask.
+    static monitor_t m;
+    m.count = opts.count;
+    m.json = opts.json;
+    json_init(&m.out, stdout);
+    if (opts.delta &&
+        !(m.delta = delta_create(opts.epsilon, opts.epsilon_relative, opts.keyframe)))
         return EXIT_FAILURE;
+    if (opts.binary_path) {
+        m.bstream_out = strcmp(opts.binary_path, "-") == 0 ? stdout
+                                                            : fopen(opts.binary_path, "wb");
+        if (!m.bstream_out) {
+            perror(opts.binary_path);
+            return EXIT_FAILURE;
+        }
+        if (!(m.bstream = bstream_writer_create(m.bstream_out))) {
+            monitor_close(&m);
+            return EXIT_FAILURE;
+        }
     }
-    sleep(1);
-    if (get_cpu_times(&curr) != 0) {
-        fprintf(stderr, "Failed to get CPU times\n");
+    reactor_t *reactor = reactor_create();
+    if (!reactor ||
+        reactor_add_signal(reactor, SIGINT, on_terminate, &m) != 0 ||
+        reactor_add_signal(reactor, SIGTERM, on_terminate, &m) != 0 ||
+        reactor_add_signal(reactor, SIGHUP, on_hangup, &m) != 0) {
+        reactor_destroy(reactor);
         return EXIT_FAILURE;
     }
-    double cpu_usage = calc_cpu_usage(&prev, &curr);
-    printf("CPU Usage: %.2f%%\n", cpu_usage);
-
-    // Memory usage
-    double mem_used_gb, mem_total_gb, mem_percent;
-    if (get_memory_usage(&mem_used_gb, &mem_total_gb, &mem_percent) == 0) {
-        printf("Memory Usage: %.2f GB / %.2f GB (%.2f%% used)\n",
-               mem_used_gb, mem_total_gb, mem_percent);
-    } else {
-        printf("Memory Usage: Error retrieving information\n");
+    // History only matters to a process that keeps running.
+    if (opts.history_mb && opts.count != 1) {
+        if (!(m.history = history_create((size_t)opts.history_mb << 20)) ||
+            reactor_add_signal(reactor, SIGUSR1, on_dump, &m) != 0) {
+            history_destroy(m.history);
+            reactor_destroy(reactor);
+            return EXIT_FAILURE;
+        }
     }
 
-    // Disk usage
-    double disk_used_gb, disk_total_gb, disk_percent;
-    if (get_disk_usage(&disk_used_gb, &disk_total_gb, &disk_percent) == 0) {
-        printf("Disk Usage (\"/\"): %.2f GB / %.2f GB (%.2f%% used)\n",
-               disk_used_gb, disk_total_gb, disk_percent);
-    } else {
-        printf("Disk Usage: Error retrieving information\n");
+    // Every collector takes its first sample now. Rates (CPU usage, I/O) are
+    // reportable once a collector has a second sample, unless the CPU
+    // collector restored its previous one from the snapshot file, in which
+    // case the first report is printed right away.
+    if (scheduler_init(&m.sched, &opts) != 0) {
+        history_destroy(m.history);
+        reactor_destroy(reactor);
+        return EXIT_FAILURE;
+    }
+    scheduler_attach(&m.sched, reactor);
+    if (opts.store_dir) {
+        if (!(m.store = store_open(opts.store_dir, (size_t)opts.store_mb << 20, 0)) ||
+            !(m.tiers[ROLLUP_1M] = open_tier(&opts, ROLLUP_1M, 0)) ||
+            !(m.tiers[ROLLUP_1H] = open_tier(&opts, ROLLUP_1H, 0)) ||
+            !(m.rollup = rollup_create(store_rollup, &m))) {
+            monitor_close(&m);
+            reactor_destroy(reactor);
+            return EXIT_FAILURE;
+        }
+        if (m.history) {
+            int64_t to = now_ms();
+            store_read(m.store, to - STORE_REPLAY_MS, to, replay_store, m.history);
+        }
+        scheduler_observe(&m.sched, record_store, m.store);
+        scheduler_observe(&m.sched, record_rollup, m.rollup);
     }
+    if (m.history)
+        scheduler_observe(&m.sched, record_history, m.history);
+    if (opts.shm_name) {
+        if (!(m.shm = shm_export_create(opts.shm_name))) {
+            monitor_close(&m);
+            reactor_destroy(reactor);
+            return EXIT_FAILURE;
+        }
+        scheduler_observe(&m.sched, record_shm, m.shm);
+    }
+    if (opts.listen_addr) {
+        if (!(m.prom = prom_create(reactor, opts.listen_addr))) {
+            monitor_close(&m);
+            reactor_destroy(reactor);
+            return EXIT_FAILURE;
+        }
+        scheduler_observe(&m.sched, record_prom, m.prom);
+    }
+    if (m.bstream)
+        scheduler_observe(&m.sched, record_bstream, m.bstream);
+    scheduler_prime(&m.sched);
+    monitor_publish(&m);
+    if (opts.use_snapshot && scheduler_ready(&m.sched, "cpu"))
+        monitor_report(&m);
 
-    // Network interfaces
-    print_network_interfaces();
+    int status = EXIT_SUCCESS;
+    if (m.count == 0 || m.n < m.count) {
+        scheduler_start(&m.sched, reactor_now_ms());
+        if ((m.timer = reactor_add_deadline(reactor, on_tick, &m)) < 0 ||
+            reactor_set_deadline(reactor, m.timer, scheduler_next(&m.sched)) != 0 ||
+            reactor_run(reactor) != 0)
+            status = EXIT_FAILURE;
+    }
 
-    return EXIT_SUCCESS;
+    // Store the partial buckets too. A restart within the same minute or hour
+    // then leaves two points for that bucket, both at its start time.
+    if (m.rollup)
+        rollup_flush(m.rollup);
+    monitor_close(&m);
+    reactor_destroy(reactor);
+    return status;
 }
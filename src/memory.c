@@ -0,0 +1,307 @@
+/*
+ * memory.c - bsdmon: memory and swap usage collector
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+
+#ifdef __FreeBSD__
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#endif
+
+#ifdef __linux__
+#include "procfs.h"
+#endif
+
+#include "collector.h"
+
+// --- Memory usage ---
+// On Linux: parse every field of /proc/meminfo in one pass.
+// On FreeBSD: use sysctl to get hw.physmem and free pages count.
+#ifdef __linux__
+// The /proc/meminfo keys we know about. Values are in kB except the
+// HugePages_* counts.
+#define MEMINFO_FIELDS(X) \
+    X(MI_MEM_TOTAL, "MemTotal") \
+    X(MI_MEM_FREE, "MemFree") \
+    X(MI_MEM_AVAILABLE, "MemAvailable") \
+    X(MI_BUFFERS, "Buffers") \
+    X(MI_CACHED, "Cached") \
+    X(MI_SWAP_CACHED, "SwapCached") \
+    X(MI_ACTIVE, "Active") \
+    X(MI_INACTIVE, "Inactive") \
+    X(MI_ACTIVE_ANON, "Active(anon)") \
+    X(MI_INACTIVE_ANON, "Inactive(anon)") \
+    X(MI_ACTIVE_FILE, "Active(file)") \
+    X(MI_INACTIVE_FILE, "Inactive(file)") \
+    X(MI_UNEVICTABLE, "Unevictable") \
+    X(MI_MLOCKED, "Mlocked") \
+    X(MI_SWAP_TOTAL, "SwapTotal") \
+    X(MI_SWAP_FREE, "SwapFree") \
+    X(MI_ZSWAP, "Zswap") \
+    X(MI_ZSWAPPED, "Zswapped") \
+    X(MI_DIRTY, "Dirty") \
+    X(MI_WRITEBACK, "Writeback") \
+    X(MI_ANON_PAGES, "AnonPages") \
+    X(MI_MAPPED, "Mapped") \
+    X(MI_SHMEM, "Shmem") \
+    X(MI_KRECLAIMABLE, "KReclaimable") \
+    X(MI_SLAB, "Slab") \
+    X(MI_SRECLAIMABLE, "SReclaimable") \
+    X(MI_SUNRECLAIM, "SUnreclaim") \
+    X(MI_KERNEL_STACK, "KernelStack") \
+    X(MI_SHADOW_CALL_STACK, "ShadowCallStack") \
+    X(MI_PAGE_TABLES, "PageTables") \
+    X(MI_SEC_PAGE_TABLES, "SecPageTables") \
+    X(MI_NFS_UNSTABLE, "NFS_Unstable") \
+    X(MI_BOUNCE, "Bounce") \
+    X(MI_WRITEBACK_TMP, "WritebackTmp") \
+    X(MI_COMMIT_LIMIT, "CommitLimit") \
+    X(MI_COMMITTED_AS, "Committed_AS") \
+    X(MI_VMALLOC_TOTAL, "VmallocTotal") \
+    X(MI_VMALLOC_USED, "VmallocUsed") \
+    X(MI_VMALLOC_CHUNK, "VmallocChunk") \
+    X(MI_PERCPU, "Percpu") \
+    X(MI_HARDWARE_CORRUPTED, "HardwareCorrupted") \
+    X(MI_ANON_HUGE_PAGES, "AnonHugePages") \
+    X(MI_SHMEM_HUGE_PAGES, "ShmemHugePages") \
+    X(MI_SHMEM_PMD_MAPPED, "ShmemPmdMapped") \
+    X(MI_FILE_HUGE_PAGES, "FileHugePages") \
+    X(MI_FILE_PMD_MAPPED, "FilePmdMapped") \
+    X(MI_CMA_TOTAL, "CmaTotal") \
+    X(MI_CMA_FREE, "CmaFree") \
+    X(MI_UNACCEPTED, "Unaccepted") \
+    X(MI_BALLOON, "Balloon") \
+    X(MI_HUGE_PAGES_TOTAL, "HugePages_Total") \
+    X(MI_HUGE_PAGES_FREE, "HugePages_Free") \
+    X(MI_HUGE_PAGES_RSVD, "HugePages_Rsvd") \
+    X(MI_HUGE_PAGES_SURP, "HugePages_Surp") \
+    X(MI_HUGEPAGESIZE, "Hugepagesize") \
+    X(MI_HUGETLB, "Hugetlb") \
+    X(MI_DIRECT_MAP_4K, "DirectMap4k") \
+    X(MI_DIRECT_MAP_2M, "DirectMap2M") \
+    X(MI_DIRECT_MAP_1G, "DirectMap1G")
+
+enum {
+#define X(id, key) id,
+    MEMINFO_FIELDS(X)
+#undef X
+    MI_NFIELDS
+};
+
+#endif
+
+typedef struct {
+    unsigned long long total;   // bytes
+    unsigned long long used;    // bytes
+    double percent_used;
+#ifdef __linux__
+    unsigned long long info[MI_NFIELDS];    // raw /proc/meminfo values
+#endif
+} mem_usage_t;
+
+#ifdef __linux__
+static const char *const meminfo_names[MI_NFIELDS] = {
+#define X(id, key) key,
+    MEMINFO_FIELDS(X)
+#undef X
+};
+
+static const uint8_t meminfo_name_len[MI_NFIELDS] = {
+#define X(id, key) sizeof(key) - 1,
+    MEMINFO_FIELDS(X)
+#undef X
+};
+
+// Perfect hash of the keys above: the first two and last two characters of a
+// key plus its length are packed into one word and multiplied by a constant
+// that spreads the known keys over 128 slots without collisions. Each slot
+// holds field + 1 (0 = empty). Unknown keys land on some slot and are rejected
+// by the single name comparison. The multiplier and table were found by an
+// offline search over MEMINFO_FIELDS; regenerate both when adding a key.
+#define MEMINFO_HASH_MUL 0x3f968d121ca8275dULL
+
+static const uint8_t meminfo_slots[128] = {
+    54,  0,  0,  0,  0, 33,  0, 52,  0, 44, 42,  5, 57,  2,  0,  0,
+     0, 43,  0, 14,  0,  0, 50,  0,  0,  0,  7,  0, 35,  9,  0,  0,
+     0, 31, 11,  0,  0, 27, 16,  0,  0, 46, 48,  0,  0, 53,  0,  0,
+    28, 45,  0,  0, 55,  0, 38,  0,  0,  6,  0, 51,  0,  0,  0,  0,
+     0,  1,  0,  3,  0, 32,  0,  0, 41, 22, 29,  0,  0,  0, 18,  0,
+     0, 21,  0, 49,  0,  0,  0, 19, 13, 15, 23,  0,  0, 47,  0,  0,
+     0,  0,  0,  0, 20,  0,  0,  0,  0,  0, 30, 26,  0, 24,  0, 58,
+     0,  8, 59, 37, 10, 17, 56, 40,  4, 12, 36, 25,  0,  0, 34, 39,
+};
+
+static int meminfo_lookup(const char *key, size_t len) {
+    if (len < 2)
+        return -1;
+    const unsigned char *k = (const unsigned char *)key;
+    uint64_t x = (uint64_t)k[0] | (uint64_t)k[1] << 8 | (uint64_t)k[len - 2] << 16 |
+                 (uint64_t)k[len - 1] << 24 | (uint64_t)len << 32;
+    int f = meminfo_slots[(x * MEMINFO_HASH_MUL) >> 57] - 1;
+    if (f < 0 || meminfo_name_len[f] != len || memcmp(meminfo_names[f], key, len) != 0)
+        return -1;
+    return f;
+}
+
+static procfs_file_t proc_meminfo = PROCFS_FILE_INIT;
+
+static int get_memory_usage(mem_usage_t *mem) {
+    if (proc_meminfo.fd < 0 && procfs_open(&proc_meminfo, "/proc/meminfo", 0) < 0) {
+        perror("open /proc/meminfo");
+        return -1;
+    }
+    if (procfs_read(&proc_meminfo) < 0) {
+        perror("read /proc/meminfo");
+        return -1;
+    }
+    // Lines look like "MemTotal:       16329384 kB".
+    unsigned long long *info = mem->info;
+    memset(info, 0, MI_NFIELDS * sizeof(*info));
+    for (const char *p = proc_meminfo.buf; *p; p = procfs_next_line(p)) {
+        const char *colon = strchr(p, ':');
+        if (!colon)
+            break;
+        int f = meminfo_lookup(p, (size_t)(colon - p));
+        p = colon + 1;
+        if (f >= 0)
+            procfs_u64(&p, &info[f]);
+    }
+    if (info[MI_MEM_TOTAL] == 0) {
+        fprintf(stderr, "Failed to get MemTotal\n");
+        return -1;
+    }
+    // Kernels before 3.14 have no MemAvailable; approximate it.
+    unsigned long long available = info[MI_MEM_AVAILABLE];
+    if (available == 0)
+        available = info[MI_MEM_FREE] + info[MI_BUFFERS] + info[MI_CACHED];
+    if (available > info[MI_MEM_TOTAL])
+        available = info[MI_MEM_TOTAL];
+    mem->total = info[MI_MEM_TOTAL] * 1024;
+    mem->used = (info[MI_MEM_TOTAL] - available) * 1024;
+    mem->percent_used = ((double)mem->used / mem->total) * 100.0;
+    return 0;
+}
+#endif
+
+#ifdef __FreeBSD__
+static int get_memory_usage(mem_usage_t *mem) {
+    unsigned long total_mem = 0;
+    size_t len = sizeof(total_mem);
+    if (sysctlbyname("hw.physmem", &total_mem, &len, NULL, 0) < 0) {
+        perror("sysctl hw.physmem");
+        return -1;
+    }
+    // Get page size.
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (page_size < 0) {
+        perror("sysconf _SC_PAGESIZE");
+        return -1;
+    }
+    // Get free pages count.
+    unsigned long free_pages = 0;
+    len = sizeof(free_pages);
+    if (sysctlbyname("vm.stats.vm.v_free_count", &free_pages, &len, NULL, 0) < 0) {
+        perror("sysctl vm.stats.vm.v_free_count");
+        return -1;
+    }
+    unsigned long free_mem = free_pages * page_size;
+    unsigned long used_mem = total_mem > free_mem ? total_mem - free_mem : 0;
+    mem->total = total_mem;
+    mem->used = used_mem;
+    mem->percent_used = ((double)used_mem / total_mem) * 100.0;
+    return 0;
+}
+#endif
+
+// --- Collector ---
+// Memory is an instantaneous reading, so every sample is reportable on its own.
+typedef struct {
+    mem_usage_t mem;
+    int failed;
+} memory_state_t;
+
+static void *memory_init(const bsdmon_options_t *opts) {
+    (void)opts;
+    memory_state_t *s = calloc(1, sizeof(*s));
+    if (!s)
+        perror("calloc");
+    return s;
+}
+
+static int memory_sample(void *state) {
+    memory_state_t *s = state;
+    s->failed = get_memory_usage(&s->mem) != 0;
+    return s->failed ? -1 : 0;
+}
+
+static int memory_compute(void *state) {
+    (void)state;
+    return 0;
+}
+
+static void memory_render(void *state, FILE *out) {
+    const memory_state_t *s = state;
+    if (s->failed) {
+        fprintf(out, "Memory Usage: Error retrieving information\n");
+        return;
+    }
+    const mem_usage_t *mem = &s->mem;
+    fprintf(out, "Memory Usage: %.2f GB / %.2f GB (%.2f%% used)\n",
+            mem->used / GB, mem->total / GB, mem->percent_used);
+#ifdef __linux__
+    const unsigned long long *mi = mem->info;
+    fprintf(out, "  free %.2f GB available %.2f GB buffers %.2f GB cached %.2f GB"
+            " shmem %.2f GB slab %.2f GB anon %.2f GB anon_huge %.2f GB"
+            " dirty %.2f MB writeback %.2f MB\n",
+            mi[MI_MEM_FREE] / KB_PER_GB, mi[MI_MEM_AVAILABLE] / KB_PER_GB,
+            mi[MI_BUFFERS] / KB_PER_GB, mi[MI_CACHED] / KB_PER_GB,
+            mi[MI_SHMEM] / KB_PER_GB, mi[MI_SLAB] / KB_PER_GB,
+            mi[MI_ANON_PAGES] / KB_PER_GB, mi[MI_ANON_HUGE_PAGES] / KB_PER_GB,
+            mi[MI_DIRTY] / 1024.0, mi[MI_WRITEBACK] / 1024.0);
+    if (mi[MI_SWAP_TOTAL]) {
+        unsigned long long swap_used = mi[MI_SWAP_TOTAL] - mi[MI_SWAP_FREE];
+        fprintf(out, "Swap Usage: %.2f GB / %.2f GB (%.2f%% used)\n",
+                swap_used / KB_PER_GB, mi[MI_SWAP_TOTAL] / KB_PER_GB,
+                (double)swap_used / mi[MI_SWAP_TOTAL] * 100.0);
+    } else {
+        fprintf(out, "Swap Usage: none\n");
+    }
+#endif
+}
+
+static void memory_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const memory_state_t *s = state;
+    if (s->failed)
+        return;
+    emit(ctx, "mem_total_bytes", "", (double)s->mem.total);
+    emit(ctx, "mem_used_bytes", "", (double)s->mem.used);
+    emit(ctx, "mem_used_percent", "", s->mem.percent_used);
+#ifdef __linux__
+    const unsigned long long *mi = s->mem.info;
+    emit(ctx, "mem_available_bytes", "", mi[MI_MEM_AVAILABLE] * 1024.0);
+    emit(ctx, "mem_buffers_bytes", "", mi[MI_BUFFERS] * 1024.0);
+    emit(ctx, "mem_cached_bytes", "", mi[MI_CACHED] * 1024.0);
+    emit(ctx, "swap_total_bytes", "", mi[MI_SWAP_TOTAL] * 1024.0);
+    emit(ctx, "swap_used_bytes", "", (mi[MI_SWAP_TOTAL] - mi[MI_SWAP_FREE]) * 1024.0);
+#endif
+}
+
+static void memory_destroy(void *state) {
+    free(state);
+}
+
+const collector_t memory_collector = {
+    .name = "memory",
+    .interval_ms = 0,
+    .init = memory_init,
+    .sample = memory_sample,
+    .compute = memory_compute,
+    .render = memory_render,
+    .destroy = memory_destroy,
+    .metrics = memory_metrics,
+};
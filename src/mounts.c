@@ -0,0 +1,472 @@
+/*
+ * mounts.c - bsdmon: capacity of every mounted filesystem
+ *
+ * See mounts.h. Entries are allocated individually so a worker that is stuck
+ * in statvfs() keeps a valid pointer while the table around it changes; an
+ * entry is only freed once its mount is gone and no call on it is in flight.
+ */
+
+#include "mounts.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/statvfs.h>
+
+#ifdef __linux__
+#include "procfs.h"
+#endif
+
+#ifdef __FreeBSD__
+#include <sys/param.h>
+#include <sys/ucred.h>
+#include <sys/mount.h>
+#endif
+
+struct mount_entry {
+    struct mount_entry *next_job;   // link in the job queue
+    char *dir;
+    char *type;
+    char *source;
+    unsigned long dev;          // major:minor (Linux) or fsid (FreeBSD)
+    int present;                // listed in the latest mount table
+    int busy;                   // queued or inside statvfs()
+    int status;
+    unsigned long long total, used, avail;
+    uint64_t job_cycle;         // sample cycle the queued job belongs to
+};
+
+struct mount_table {
+    pthread_mutex_t lock;
+    pthread_cond_t work;        // jobs queued, or shutdown
+    pthread_cond_t done;        // a job of the current cycle finished
+    struct mount_entry **entries;
+    int n, cap;
+    struct mount_entry *queue_head, *queue_tail;
+    uint64_t cycle;
+    int pending;                // jobs of the current cycle not yet finished
+    int quit;
+    int workers_alive;
+    int timeout_ms;
+    mount_usage_t *results;
+    int results_cap;
+    unsigned long *devs;        // open-addressed set of listed devices, as dev + 1
+    size_t devs_cap;            // power of two, 0 marks a free slot
+#ifdef __linux__
+    procfs_file_t mountinfo;
+    char *last_info;            // mountinfo contents behind the current list
+    size_t last_len;
+#endif
+};
+
+// Pseudo and memory-backed filesystems that have no storage capacity worth
+// reporting.
+static const char *const skip_types[] = {
+    "autofs", "binfmt_misc", "bpf", "cgroup", "cgroup2", "configfs",
+    "debugfs", "devfs", "devpts", "devtmpfs", "efivarfs", "fdescfs",
+    "fusectl", "hugetlbfs", "linprocfs", "linsysfs", "mqueue", "nsfs",
+    "proc", "procfs", "pstore", "ramfs", "rpc_pipefs", "securityfs",
+    "selinuxfs", "squashfs", "sysfs", "tmpfs", "tracefs",
+    NULL
+};
+
+static int skip_type(const char *type) {
+    for (int i = 0; skip_types[i]; i++)
+        if (strcmp(type, skip_types[i]) == 0)
+            return 1;
+    return 0;
+}
+
+static void entry_free(struct mount_entry *e) {
+    free(e->dir);
+    free(e->type);
+    free(e->source);
+    free(e);
+}
+
+// Find the entry for dir, trying the slot at *next first: the kernel lists
+// mounts in a stable order and the table keeps it, so after the first sample
+// each mount is usually found right after the previous one.
+static struct mount_entry *table_find(mount_table_t *t, const char *dir, int *next) {
+    int i = *next;
+    if (i >= t->n || strcmp(t->entries[i]->dir, dir) != 0)
+        for (i = 0; i < t->n; i++)
+            if (strcmp(t->entries[i]->dir, dir) == 0)
+                break;
+    if (i == t->n)
+        return NULL;
+    *next = i + 1;
+    return t->entries[i];
+}
+
+// Start a refresh of up to nmounts mounts: every entry is marked absent until
+// it is listed again, and the set of listed devices is emptied.
+static int table_begin(mount_table_t *t, int nmounts) {
+    size_t cap = t->devs_cap ? t->devs_cap : 64;
+    while (cap < 2 * (size_t)nmounts)
+        cap *= 2;
+    if (cap != t->devs_cap) {
+        unsigned long *p = realloc(t->devs, cap * sizeof(*p));
+        if (!p)
+            return -1;
+        t->devs = p;
+        t->devs_cap = cap;
+    }
+    memset(t->devs, 0, t->devs_cap * sizeof(*t->devs));
+    for (int i = 0; i < t->n; i++)
+        t->entries[i]->present = 0;
+    return 0;
+}
+
+// Add dev to the devices listed so far. Returns 1 if it was already there,
+// which makes this mount a second one of that device (a bind mount).
+static int table_claim_dev(mount_table_t *t, unsigned long dev) {
+    size_t mask = t->devs_cap - 1;
+    size_t i = (size_t)(((unsigned long long)dev * 0x9e3779b97f4a7c15ULL) >> 32) & mask;
+    // At most half the slots are used, so probing always ends.
+    for (; t->devs[i]; i = (i + 1) & mask)
+        if (t->devs[i] == dev + 1)
+            return 1;
+    t->devs[i] = dev + 1;
+    return 0;
+}
+
+// Mark a mount as present, adding it to the table if it is new. Returns its
+// entry, or NULL without memory.
+static struct mount_entry *table_add(mount_table_t *t, const char *dir, const char *type,
+                                     const char *source, unsigned long dev, int *next) {
+    struct mount_entry *e = table_find(t, dir, next);
+    if (!e) {
+        if (t->n == t->cap) {
+            int cap = t->cap ? t->cap * 2 : 16;
+            struct mount_entry **p = realloc(t->entries, cap * sizeof(*p));
+            if (!p)
+                return NULL;
+            t->entries = p;
+            t->cap = cap;
+        }
+        e = calloc(1, sizeof(*e));
+        if (!e)
+            return NULL;
+        e->dir = strdup(dir);
+        e->type = strdup(type);
+        e->source = strdup(source);
+        if (!e->dir || !e->type || !e->source) {
+            entry_free(e);
+            return NULL;
+        }
+        t->entries[t->n++] = e;
+        *next = t->n;
+    }
+    e->dev = dev;
+    e->present = 1;
+    return e;
+}
+
+// Drop entries that are no longer mounted and have no call in flight.
+static void table_compact(mount_table_t *t) {
+    int n = 0;
+    for (int i = 0; i < t->n; i++) {
+        struct mount_entry *e = t->entries[i];
+        if (!e->present && !e->busy)
+            entry_free(e);
+        else
+            t->entries[n++] = e;
+    }
+    t->n = n;
+}
+
+#ifdef __linux__
+// Copy one space-separated mountinfo field, decoding the \ooo octal escapes
+// the kernel uses for spaces, tabs, newlines and backslashes.
+static const char *mountinfo_field(const char *p, char *out, size_t len) {
+    size_t n = 0;
+    p = procfs_skip_blanks(p);
+    while (*p && *p != ' ' && *p != '\n') {
+        char c = *p++;
+        if (c == '\\' && p[0] >= '0' && p[0] <= '3' && p[1] >= '0' && p[1] <= '7' &&
+            p[2] >= '0' && p[2] <= '7') {
+            c = (char)((p[0] - '0') << 6 | (p[1] - '0') << 3 | (p[2] - '0'));
+            p += 3;
+        }
+        if (n + 1 < len)
+            out[n++] = c;
+    }
+    out[n] = '\0';
+    return p;
+}
+
+// Re-read /proc/self/mountinfo and update the table. Lines look like
+// "36 35 98:0 /mnt1 /mnt2 rw,noatime master:1 - ext3 /dev/root rw".
+static int table_refresh(mount_table_t *t) {
+    if (procfs_read(&t->mountinfo) < 0)
+        return -1;
+    const char *buf = t->mountinfo.buf;
+    size_t len = t->mountinfo.len;
+    // The mount table rarely changes; skip parsing when it is identical.
+    if (t->last_info && len == t->last_len && memcmp(buf, t->last_info, len) == 0)
+        return 0;
+    char *copy = realloc(t->last_info, len + 1);
+    if (!copy)
+        return -1;
+    memcpy(copy, buf, len + 1);
+    t->last_info = copy;
+    t->last_len = len;
+
+    int lines = 0;
+    for (const char *p = buf; (p = strchr(p, '\n')); p++)
+        lines++;
+    if (table_begin(t, lines + 1) < 0)
+        return -1;
+
+    char dir[4096], type[256], source[4096], scratch[64];
+    int next = 0;
+    for (const char *p = buf; *p; p = procfs_next_line(p)) {
+        unsigned long long id, parent, major, minor;
+        if (!procfs_u64(&p, &id) || !procfs_u64(&p, &parent) ||
+            !procfs_u64(&p, &major) || *p != ':')
+            continue;
+        p++;
+        if (!procfs_u64(&p, &minor))
+            continue;
+        p = mountinfo_field(p, scratch, sizeof(scratch));   // root
+        p = mountinfo_field(p, dir, sizeof(dir));
+        // Skip mount options and optional fields up to the "-" separator.
+        const char *sep = strstr(p, " - ");
+        const char *eol = strchr(p, '\n');
+        if (!sep || (eol && sep > eol))
+            continue;
+        p = mountinfo_field(sep + 3, type, sizeof(type));
+        mountinfo_field(p, source, sizeof(source));
+        if (skip_type(type))
+            continue;
+        unsigned long dev = (unsigned long)(major << 20 | minor);
+        if (table_claim_dev(t, dev))
+            continue;
+        if (!table_add(t, dir, type, source, dev, &next))
+            return -1;
+    }
+    table_compact(t);
+    return 0;
+}
+
+static void *mount_worker(void *arg) {
+    mount_table_t *t = arg;
+    pthread_mutex_lock(&t->lock);
+    for (;;) {
+        while (!t->quit && !t->queue_head)
+            pthread_cond_wait(&t->work, &t->lock);
+        if (t->quit)
+            break;
+        struct mount_entry *e = t->queue_head;
+        t->queue_head = e->next_job;
+        if (!t->queue_head)
+            t->queue_tail = NULL;
+        pthread_mutex_unlock(&t->lock);
+
+        // The entry cannot be freed while busy, so dir is stable here.
+        struct statvfs vfs;
+        int rc = statvfs(e->dir, &vfs);
+
+        pthread_mutex_lock(&t->lock);
+        if (rc == 0) {
+            e->total = (unsigned long long)vfs.f_blocks * vfs.f_frsize;
+            e->used = e->total - (unsigned long long)vfs.f_bfree * vfs.f_frsize;
+            e->avail = (unsigned long long)vfs.f_bavail * vfs.f_frsize;
+            e->status = MOUNT_OK;
+        } else {
+            e->status = MOUNT_ERROR;
+        }
+        e->busy = 0;
+        if (e->job_cycle == t->cycle && --t->pending == 0)
+            pthread_cond_signal(&t->done);
+    }
+    t->workers_alive--;
+    pthread_cond_signal(&t->done);
+    pthread_mutex_unlock(&t->lock);
+    return NULL;
+}
+#endif
+
+#ifdef __FreeBSD__
+// getmntinfo() with MNT_NOWAIT returns the kernel's cached statistics without
+// contacting the filesystems, so it cannot hang.
+static int table_refresh(mount_table_t *t) {
+    struct statfs *mnt;
+    int count = getmntinfo(&mnt, MNT_NOWAIT);
+    if (count <= 0)
+        return -1;
+    if (table_begin(t, count) < 0)
+        return -1;
+    int next = 0;
+    for (int i = 0; i < count; i++) {
+        if (skip_type(mnt[i].f_fstypename) || mnt[i].f_blocks == 0)
+            continue;
+        unsigned long dev = (unsigned long)(unsigned)mnt[i].f_fsid.val[0] << 16 ^
+                            (unsigned)mnt[i].f_fsid.val[1];
+        if (table_claim_dev(t, dev))
+            continue;
+        struct mount_entry *e = table_add(t, mnt[i].f_mntonname, mnt[i].f_fstypename,
+                                          mnt[i].f_mntfromname, dev, &next);
+        if (!e)
+            return -1;
+        e->total = (unsigned long long)mnt[i].f_blocks * mnt[i].f_bsize;
+        e->used = e->total - (unsigned long long)mnt[i].f_bfree * mnt[i].f_bsize;
+        e->avail = mnt[i].f_bavail > 0 ?
+            (unsigned long long)mnt[i].f_bavail * mnt[i].f_bsize : 0;
+        e->status = MOUNT_OK;
+    }
+    table_compact(t);
+    return 0;
+}
+#endif
+
+mount_table_t *mount_table_create(int nworkers, int timeout_ms) {
+    mount_table_t *t = calloc(1, sizeof(*t));
+    if (!t)
+        return NULL;
+    t->timeout_ms = timeout_ms;
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_mutex_init(&t->lock, NULL);
+    pthread_cond_init(&t->work, NULL);
+    pthread_cond_init(&t->done, &attr);
+    pthread_condattr_destroy(&attr);
+#ifdef __linux__
+    if (procfs_open(&t->mountinfo, "/proc/self/mountinfo", 16384) < 0) {
+        perror("open /proc/self/mountinfo");
+        mount_table_destroy(t);
+        return NULL;
+    }
+    // Workers are detached: one stuck in statvfs() can never be joined.
+    pthread_attr_t tattr;
+    pthread_attr_init(&tattr);
+    pthread_attr_setdetachstate(&tattr, PTHREAD_CREATE_DETACHED);
+    for (int i = 0; i < nworkers; i++) {
+        pthread_t tid;
+        if (pthread_create(&tid, &tattr, mount_worker, t) != 0)
+            break;
+        t->workers_alive++;
+    }
+    pthread_attr_destroy(&tattr);
+    if (t->workers_alive == 0) {
+        fprintf(stderr, "Failed to start disk workers\n");
+        mount_table_destroy(t);
+        return NULL;
+    }
+#else
+    (void)nworkers;
+#endif
+    return t;
+}
+
+int mount_table_sample(mount_table_t *t, const mount_usage_t **out) {
+    pthread_mutex_lock(&t->lock);
+    if (table_refresh(t) < 0) {
+        pthread_mutex_unlock(&t->lock);
+        return -1;
+    }
+
+#ifdef __linux__
+    // Queue every mount that is not still busy from an earlier sample.
+    t->cycle++;
+    t->pending = 0;
+    for (int i = 0; i < t->n; i++) {
+        struct mount_entry *e = t->entries[i];
+        if (!e->present || e->busy)
+            continue;
+        e->busy = 1;
+        e->job_cycle = t->cycle;
+        e->next_job = NULL;
+        if (t->queue_tail)
+            t->queue_tail->next_job = e;
+        else
+            t->queue_head = e;
+        t->queue_tail = e;
+        t->pending++;
+    }
+    if (t->pending > 0) {
+        pthread_cond_broadcast(&t->work);
+        struct timespec deadline;
+        clock_gettime(CLOCK_MONOTONIC, &deadline);
+        deadline.tv_sec += t->timeout_ms / 1000;
+        deadline.tv_nsec += (long)(t->timeout_ms % 1000) * 1000000L;
+        if (deadline.tv_nsec >= 1000000000L) {
+            deadline.tv_sec++;
+            deadline.tv_nsec -= 1000000000L;
+        }
+        while (t->pending > 0) {
+            if (pthread_cond_timedwait(&t->done, &t->lock, &deadline) == ETIMEDOUT)
+                break;
+        }
+    }
+#endif
+
+    if (t->n > t->results_cap) {
+        mount_usage_t *r = realloc(t->results, t->n * sizeof(*r));
+        if (!r) {
+            pthread_mutex_unlock(&t->lock);
+            return -1;
+        }
+        t->results = r;
+        t->results_cap = t->n;
+    }
+    int n = 0;
+    for (int i = 0; i < t->n; i++) {
+        struct mount_entry *e = t->entries[i];
+        if (!e->present)
+            continue;
+        mount_usage_t *r = &t->results[n++];
+        r->dir = e->dir;
+        r->type = e->type;
+        r->source = e->source;
+        r->status = e->busy ? MOUNT_TIMEOUT : e->status;
+        r->total = e->total;
+        r->used = e->used;
+        r->avail = e->avail;
+    }
+    pthread_mutex_unlock(&t->lock);
+    *out = t->results;
+    return n;
+}
+
+void mount_table_destroy(mount_table_t *t) {
+    if (!t)
+        return;
+    pthread_mutex_lock(&t->lock);
+    t->quit = 1;
+    pthread_cond_broadcast(&t->work);
+    // Jobs still queued will never run; only calls in progress keep entries.
+    for (struct mount_entry *e = t->queue_head; e; e = e->next_job)
+        e->busy = 0;
+    t->queue_head = t->queue_tail = NULL;
+    int stuck = 0;
+    for (int i = 0; i < t->n; i++)
+        if (t->entries[i]->busy)
+            stuck = 1;
+    // Idle workers exit promptly; stuck ones still reference the table.
+    while (!stuck && t->workers_alive > 0)
+        pthread_cond_wait(&t->done, &t->lock);
+    pthread_mutex_unlock(&t->lock);
+    if (stuck)
+        return;
+
+    for (int i = 0; i < t->n; i++)
+        entry_free(t->entries[i]);
+    free(t->entries);
+    free(t->results);
+    free(t->devs);
+#ifdef __linux__
+    procfs_close(&t->mountinfo);
+    free(t->last_info);
+#endif
+    pthread_cond_destroy(&t->work);
+    pthread_cond_destroy(&t->done);
+    pthread_mutex_destroy(&t->lock);
+    free(t);
+}
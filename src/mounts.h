@@ -0,0 +1,47 @@
+/*
+ * mounts.h - bsdmon: capacity of every mounted filesystem
+ *
+ * A mount_table_t tracks the real (storage backed) filesystems of the host and
+ * samples their capacity. On Linux the mount list comes from
+ * /proc/self/mountinfo and the statvfs() calls are issued from a small pool of
+ * worker threads; a sample waits for them only until a deadline, so a hung NFS
+ * or FUSE mount is reported as timed out instead of stalling the monitor. A
+ * mount whose previous call is still stuck is not queued again until it
+ * returns. On FreeBSD getmntinfo(MNT_NOWAIT) already returns cached,
+ * non-blocking statistics, so no workers are used.
+ */
+
+#ifndef BSDMON_MOUNTS_H
+#define BSDMON_MOUNTS_H
+
+enum {
+    MOUNT_OK,
+    MOUNT_ERROR,        // statvfs failed
+    MOUNT_TIMEOUT,      // no answer before the deadline
+};
+
+typedef struct {
+    const char *dir;    // mount point
+    const char *type;   // filesystem type
+    const char *source; // device or remote source
+    int status;         // MOUNT_*
+    unsigned long long total;   // bytes
+    unsigned long long used;    // bytes
+    unsigned long long avail;   // bytes available to unprivileged users
+} mount_usage_t;
+
+typedef struct mount_table mount_table_t;
+
+// Create a table sampled by nworkers threads, waiting at most timeout_ms for
+// all statvfs() calls of one sample. Returns NULL on failure.
+mount_table_t *mount_table_create(int nworkers, int timeout_ms);
+
+// Refresh the mount list and sample every mount. *out points to an array of
+// the returned length that stays valid until the next call.
+int mount_table_sample(mount_table_t *t, const mount_usage_t **out);
+
+// Stop the workers and free the table. If a worker is still stuck in a
+// statvfs() call the table is left to the process exit instead.
+void mount_table_destroy(mount_table_t *t);
+
+#endif
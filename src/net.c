@@ -0,0 +1,598 @@
+/*
+ * net.c - bsdmon: network interface and traffic collector
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <ifaddrs.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <net/if.h>
+
+#ifdef __FreeBSD__
+#include <net/if_dl.h>
+#endif
+
+#ifdef __linux__
+#include <linux/ethtool.h>
+#include <linux/sockios.h>
+#include <sys/ioctl.h>
+#include "netlink.h"
+#endif
+
+#include "collector.h"
+
+// --- Network interfaces ---
+// Every non-loopback interface is reported with its link state, MTU, speed and
+// IPv4/IPv6 addresses. Traffic follows the same two-sample model as disk I/O:
+// the kernel's cumulative counters are read into the sample and rates come
+// from their deltas. On Linux links and addresses come from rtnetlink
+// RTM_GETLINK/RTM_GETADDR dumps parsed straight out of a reused receive buffer
+// (see netlink.h), with 64-bit IFLA_STATS64 counters; FreeBSD uses
+// getifaddrs() (AF_LINK if_data for the counters).
+typedef struct {
+    char name[IFNAMSIZ];
+    int index;
+    unsigned flags;         // IFF_*
+    int link_up;            // administratively up and carrier present
+    unsigned mtu;
+    long speed;             // Mb/s, -1 if unknown
+    unsigned long long rx_bytes, tx_bytes;
+    unsigned long long rx_packets, tx_packets;
+    unsigned long long rx_errors, tx_errors;
+    unsigned long long rx_dropped, tx_dropped;
+} net_stat_t;
+
+typedef struct {
+    int index;              // interface index
+    int family;             // AF_INET or AF_INET6
+    int prefixlen;
+    unsigned char addr[16];
+} net_addr_t;
+
+typedef struct {
+    int n, cap;
+    net_stat_t *ifs;
+    int naddrs, addrs_cap;
+    net_addr_t *addrs;
+} net_io_t;
+
+typedef struct {
+    const char *name;
+    double rx_bytes, tx_bytes;      // per second
+    double rx_packets, tx_packets;
+    double rx_errors, tx_errors;
+    double rx_dropped, tx_dropped;
+} net_io_rate_t;
+
+static void net_io_free(net_io_t *io) {
+    free(io->ifs);
+    free(io->addrs);
+    memset(io, 0, sizeof(*io));
+}
+
+static net_stat_t *net_io_add_link(net_io_t *io) {
+    if (io->n == io->cap) {
+        int cap = io->cap ? io->cap * 2 : 8;
+        net_stat_t *p = realloc(io->ifs, cap * sizeof(*p));
+        if (!p)
+            return NULL;
+        io->ifs = p;
+        io->cap = cap;
+    }
+    net_stat_t *st = &io->ifs[io->n++];
+    memset(st, 0, sizeof(*st));
+    st->speed = -1;
+    return st;
+}
+
+// Find the link with the given index. Addresses of one interface arrive
+// together, so the previous match is tried first.
+static const net_stat_t *net_io_find(const net_io_t *io, int index, int *hint) {
+    if (*hint < io->n && io->ifs[*hint].index == index)
+        return &io->ifs[*hint];
+    for (int i = 0; i < io->n; i++) {
+        if (io->ifs[i].index == index) {
+            *hint = i;
+            return &io->ifs[i];
+        }
+    }
+    return NULL;
+}
+
+// Replace the addresses of dst with those of src.
+static int net_io_copy_addrs(net_io_t *dst, const net_io_t *src) {
+    if (src->naddrs > dst->addrs_cap) {
+        net_addr_t *p = realloc(dst->addrs, src->naddrs * sizeof(*p));
+        if (!p)
+            return -1;
+        dst->addrs = p;
+        dst->addrs_cap = src->naddrs;
+    }
+    if (src->naddrs)
+        memcpy(dst->addrs, src->addrs, src->naddrs * sizeof(*dst->addrs));
+    dst->naddrs = src->naddrs;
+    return 0;
+}
+
+static net_addr_t *net_io_add_addr(net_io_t *io) {
+    if (io->naddrs == io->addrs_cap) {
+        int cap = io->addrs_cap ? io->addrs_cap * 2 : 8;
+        net_addr_t *p = realloc(io->addrs, cap * sizeof(*p));
+        if (!p)
+            return NULL;
+        io->addrs = p;
+        io->addrs_cap = cap;
+    }
+    net_addr_t *a = &io->addrs[io->naddrs++];
+    memset(a, 0, sizeof(*a));
+    return a;
+}
+
+#ifdef __linux__
+// IF_OPER_UP / IF_OPER_UNKNOWN from <linux/if.h>, which clashes with <net/if.h>.
+#define NET_OPER_UNKNOWN 0
+#define NET_OPER_UP 6
+
+static nl_socket_t net_nl = NL_SOCKET_INIT;
+
+// Link speed via the ethtool ioctl, -1 if unknown or the link is down.
+static int net_ioctl_fd = -1;
+
+static long net_link_speed(const char *name, int link_up) {
+    long speed = -1;
+    if (link_up) {
+        if (net_ioctl_fd < 0)
+            net_ioctl_fd = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+        struct ethtool_cmd cmd;
+        struct ifreq ifr;
+        memset(&cmd, 0, sizeof(cmd));
+        memset(&ifr, 0, sizeof(ifr));
+        cmd.cmd = ETHTOOL_GSET;
+        snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "%s", name);
+        ifr.ifr_data = (char *)&cmd;
+        if (net_ioctl_fd >= 0 && ioctl(net_ioctl_fd, SIOCETHTOOL, &ifr) == 0) {
+            uint32_t mbps = ethtool_cmd_speed(&cmd);
+            if (mbps != 0 && mbps != (uint32_t)SPEED_UNKNOWN)
+                speed = (long)mbps;
+        }
+    }
+    return speed;
+}
+
+static int net_link_cb(const struct nlmsghdr *msg, void *arg) {
+    net_io_t *io = arg;
+    if (msg->nlmsg_type != RTM_NEWLINK)
+        return 0;
+    const struct ifinfomsg *ifi = NLMSG_DATA(msg);
+    if (ifi->ifi_flags & IFF_LOOPBACK)
+        return 0;
+    net_stat_t *st = net_io_add_link(io);
+    if (!st)
+        return -1;
+    st->index = ifi->ifi_index;
+    st->flags = ifi->ifi_flags;
+    int oper = NET_OPER_UNKNOWN;
+    int left;
+    for (struct rtattr *a = nl_attrs(msg, sizeof(*ifi), &left); RTA_OK(a, left);
+         a = RTA_NEXT(a, left)) {
+        switch (a->rta_type) {
+        case IFLA_IFNAME:
+            snprintf(st->name, sizeof(st->name), "%.*s", (int)RTA_PAYLOAD(a),
+                     (const char *)RTA_DATA(a));
+            break;
+        case IFLA_MTU:
+            memcpy(&st->mtu, RTA_DATA(a), sizeof(st->mtu));
+            break;
+        case IFLA_OPERSTATE:
+            oper = *(const uint8_t *)RTA_DATA(a);
+            break;
+        case IFLA_STATS64: {
+            struct rtnl_link_stats64 ls;
+            memset(&ls, 0, sizeof(ls));
+            size_t len = RTA_PAYLOAD(a) < sizeof(ls) ? RTA_PAYLOAD(a) : sizeof(ls);
+            memcpy(&ls, RTA_DATA(a), len);
+            st->rx_bytes = ls.rx_bytes;
+            st->tx_bytes = ls.tx_bytes;
+            st->rx_packets = ls.rx_packets;
+            st->tx_packets = ls.tx_packets;
+            st->rx_errors = ls.rx_errors;
+            st->tx_errors = ls.tx_errors;
+            st->rx_dropped = ls.rx_dropped;
+            st->tx_dropped = ls.tx_dropped;
+            break;
+        }
+        }
+    }
+    // Many virtual devices never report an operational state; fall back to
+    // the carrier flag for those.
+    st->link_up = (st->flags & IFF_UP) &&
+        (oper == NET_OPER_UP || (oper == NET_OPER_UNKNOWN && (st->flags & IFF_RUNNING)));
+    return 0;
+}
+
+static int net_addr_cb(const struct nlmsghdr *msg, void *arg) {
+    static int hint;
+    net_io_t *io = arg;
+    if (msg->nlmsg_type != RTM_NEWADDR)
+        return 0;
+    const struct ifaddrmsg *ifa = NLMSG_DATA(msg);
+    if (ifa->ifa_family != AF_INET && ifa->ifa_family != AF_INET6)
+        return 0;
+    if (!net_io_find(io, (int)ifa->ifa_index, &hint))
+        return 0;   // loopback
+    // IFA_LOCAL is the interface's own address; IFA_ADDRESS is the peer on
+    // point-to-point links and the same address everywhere else.
+    const struct rtattr *local = NULL, *address = NULL;
+    int left;
+    for (struct rtattr *a = nl_attrs(msg, sizeof(*ifa), &left); RTA_OK(a, left);
+         a = RTA_NEXT(a, left)) {
+        if (a->rta_type == IFA_LOCAL)
+            local = a;
+        else if (a->rta_type == IFA_ADDRESS)
+            address = a;
+    }
+    const struct rtattr *use = local ? local : address;
+    size_t len = ifa->ifa_family == AF_INET ? 4 : 16;
+    if (!use || RTA_PAYLOAD(use) < len)
+        return 0;
+    net_addr_t *na = net_io_add_addr(io);
+    if (!na)
+        return -1;
+    na->index = (int)ifa->ifa_index;
+    na->family = ifa->ifa_family;
+    na->prefixlen = ifa->ifa_prefixlen;
+    memcpy(na->addr, RTA_DATA(use), len);
+    return 0;
+}
+
+// Without want_addrs only the links are dumped and io->addrs is left as is.
+// prev is the previous sample, whose link speeds are reused.
+static int get_net_io(net_io_t *io, const net_io_t *prev, int want_addrs) {
+    if (net_nl.fd < 0 && nl_open(&net_nl, 0) < 0) {
+        perror("netlink socket");
+        return -1;
+    }
+    io->n = 0;
+    if (nl_dump(&net_nl, RTM_GETLINK, AF_UNSPEC, net_link_cb, io) < 0) {
+        perror("netlink RTM_GETLINK");
+        io->n = 0;      // no speeds were looked up for a partial dump
+        return -1;
+    }
+    // The ethtool answer only changes with the carrier, so it is carried over
+    // from the same link in the previous sample and asked again when link_up
+    // flips. Links that disappeared take their speed with them.
+    for (int i = 0; i < io->n; i++) {
+        net_stat_t *st = &io->ifs[i];
+        int hint = i;
+        const net_stat_t *p = net_io_find(prev, st->index, &hint);
+        if (p && p->link_up == st->link_up && strcmp(p->name, st->name) == 0)
+            st->speed = p->speed;
+        else
+            st->speed = net_link_speed(st->name, st->link_up);
+    }
+    if (!want_addrs)
+        return 0;
+    io->naddrs = 0;
+    if (nl_dump(&net_nl, RTM_GETADDR, AF_UNSPEC, net_addr_cb, io) < 0) {
+        perror("netlink RTM_GETADDR");
+        return -1;
+    }
+    return 0;
+}
+#else
+// Length of a contiguous netmask in bits.
+static int net_prefixlen(const unsigned char *mask, size_t len) {
+    int bits = 0;
+    for (size_t i = 0; i < len; i++)
+        bits += __builtin_popcount(mask[i]);
+    return bits;
+}
+
+// getifaddrs() always returns the addresses and the speed, so want_addrs and
+// prev are ignored.
+static int get_net_io(net_io_t *io, const net_io_t *prev, int want_addrs) {
+    (void)prev;
+    (void)want_addrs;
+    struct ifaddrs *ifaddr, *ifa;
+    if (getifaddrs(&ifaddr) < 0) {
+        perror("getifaddrs");
+        return -1;
+    }
+    io->n = 0;
+    io->naddrs = 0;
+    // Links first, so addresses can be attached to their interface index.
+    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || ifa->ifa_addr->sa_family != AF_LINK || !ifa->ifa_data)
+            continue;
+        if (ifa->ifa_flags & IFF_LOOPBACK)
+            continue;
+        net_stat_t *st = net_io_add_link(io);
+        if (!st)
+            break;
+        const struct if_data *ld = ifa->ifa_data;
+        snprintf(st->name, sizeof(st->name), "%s", ifa->ifa_name);
+        st->index = ((const struct sockaddr_dl *)ifa->ifa_addr)->sdl_index;
+        st->flags = ifa->ifa_flags;
+        st->link_up = (st->flags & IFF_UP) && (st->flags & IFF_RUNNING);
+        st->mtu = ld->ifi_mtu;
+        st->speed = ld->ifi_baudrate ? (long)(ld->ifi_baudrate / 1000000) : -1;
+        st->rx_bytes = ld->ifi_ibytes;
+        st->tx_bytes = ld->ifi_obytes;
+        st->rx_packets = ld->ifi_ipackets;
+        st->tx_packets = ld->ifi_opackets;
+        st->rx_errors = ld->ifi_ierrors;
+        st->tx_errors = ld->ifi_oerrors;
+        st->rx_dropped = ld->ifi_iqdrops;
+        st->tx_dropped = ld->ifi_oqdrops;
+    }
+    for (ifa = ifaddr; ifa != NULL; ifa = ifa->ifa_next) {
+        if (!ifa->ifa_addr || !ifa->ifa_netmask)
+            continue;
+        int family = ifa->ifa_addr->sa_family;
+        if (family != AF_INET && family != AF_INET6)
+            continue;
+        int index = -1;
+        for (int i = 0; i < io->n; i++)
+            if (strcmp(io->ifs[i].name, ifa->ifa_name) == 0)
+                index = io->ifs[i].index;
+        if (index < 0)
+            continue;
+        net_addr_t *na = net_io_add_addr(io);
+        if (!na)
+            break;
+        na->index = index;
+        na->family = family;
+        if (family == AF_INET) {
+            memcpy(na->addr, &((struct sockaddr_in *)ifa->ifa_addr)->sin_addr, 4);
+            na->prefixlen = net_prefixlen(
+                (const unsigned char *)&((struct sockaddr_in *)ifa->ifa_netmask)->sin_addr, 4);
+        } else {
+            memcpy(na->addr, &((struct sockaddr_in6 *)ifa->ifa_addr)->sin6_addr, 16);
+            na->prefixlen = net_prefixlen(
+                (const unsigned char *)&((struct sockaddr_in6 *)ifa->ifa_netmask)->sin6_addr, 16);
+        }
+    }
+    freeifaddrs(ifaddr);
+    return 0;
+}
+#endif
+
+// Compute per-interface rates between two samples taken seconds apart into
+// rates[curr->n]. Returns the number of interfaces present in both samples.
+static int calc_net_io(const net_io_t *prev, const net_io_t *curr, double seconds,
+                net_io_rate_t *rates) {
+    int n = 0;
+    if (seconds <= 0)
+        return 0;
+    for (int i = 0; i < curr->n; i++) {
+        const net_stat_t *c = &curr->ifs[i];
+        int hint = i;
+        const net_stat_t *p = net_io_find(prev, c->index, &hint);
+        // A recreated interface may reuse the index with fresh counters.
+        if (!p || strcmp(p->name, c->name) != 0 || c->rx_bytes < p->rx_bytes ||
+            c->tx_bytes < p->tx_bytes)
+            continue;
+#define NET_RATE(field) ((double)(c->field - p->field) / seconds)
+        net_io_rate_t *r = &rates[n++];
+        r->name = c->name;
+        r->rx_bytes = NET_RATE(rx_bytes);
+        r->tx_bytes = NET_RATE(tx_bytes);
+        r->rx_packets = NET_RATE(rx_packets);
+        r->tx_packets = NET_RATE(tx_packets);
+        r->rx_errors = NET_RATE(rx_errors);
+        r->tx_errors = NET_RATE(tx_errors);
+        r->rx_dropped = NET_RATE(rx_dropped);
+        r->tx_dropped = NET_RATE(tx_dropped);
+#undef NET_RATE
+    }
+    return n;
+}
+
+// Print every interface with its link state and addresses.
+static void print_network_interfaces(const net_io_t *io, FILE *out) {
+    fprintf(out, "Network interfaces:\n");
+    for (int i = 0; i < io->n; i++) {
+        const net_stat_t *st = &io->ifs[i];
+        fprintf(out, "  %s: %s, mtu %u", st->name,
+                !(st->flags & IFF_UP) ? "down" : st->link_up ? "up" : "no-carrier", st->mtu);
+        if (st->speed > 0)
+            fprintf(out, ", %ld Mb/s", st->speed);
+        fprintf(out, "\n");
+        for (int j = 0; j < io->naddrs; j++) {
+            const net_addr_t *na = &io->addrs[j];
+            if (na->index != st->index)
+                continue;
+            char ip[INET6_ADDRSTRLEN];
+            if (!inet_ntop(na->family, na->addr, ip, sizeof(ip)))
+                continue;
+            if (na->family == AF_INET) {
+                struct in_addr mask;
+                char netmask[INET_ADDRSTRLEN];
+                mask.s_addr = htonl(na->prefixlen ? ~0U << (32 - na->prefixlen) : 0);
+                inet_ntop(AF_INET, &mask, netmask, sizeof(netmask));
+                fprintf(out, "    inet %s (mask: %s)\n", ip, netmask);
+            } else {
+                fprintf(out, "    inet6 %s/%d\n", ip, na->prefixlen);
+            }
+        }
+    }
+}
+
+// --- Collector ---
+// The interface list is reportable after one sample; traffic rates need two.
+// On Linux the collector subscribes to rtnetlink address notifications, so
+// the address dump is only repeated after an address actually changed; the
+// link dump still runs every sample for the counters.
+typedef struct {
+    net_io_t prev, curr;
+    struct timespec prev_taken, curr_taken;
+    int nsamples;               // consecutive successful samples, 0..2
+    net_io_rate_t *rates;
+    int nrates, rates_cap;
+    int addrs_dirty;            // addresses must be dumped on the next sample
+#ifdef __linux__
+    nl_socket_t notify;         // address change notifications
+#endif
+} net_state_t;
+
+static void *net_init(const bsdmon_options_t *opts) {
+    (void)opts;
+    net_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+#ifdef __linux__
+    s->notify.fd = -1;
+#endif
+    return s;
+}
+
+static int net_sample(void *state) {
+    net_state_t *s = state;
+    net_io_t tmp = s->prev;
+    s->prev = s->curr;
+    s->curr = tmp;
+    s->prev_taken = s->curr_taken;
+    // Without notifications there is no way to tell whether addresses changed.
+    int want_addrs = s->addrs_dirty || s->nsamples == 0;
+#ifdef __linux__
+    want_addrs |= s->notify.fd < 0;
+#else
+    want_addrs = 1;
+#endif
+    if (get_net_io(&s->curr, &s->prev, want_addrs) != 0) {
+        s->nsamples = 0;
+        return -1;
+    }
+    if (want_addrs)
+        s->addrs_dirty = 0;
+    else if (net_io_copy_addrs(&s->curr, &s->prev) != 0)
+        s->addrs_dirty = 1;
+    clock_gettime(CLOCK_MONOTONIC, &s->curr_taken);
+    if (s->nsamples < 2)
+        s->nsamples++;
+    return 0;
+}
+
+static int net_compute(void *state) {
+    net_state_t *s = state;
+    s->nrates = 0;
+    if (s->nsamples < 2)
+        return 0;
+    if (s->curr.n > s->rates_cap) {
+        net_io_rate_t *r = realloc(s->rates, s->curr.n * sizeof(*r));
+        if (!r) {
+            perror("realloc");
+            return 0;
+        }
+        s->rates = r;
+        s->rates_cap = s->curr.n;
+    }
+    s->nrates = calc_net_io(&s->prev, &s->curr,
+                            timespec_diff(&s->prev_taken, &s->curr_taken), s->rates);
+    return 0;
+}
+
+// Interfaces with their addresses, then one traffic line per interface.
+static void net_render(void *state, FILE *out) {
+    const net_state_t *s = state;
+    if (s->nsamples == 0) {
+        fprintf(out, "Network interfaces: Error retrieving information\n");
+        return;
+    }
+    print_network_interfaces(&s->curr, out);
+    if (s->nsamples < 2)
+        return;
+    fprintf(out, "Network I/O:%s\n", s->nrates ? "" : " none");
+    for (int i = 0; i < s->nrates; i++) {
+        const net_io_rate_t *r = &s->rates[i];
+        fprintf(out, "  %s: rx %.2f MB/s (%.1f pkt/s, %.1f err/s, %.1f drop/s)"
+                " tx %.2f MB/s (%.1f pkt/s, %.1f err/s, %.1f drop/s)\n",
+                r->name, r->rx_bytes / MB, r->rx_packets, r->rx_errors, r->rx_dropped,
+                r->tx_bytes / MB, r->tx_packets, r->tx_errors, r->tx_dropped);
+    }
+}
+
+static void net_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const net_state_t *s = state;
+    for (int i = 0; i < s->curr.n; i++)
+        emit(ctx, "net_link_up", s->curr.ifs[i].name, s->curr.ifs[i].link_up);
+    for (int i = 0; i < s->nrates; i++) {
+        const net_io_rate_t *r = &s->rates[i];
+        emit(ctx, "net_rx_bytes_per_second", r->name, r->rx_bytes);
+        emit(ctx, "net_tx_bytes_per_second", r->name, r->tx_bytes);
+        emit(ctx, "net_rx_packets_per_second", r->name, r->rx_packets);
+        emit(ctx, "net_tx_packets_per_second", r->name, r->tx_packets);
+        emit(ctx, "net_rx_errors_per_second", r->name, r->rx_errors);
+        emit(ctx, "net_tx_errors_per_second", r->name, r->tx_errors);
+        emit(ctx, "net_rx_dropped_per_second", r->name, r->rx_dropped);
+        emit(ctx, "net_tx_dropped_per_second", r->name, r->tx_dropped);
+    }
+}
+
+#ifdef __linux__
+static int net_notify_cb(const struct nlmsghdr *msg, void *arg) {
+    net_state_t *s = arg;
+    if (msg->nlmsg_type == RTM_NEWADDR || msg->nlmsg_type == RTM_DELADDR)
+        s->addrs_dirty = 1;
+    return 0;
+}
+
+static void net_notify_ready(reactor_t *r, int fd, void *arg) {
+    (void)r;
+    (void)fd;
+    net_state_t *s = arg;
+    // A notification lost to a full socket buffer could be an address change.
+    if (nl_drain(&s->notify, net_notify_cb, s) < 0 && errno == ENOBUFS)
+        s->addrs_dirty = 1;
+}
+
+static int net_attach(void *state, reactor_t *r) {
+    net_state_t *s = state;
+    if (nl_open(&s->notify, RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR) < 0) {
+        perror("netlink socket");
+        return -1;
+    }
+    if (reactor_add_fd(r, s->notify.fd, net_notify_ready, s) < 0) {
+        nl_close(&s->notify);
+        return -1;
+    }
+    // Changes made before the subscription are only seen by a fresh dump.
+    s->addrs_dirty = 1;
+    return 0;
+}
+#endif
+
+static void net_destroy(void *state) {
+    net_state_t *s = state;
+#ifdef __linux__
+    nl_close(&s->notify);
+#endif
+    net_io_free(&s->prev);
+    net_io_free(&s->curr);
+    free(s->rates);
+    free(s);
+}
+
+const collector_t net_collector = {
+    .name = "net",
+    .interval_ms = 0,
+    .init = net_init,
+    .sample = net_sample,
+    .compute = net_compute,
+    .render = net_render,
+    .destroy = net_destroy,
+#ifdef __linux__
+    .attach = net_attach,
+#endif
+    .metrics = net_metrics,
+};
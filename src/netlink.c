@@ -0,0 +1,136 @@
+/*
+ * netlink.c - bsdmon: minimal rtnetlink client (Linux only)
+ *
+ * See netlink.h.
+ */
+
+#ifdef __linux__
+
+#include "netlink.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+// Large enough for a full dump batch on typical kernels; grown on MSG_TRUNC.
+#define NL_INITIAL_BUFFER 32768
+
+int nl_open(nl_socket_t *nl, unsigned groups) {
+    nl->fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    nl->seq = 0;
+    nl->pid = 0;
+    nl->buf = NULL;
+    nl->cap = 0;
+    if (nl->fd < 0)
+        return -1;
+    struct sockaddr_nl addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = groups;
+    socklen_t len = sizeof(addr);
+    if (bind(nl->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        getsockname(nl->fd, (struct sockaddr *)&addr, &len) < 0 ||
+        !(nl->buf = malloc(NL_INITIAL_BUFFER))) {
+        int err = errno;
+        nl_close(nl);
+        errno = err;
+        return -1;
+    }
+    nl->pid = addr.nl_pid;
+    nl->cap = NL_INITIAL_BUFFER;
+    return 0;
+}
+
+static int nl_request(nl_socket_t *nl, int type, int family) {
+    struct {
+        struct nlmsghdr hdr;
+        struct rtgenmsg gen;
+    } req;
+    memset(&req, 0, sizeof(req));
+    req.hdr.nlmsg_len = NLMSG_LENGTH(sizeof(req.gen));
+    req.hdr.nlmsg_type = (uint16_t)type;
+    req.hdr.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    req.hdr.nlmsg_seq = ++nl->seq;
+    req.gen.rtgen_family = (unsigned char)family;
+    return send(nl->fd, &req, req.hdr.nlmsg_len, 0) < 0 ? -1 : 0;
+}
+
+int nl_dump(nl_socket_t *nl, int type, int family, nl_cb_t cb, void *arg) {
+    if (nl_request(nl, type, family) < 0)
+        return -1;
+
+    // The kernel sizes dump batches to the receive buffer we pass, so a
+    // truncated batch only happens with unusually large single messages. In
+    // that case the buffer is grown for the next dump and the rest of this
+    // one is discarded.
+    int truncated = 0, stop = 0;
+    for (;;) {
+        ssize_t len = recv(nl->fd, nl->buf, nl->cap, MSG_TRUNC);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if ((size_t)len > nl->cap) {
+            char *buf = realloc(nl->buf, (size_t)len);
+            if (!buf)
+                return -1;
+            nl->buf = buf;
+            nl->cap = (size_t)len;
+            truncated = stop = 1;
+            continue;
+        }
+
+        int left = (int)len;
+        for (struct nlmsghdr *msg = (struct nlmsghdr *)nl->buf; NLMSG_OK(msg, left);
+             msg = NLMSG_NEXT(msg, left)) {
+            // Skip multicast notifications and replies to older requests.
+            if (msg->nlmsg_pid != nl->pid || msg->nlmsg_seq != nl->seq)
+                continue;
+            if (msg->nlmsg_type == NLMSG_DONE) {
+                if (truncated) {
+                    errno = EMSGSIZE;
+                    return -1;
+                }
+                return 0;
+            }
+            if (msg->nlmsg_type == NLMSG_ERROR) {
+                const struct nlmsgerr *err = NLMSG_DATA(msg);
+                errno = err->error ? -err->error : EPROTO;
+                return -1;
+            }
+            if (!stop && cb(msg, arg) != 0)
+                stop = 1;
+        }
+    }
+}
+
+int nl_drain(nl_socket_t *nl, nl_cb_t cb, void *arg) {
+    for (;;) {
+        ssize_t len = recv(nl->fd, nl->buf, nl->cap, MSG_DONTWAIT);
+        if (len < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return 0;
+            return -1;
+        }
+        int left = (int)len;
+        for (struct nlmsghdr *msg = (struct nlmsghdr *)nl->buf; NLMSG_OK(msg, left);
+             msg = NLMSG_NEXT(msg, left))
+            cb(msg, arg);
+    }
+}
+
+void nl_close(nl_socket_t *nl) {
+    if (nl->fd >= 0)
+        close(nl->fd);
+    free(nl->buf);
+    nl->fd = -1;
+    nl->buf = NULL;
+    nl->cap = 0;
+}
+
+#endif
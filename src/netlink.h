@@ -0,0 +1,59 @@
+/*
+ * netlink.h - bsdmon: minimal rtnetlink client (Linux only)
+ *
+ * An nl_socket_t owns a NETLINK_ROUTE socket and a receive buffer that is
+ * reused for every dump, so enumerating links and addresses does not allocate
+ * per interface the way getifaddrs() does. Messages are handed to a callback
+ * straight out of the buffer.
+ */
+
+#ifndef BSDMON_NETLINK_H
+#define BSDMON_NETLINK_H
+
+#ifdef __linux__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+
+typedef struct {
+    int fd;
+    uint32_t seq;       // sequence number of the last request
+    uint32_t pid;       // port id assigned by the kernel
+    char *buf;
+    size_t cap;
+} nl_socket_t;
+
+#define NL_SOCKET_INIT { -1, 0, 0, NULL, 0 }
+
+// Called for every message of a dump. Return non-zero to skip the rest.
+typedef int (*nl_cb_t)(const struct nlmsghdr *msg, void *arg);
+
+// Open the socket, subscribed to the given RTMGRP_* multicast groups (0 for
+// none). Returns 0 or -1 with errno set.
+int nl_open(nl_socket_t *nl, unsigned groups);
+
+// Request a dump of type (RTM_GETLINK, RTM_GETADDR, ...) for family and feed
+// every reply to cb. Returns 0, or -1 with errno set.
+int nl_dump(nl_socket_t *nl, int type, int family, nl_cb_t cb, void *arg);
+
+// Feed every pending multicast notification to cb without blocking. Returns
+// 0 once the socket is empty, or -1 with errno set; ENOBUFS means the kernel
+// dropped notifications because the socket buffer was full.
+int nl_drain(nl_socket_t *nl, nl_cb_t cb, void *arg);
+
+void nl_close(nl_socket_t *nl);
+
+// First rtattr after a fixed-size message header of hdrlen bytes; *left
+// receives the attribute bytes for use with RTA_OK()/RTA_NEXT():
+//   for (a = nl_attrs(msg, sizeof(struct ifinfomsg), &left); RTA_OK(a, left);
+//        a = RTA_NEXT(a, left))
+static inline struct rtattr *nl_attrs(const struct nlmsghdr *msg, size_t hdrlen, int *left) {
+    *left = (int)msg->nlmsg_len - (int)NLMSG_LENGTH(NLMSG_ALIGN(hdrlen));
+    return (struct rtattr *)((char *)NLMSG_DATA(msg) + NLMSG_ALIGN(hdrlen));
+}
+
+#endif
+
+#endif
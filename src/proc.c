@@ -0,0 +1,1304 @@
+/*
+ * proc.c - bsdmon: top processes by CPU, memory and I/O collectors
+ */
+
+#include <stdio.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include "procfs.h"
+#endif
+
+#ifdef __FreeBSD__
+#include <sys/types.h>
+#include <sys/sysctl.h>
+#include <sys/user.h>
+#endif
+
+#include "collector.h"
+
+// --- Process table ---
+// Every scan walks all processes and records each one's cumulative CPU time
+// in a table keyed by pid that lives across samples, so the usage of a
+// process over the last interval is the difference to the previous scan.
+// Entries carry the scan generation that last saw them; the ones a scan did
+// not see have exited and are swept out afterwards. A pid reused between two
+// scans is told apart by the start time. When a view needs them, the scan
+// also reads the I/O counters of every process, kept the same way.
+enum { PROC_IO_READ, PROC_IO_WRITE, PROC_IO_SYSCR, PROC_IO_SYSCW, PROC_IO_FIELDS };
+
+typedef struct {
+    int pid;
+    int fd;                         // stat file kept open across scans, or -1
+    int io_fd;                      // io file kept open across scans, or -1
+    uint32_t seen;                  // generation of the last scan that found it
+    unsigned long long start;       // start time, in proc_hz units since boot
+    unsigned long long cpu;         // user + system time, in proc_hz units
+    unsigned long long prev_cpu;    // cpu at the previous scan (0 if new since)
+    unsigned long long rss;         // resident pages
+    unsigned long long io[PROC_IO_FIELDS];      // cumulative, PROC_IO_*
+    unsigned long long prev_io[PROC_IO_FIELDS]; // io at the previous scan
+    uint32_t io_seen;               // generation of the last scan that read io
+    int io_delta;                   // io - prev_io covers the last interval
+    char comm[20];
+} proc_entry_t;
+
+typedef struct {
+    proc_entry_t *procs;
+    uint32_t n, cap;
+    uint32_t *slots;                // open addressing on pid, index + 1
+    uint32_t nslots;                // power of two, at least twice n
+    uint32_t nfds;                  // entries holding an fd
+} proc_table_t;
+
+static uint32_t proc_slot(const proc_table_t *t, int pid) {
+    // Pids are mostly consecutive; an odd multiplier keeps them in distinct
+    // slots and spreads clusters.
+    return ((uint32_t)pid * 2654435761u) & (t->nslots - 1);
+}
+
+static int proc_rehash(proc_table_t *t, uint32_t nslots) {
+    if (nslots != t->nslots) {
+        uint32_t *slots = realloc(t->slots, nslots * sizeof(*slots));
+        if (!slots) {
+            perror("realloc");
+            return -1;
+        }
+        t->slots = slots;
+        t->nslots = nslots;
+    }
+    memset(t->slots, 0, t->nslots * sizeof(*t->slots));
+    for (uint32_t i = 0; i < t->n; i++) {
+        uint32_t j = proc_slot(t, t->procs[i].pid);
+        while (t->slots[j])
+            j = (j + 1) & (t->nslots - 1);
+        t->slots[j] = i + 1;
+    }
+    return 0;
+}
+
+// The entry of pid, added with no CPU time if it is new. NULL if memory ran
+// out.
+static proc_entry_t *proc_lookup(proc_table_t *t, int pid) {
+    if (t->nslots) {
+        uint32_t mask = t->nslots - 1;
+        for (uint32_t i = proc_slot(t, pid); t->slots[i]; i = (i + 1) & mask) {
+            proc_entry_t *e = &t->procs[t->slots[i] - 1];
+            if (e->pid == pid)
+                return e;
+        }
+    }
+
+    // Keep the table at most half full.
+    if ((t->n + 1) * 2 > t->nslots && proc_rehash(t, t->nslots ? t->nslots * 2 : 1024) != 0)
+        return NULL;
+    if (t->n == t->cap) {
+        uint32_t cap = t->cap ? t->cap * 2 : 512;
+        proc_entry_t *p = realloc(t->procs, cap * sizeof(*p));
+        if (!p) {
+            perror("realloc");
+            return NULL;
+        }
+        t->procs = p;
+        t->cap = cap;
+    }
+    proc_entry_t *e = &t->procs[t->n];
+    memset(e, 0, sizeof(*e));
+    e->pid = pid;
+    e->fd = -1;
+    e->io_fd = -1;
+    uint32_t mask = t->nslots - 1, i = proc_slot(t, pid);
+    while (t->slots[i])
+        i = (i + 1) & mask;
+    t->slots[i] = ++t->n;
+    return e;
+}
+
+// Record what the scan of generation gen found about a process. Returns 1 if
+// the process is new since the previous scan.
+static int proc_update(proc_entry_t *e, uint32_t gen, unsigned long long start,
+                        unsigned long long cpu, unsigned long long rss, const char *comm,
+                        size_t comm_len) {
+    int fresh = !e->seen || e->start != start;
+    if (!fresh) {
+        e->prev_cpu = e->cpu;
+    } else {
+        // New since the last scan (or the pid was reused): all of its CPU
+        // time was spent since then.
+        e->prev_cpu = 0;
+        e->start = start;
+        if (comm_len >= sizeof(e->comm))
+            comm_len = sizeof(e->comm) - 1;
+        for (size_t i = 0; i < comm_len; i++)
+            e->comm[i] = (unsigned char)comm[i] < ' ' ? '?' : comm[i];
+        e->comm[comm_len] = '\0';
+    }
+    e->cpu = cpu;
+    e->rss = rss;
+    e->seen = gen;
+    return fresh;
+}
+
+// Record the I/O counters read by the scan of generation gen; fresh is what
+// proc_update() returned for the same scan.
+static void proc_update_io(proc_entry_t *e, uint32_t gen, int fresh,
+                           const unsigned long long *io) {
+    if (fresh) {
+        memset(e->prev_io, 0, sizeof(e->prev_io));
+        e->io_delta = 1;
+    } else {
+        memcpy(e->prev_io, e->io, sizeof(e->prev_io));
+        e->io_delta = e->io_seen == gen - 1;
+    }
+    memcpy(e->io, io, sizeof(e->io));
+    e->io_seen = gen;
+}
+
+static void proc_close(proc_table_t *t, proc_entry_t *e) {
+    if (e->fd >= 0) {
+        close(e->fd);
+        e->fd = -1;
+        t->nfds--;
+    }
+    if (e->io_fd >= 0) {
+        close(e->io_fd);
+        e->io_fd = -1;
+        t->nfds--;
+    }
+}
+
+// Drop the processes the scan of generation gen did not find.
+static int proc_sweep(proc_table_t *t, uint32_t gen) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < t->n; i++) {
+        if (t->procs[i].seen == gen)
+            t->procs[n++] = t->procs[i];
+        else
+            proc_close(t, &t->procs[i]);
+    }
+    if (n == t->n)
+        return 0;
+    t->n = n;
+    return proc_rehash(t, t->nslots);
+}
+
+static void proc_table_free(proc_table_t *t) {
+    for (uint32_t i = 0; i < t->n; i++)
+        proc_close(t, &t->procs[i]);
+    free(t->procs);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
+
+// --- Scanning ---
+// scan_procs() finds every process and passes it to proc_update(); proc_hz
+// is the unit of the start and CPU times it records. It also reports how
+// long the scan took and on how many threads.
+//
+// On Linux the stat file (and io file, when read) of every tracked process
+// stays open and is re-read with pread(), one syscall per file per scan
+// instead of open, read and close. An fd keeps referring to the process it
+// was opened for: once that process is gone reads fail with ESRCH, even if
+// its pid was reused, and the file is opened afresh. The cache holds at most
+// fd_budget fds, derived from RLIMIT_NOFILE; processes beyond it are read the
+// uncached way.
+//
+// The stat files are read in parallel. The scan first reads the /proc
+// directory and looks every pid up in the table on the calling thread (a few
+// getdents64 calls and hash probes), which gives the list of entries to read.
+// That list is cut into one contiguous share per thread; each thread takes
+// chunks from the front of its own share and, once it is empty, steals
+// chunks from the back of the others', so a thread that ran into slow
+// processes does not hold up the scan. Every entry is read by exactly one
+// thread. What a thread changes beyond its entries (fds opened and closed)
+// is counted in its own worker slot and merged when the scan ends. The
+// calling thread works as thread 0; small scans wake fewer threads, or none.
+#ifdef __linux__
+#define PROC_DENTS_SIZE (256 * 1024)
+#define PROC_FD_LIMIT 262144        // raise RLIMIT_NOFILE up to this
+#define PROC_FD_RESERVE 256         // fds left for everything else
+#define PROC_MIN_SHARE 256          // processes per thread worth waking it for
+#define PROC_CHUNK 32               // processes taken from a share at a time
+
+typedef struct {
+    pthread_mutex_t lock;           // guards next and end
+    uint32_t next, end;             // the part of the share not taken yet
+    uint32_t fd_allowance;          // fds this thread may add to the cache
+    int nfds;                       // fds opened minus closed in this scan
+} proc_worker_t;
+#endif
+
+typedef struct proc_scan {
+    proc_table_t table;
+    uint32_t gen;
+    double proc_hz;
+    int want_io;                    // also read the I/O counters
+    int nscans;                     // consecutive successful scans, 0..2
+    struct timespec prev_taken;     // when the scan before the last one ended
+    struct timespec taken;          // when the last scan ended
+    double wall_ms;                 // duration of the last scan
+    int threads;                    // threads the last scan ran on
+#ifdef __linux__
+    int proc_fd;                    // /proc, open for the life of the collector
+    char *dents;                    // getdents64 buffer
+    uint32_t fd_budget;             // stat fds the cache may keep open
+    uint32_t *work;                 // table indices of the pids found
+    uint32_t nwork, work_cap;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;            // a scan started, or shutdown
+    pthread_cond_t done;            // a pool thread finished its part
+    uint64_t cycle;                 // scans started
+    int running;                    // pool threads still in the scan
+    int active;                     // threads taking part in the scan
+    int quit;
+    int nworkers;                   // slots: the calling thread plus the pool
+    proc_worker_t *workers;
+    pthread_t *pool;
+    int npool;                      // pool threads started
+#endif
+#ifdef __FreeBSD__
+    struct kinfo_proc *kp;
+    size_t kp_size;
+#endif
+} proc_scan_t;
+
+#ifdef __linux__
+// getdents64 records; glibc only has a wrapper since 2.30.
+struct proc_dirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// Value of the "KEY: 123" line of a /proc file in *v. Returns 0 if the line
+// is missing.
+static int proc_field(const char *buf, const char *key, unsigned long long *v) {
+    size_t key_len = strlen(key);
+    for (const char *p = buf; *p; p = procfs_next_line(p)) {
+        if (strncmp(p, key, key_len) != 0 || p[key_len] != ':')
+            continue;
+        p += key_len + 1;
+        return procfs_u64(&p, v);
+    }
+    return 0;
+}
+
+// Read /proc/PID/NAME of e into buf (NUL terminated, with PROCFS_PAD bytes
+// of padding) through the fd cached in *fd, opening the file if there is
+// none yet and caching the new fd while the worker's allowance lasts.
+// Returns the length, or -1 if the process is gone or the file unreadable.
+static ssize_t scan_read(proc_scan_t *sc, proc_worker_t *w, const proc_entry_t *e, int *fd,
+                         const char *name, char *buf, size_t size) {
+    size_t cap = size - PROCFS_PAD - 1;
+    ssize_t len = -1;
+    if (*fd >= 0) {
+        len = pread(*fd, buf, cap, 0);
+        if (len < 0) {
+            // ESRCH: the process it was opened for is gone.
+            close(*fd);
+            *fd = -1;
+            w->nfds--;
+        }
+    }
+    if (len < 0) {
+        char path[32];
+        snprintf(path, sizeof(path), "%d/%s", e->pid, name);
+        int f = openat(sc->proc_fd, path, O_RDONLY | O_CLOEXEC);
+        if (f < 0)
+            return -1;  // exited since the directory was read, or no access
+        len = read(f, buf, cap);
+        if (len > 0 && w->fd_allowance > 0) {
+            *fd = f;
+            w->fd_allowance--;
+            w->nfds++;
+        } else {
+            close(f);
+        }
+    }
+    if (len <= 0)
+        return -1;
+    memset(buf + len, 0, PROCFS_PAD + 1);
+    return len;
+}
+
+// /proc/PID/io has "read_bytes: N" style lines. Reading it takes ptrace
+// access to the process, so without root only the user's own processes have
+// I/O counters.
+static void scan_io(proc_scan_t *sc, proc_worker_t *w, proc_entry_t *e, int fresh) {
+    static const char *const keys[PROC_IO_FIELDS] = {
+        [PROC_IO_READ] = "read_bytes",
+        [PROC_IO_WRITE] = "write_bytes",
+        [PROC_IO_SYSCR] = "syscr",
+        [PROC_IO_SYSCW] = "syscw",
+    };
+    char buf[512];
+    unsigned long long io[PROC_IO_FIELDS];
+    if (scan_read(sc, w, e, &e->io_fd, "io", buf, sizeof(buf)) < 0)
+        return;
+    for (int i = 0; i < PROC_IO_FIELDS; i++)
+        if (!proc_field(buf, keys[i], &io[i]))
+            return;
+    proc_update_io(e, sc->gen, fresh, io);
+}
+
+// /proc/PID/stat is "PID (COMM) STATE PPID ..."; COMM may itself hold spaces
+// and parentheses, so it ends at the last ')'. utime and stime are fields 14
+// and 15, starttime field 22 and rss (in pages) field 24.
+static void scan_stat(proc_scan_t *sc, proc_worker_t *w, proc_entry_t *e) {
+    char buf[1024];
+    ssize_t len = scan_read(sc, w, e, &e->fd, "stat", buf, sizeof(buf));
+    if (len < 0)
+        return;
+
+    const char *lparen = memchr(buf, '(', (size_t)len);
+    const char *rparen = NULL;
+    for (const char *c = buf + len - 1; c > buf; c--)
+        if (*c == ')') {
+            rparen = c;
+            break;
+        }
+    if (!lparen || !rparen || rparen < lparen)
+        return;
+
+    // Field 3 (the state) follows the comm; skip to field 14.
+    const char *p = procfs_skip_blanks(rparen + 1);
+    for (int field = 3; field < 14; field++) {
+        while (*p && *p != ' ')
+            p++;
+        p = procfs_skip_blanks(p);
+    }
+    unsigned long long utime, stime, start, vsize, rss;
+    if (!procfs_u64(&p, &utime) || !procfs_u64(&p, &stime))
+        return;
+    for (int field = 16; field < 22; field++) {
+        p = procfs_skip_blanks(p);
+        while (*p && *p != ' ')
+            p++;
+    }
+    if (!procfs_u64(&p, &start) || !procfs_u64(&p, &vsize) || !procfs_u64(&p, &rss))
+        return;
+    int fresh = proc_update(e, sc->gen, start, utime + stime, rss, lparen + 1,
+                            (size_t)(rparen - lparen - 1));
+    if (sc->want_io)
+        scan_io(sc, w, e, fresh);
+}
+
+// Take the next chunk of work for worker self into [*from, *to): from the
+// front of its own share, or else from the back of another's. Returns 0 when
+// every share is empty.
+static int scan_take(proc_scan_t *sc, int self, uint32_t *from, uint32_t *to) {
+    proc_worker_t *w = &sc->workers[self];
+    pthread_mutex_lock(&w->lock);
+    if (w->next < w->end) {
+        *from = w->next;
+        w->next = w->end - w->next > PROC_CHUNK ? w->next + PROC_CHUNK : w->end;
+        *to = w->next;
+        pthread_mutex_unlock(&w->lock);
+        return 1;
+    }
+    pthread_mutex_unlock(&w->lock);
+    for (int i = 1; i < sc->active; i++) {
+        proc_worker_t *v = &sc->workers[(self + i) % sc->active];
+        pthread_mutex_lock(&v->lock);
+        if (v->next < v->end) {
+            *to = v->end;
+            v->end = v->end - v->next > PROC_CHUNK ? v->end - PROC_CHUNK : v->next;
+            *from = v->end;
+            pthread_mutex_unlock(&v->lock);
+            return 1;
+        }
+        pthread_mutex_unlock(&v->lock);
+    }
+    return 0;
+}
+
+static void scan_run(proc_scan_t *sc, int self) {
+    uint32_t from, to;
+    while (scan_take(sc, self, &from, &to))
+        for (uint32_t i = from; i < to; i++)
+            scan_stat(sc, &sc->workers[self], &sc->table.procs[sc->work[i]]);
+}
+
+typedef struct {
+    proc_scan_t *sc;
+    int self;
+} proc_thread_arg_t;
+
+static void *scan_thread(void *arg) {
+    proc_thread_arg_t a = *(proc_thread_arg_t *)arg;
+    free(arg);
+    proc_scan_t *sc = a.sc;
+    uint64_t seen = 0;
+    pthread_mutex_lock(&sc->lock);
+    for (;;) {
+        while (!sc->quit && sc->cycle == seen)
+            pthread_cond_wait(&sc->wake, &sc->lock);
+        if (sc->quit)
+            break;
+        seen = sc->cycle;
+        if (a.self >= sc->active)
+            continue;
+        pthread_mutex_unlock(&sc->lock);
+        scan_run(sc, a.self);
+        pthread_mutex_lock(&sc->lock);
+        if (--sc->running == 0)
+            pthread_cond_signal(&sc->done);
+    }
+    pthread_mutex_unlock(&sc->lock);
+    return NULL;
+}
+
+static int scan_init(proc_scan_t *sc, const bsdmon_options_t *opts) {
+    long hz = sysconf(_SC_CLK_TCK);
+    sc->proc_hz = hz > 0 ? (double)hz : 100.0;
+    pthread_mutex_init(&sc->lock, NULL);
+    pthread_cond_init(&sc->wake, NULL);
+    pthread_cond_init(&sc->done, NULL);
+    sc->dents = malloc(PROC_DENTS_SIZE);
+    if (!sc->dents) {
+        perror("malloc");
+        return -1;
+    }
+    sc->proc_fd = open("/proc", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (sc->proc_fd < 0) {
+        perror("open /proc");
+        return -1;
+    }
+    // The default soft limit (often 1024) would keep most processes of a
+    // large host out of the cache; take what the hard limit allows.
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        if (rl.rlim_cur < PROC_FD_LIMIT && rl.rlim_cur < rl.rlim_max) {
+            struct rlimit raised = rl;
+            raised.rlim_cur = rl.rlim_max < PROC_FD_LIMIT ? rl.rlim_max : PROC_FD_LIMIT;
+            if (setrlimit(RLIMIT_NOFILE, &raised) == 0)
+                rl = raised;
+        }
+        if (rl.rlim_cur > PROC_FD_LIMIT)
+            rl.rlim_cur = PROC_FD_LIMIT;
+        if (rl.rlim_cur > PROC_FD_RESERVE)
+            sc->fd_budget = (uint32_t)(rl.rlim_cur - PROC_FD_RESERVE);
+    }
+    int nworkers = opts->proc_threads;
+    if (nworkers == 0) {
+        long ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+        nworkers = ncpu < 1 ? 1 : ncpu > 8 ? 8 : (int)ncpu;
+    }
+    sc->workers = calloc((size_t)nworkers, sizeof(*sc->workers));
+    sc->pool = calloc((size_t)nworkers, sizeof(*sc->pool));
+    if (!sc->workers || !sc->pool) {
+        perror("calloc");
+        return -1;
+    }
+    for (int i = 0; i < nworkers; i++)
+        pthread_mutex_init(&sc->workers[i].lock, NULL);
+    sc->nworkers = nworkers;
+    // A pool thread that fails to start only makes scans use fewer threads.
+    for (int i = 1; i < nworkers; i++) {
+        proc_thread_arg_t *a = malloc(sizeof(*a));
+        if (!a)
+            break;
+        a->sc = sc;
+        a->self = i;
+        if (pthread_create(&sc->pool[sc->npool], NULL, scan_thread, a) != 0) {
+            free(a);
+            break;
+        }
+        sc->npool++;
+    }
+    return 0;
+}
+
+static void scan_free(proc_scan_t *sc) {
+    pthread_mutex_lock(&sc->lock);
+    sc->quit = 1;
+    pthread_cond_broadcast(&sc->wake);
+    pthread_mutex_unlock(&sc->lock);
+    for (int i = 0; i < sc->npool; i++)
+        pthread_join(sc->pool[i], NULL);
+    for (int i = 0; i < sc->nworkers; i++)
+        pthread_mutex_destroy(&sc->workers[i].lock);
+    free(sc->workers);
+    free(sc->pool);
+    pthread_cond_destroy(&sc->wake);
+    pthread_cond_destroy(&sc->done);
+    pthread_mutex_destroy(&sc->lock);
+    if (sc->proc_fd >= 0)
+        close(sc->proc_fd);
+    free(sc->dents);
+    free(sc->work);
+}
+
+// Read the /proc directory with getdents64 into one large buffer, a few
+// syscalls for the whole process list, and collect the table entry of every
+// numeric entry into sc->work.
+static int scan_dir(proc_scan_t *sc) {
+    sc->nwork = 0;
+    if (lseek(sc->proc_fd, 0, SEEK_SET) < 0) {
+        perror("lseek /proc");
+        return -1;
+    }
+    for (;;) {
+        long n = syscall(SYS_getdents64, sc->proc_fd, sc->dents, PROC_DENTS_SIZE);
+        if (n < 0) {
+            perror("getdents64 /proc");
+            return -1;
+        }
+        if (n == 0)
+            return 0;
+        for (long off = 0; off < n;) {
+            const struct proc_dirent64 *d = (const void *)(sc->dents + off);
+            off += d->d_reclen;
+            if ((unsigned)(d->d_name[0] - '1') > 8)
+                continue;   // not a pid (pids start at 1)
+            int pid = 0;
+            size_t len = 0;
+            while ((unsigned)(d->d_name[len] - '0') <= 9)
+                pid = pid * 10 + (d->d_name[len++] - '0');
+            if (d->d_name[len] != '\0')
+                continue;
+            proc_entry_t *e = proc_lookup(&sc->table, pid);
+            if (!e)
+                continue;
+            if (sc->nwork == sc->work_cap) {
+                uint32_t cap = sc->work_cap ? sc->work_cap * 2 : 1024;
+                uint32_t *w = realloc(sc->work, cap * sizeof(*w));
+                if (!w) {
+                    perror("realloc");
+                    return -1;
+                }
+                sc->work = w;
+                sc->work_cap = cap;
+            }
+            sc->work[sc->nwork++] = (uint32_t)(e - sc->table.procs);
+        }
+    }
+}
+
+static int scan_procs(proc_scan_t *sc) {
+    if (scan_dir(sc) != 0)
+        return -1;
+
+    int active = 1 + (int)(sc->nwork / PROC_MIN_SHARE);
+    if (active > sc->npool + 1)
+        active = sc->npool + 1;
+    uint32_t spare = sc->fd_budget > sc->table.nfds ? sc->fd_budget - sc->table.nfds : 0;
+    for (int i = 0; i < active; i++) {
+        proc_worker_t *w = &sc->workers[i];
+        w->next = (uint32_t)((uint64_t)sc->nwork * i / active);
+        w->end = (uint32_t)((uint64_t)sc->nwork * (i + 1) / active);
+        w->fd_allowance = spare / active + (i == 0 ? spare % active : 0);
+        w->nfds = 0;
+    }
+    sc->threads = active;
+    if (active > 1) {
+        pthread_mutex_lock(&sc->lock);
+        sc->active = active;
+        sc->running = active - 1;
+        sc->cycle++;
+        pthread_cond_broadcast(&sc->wake);
+        pthread_mutex_unlock(&sc->lock);
+    } else {
+        sc->active = 1;
+    }
+    scan_run(sc, 0);
+    if (active > 1) {
+        pthread_mutex_lock(&sc->lock);
+        while (sc->running > 0)
+            pthread_cond_wait(&sc->done, &sc->lock);
+        pthread_mutex_unlock(&sc->lock);
+    }
+    for (int i = 0; i < active; i++)
+        sc->table.nfds += (uint32_t)sc->workers[i].nfds;
+    return 0;
+}
+#elif defined(__FreeBSD__)
+// One sysctl returns the whole process table, so there is nothing to spread
+// over threads; ki_runtime is in microseconds.
+static int scan_init(proc_scan_t *sc, const bsdmon_options_t *opts) {
+    (void)opts;
+    sc->proc_hz = 1e6;
+    sc->threads = 1;
+    return 0;
+}
+
+static void scan_free(proc_scan_t *sc) {
+    free(sc->kp);
+}
+
+static int scan_procs(proc_scan_t *sc) {
+    int mib[4] = { CTL_KERN, KERN_PROC, KERN_PROC_PROC, 0 };
+    size_t size = sc->kp_size;
+    while (sysctl(mib, 4, sc->kp, &size, NULL, 0) != 0 || !sc->kp) {
+        if (sc->kp && errno != ENOMEM) {
+            perror("sysctl kern.proc");
+            return -1;
+        }
+        // Query the size, with room for processes started meanwhile.
+        if (sysctl(mib, 4, NULL, &size, NULL, 0) != 0) {
+            perror("sysctl kern.proc");
+            return -1;
+        }
+        size += size / 4;
+        struct kinfo_proc *kp = realloc(sc->kp, size);
+        if (!kp) {
+            perror("realloc");
+            return -1;
+        }
+        sc->kp = kp;
+        sc->kp_size = size;
+    }
+    for (size_t i = 0; i < size / sizeof(*sc->kp); i++) {
+        const struct kinfo_proc *k = &sc->kp[i];
+        unsigned long long start = (unsigned long long)k->ki_start.tv_sec * 1000000ULL +
+                                   (unsigned long long)k->ki_start.tv_usec;
+        proc_entry_t *e = proc_lookup(&sc->table, k->ki_pid);
+        if (e)
+            proc_update(e, sc->gen, start, k->ki_runtime, (unsigned long long)k->ki_rssize,
+                        k->ki_comm, strlen(k->ki_comm));
+    }
+    return 0;
+}
+#else
+static int scan_init(proc_scan_t *sc, const bsdmon_options_t *opts) {
+    (void)opts;
+    sc->proc_hz = 1.0;
+    return 0;
+}
+
+static void scan_free(proc_scan_t *sc) {
+    (void)sc;
+}
+
+static int scan_procs(proc_scan_t *sc) {
+    (void)sc;
+    return -1;
+}
+#endif
+
+
+// --- Shared scan ---
+// The process collectors share one scan and its table: the CPU collector
+// runs the scan on its period and the others read the table it leaves
+// behind, so adding a per-process view does not add another walk of every
+// process; delta tracking (the previous values in the table and the time
+// between the last two scans) is shared as well. Without the CPU collector
+// the I/O view runs the scan, and without both the memory view does.
+static proc_scan_t *proc_shared;
+static int proc_shared_refs;
+
+static proc_scan_t *scan_acquire(const bsdmon_options_t *opts) {
+    if (proc_shared) {
+        proc_shared_refs++;
+        return proc_shared;
+    }
+    proc_scan_t *sc = calloc(1, sizeof(*sc));
+    if (!sc) {
+        perror("calloc");
+        return NULL;
+    }
+#ifdef __linux__
+    sc->proc_fd = -1;
+#endif
+    if (scan_init(sc, opts) != 0) {
+        scan_free(sc);
+        free(sc);
+        return NULL;
+    }
+    proc_shared = sc;
+    proc_shared_refs = 1;
+    return sc;
+}
+
+static void scan_release(proc_scan_t *sc) {
+    if (!sc || --proc_shared_refs > 0)
+        return;
+    scan_free(sc);
+    proc_table_free(&sc->table);
+    free(sc);
+    proc_shared = NULL;
+}
+
+// Run one scan and sweep out the processes that are gone.
+static int scan_sample(proc_scan_t *sc) {
+    struct timespec begin;
+    sc->gen++;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    if (scan_procs(sc) != 0 || proc_sweep(&sc->table, sc->gen) != 0) {
+        sc->nscans = 0;
+        return -1;
+    }
+    sc->prev_taken = sc->taken;
+    clock_gettime(CLOCK_MONOTONIC, &sc->taken);
+    sc->wall_ms = timespec_diff(&begin, &sc->taken) * 1000.0;
+    if (sc->nscans < 2)
+        sc->nscans++;
+    return 0;
+}
+
+// --- Top N ---
+// The top processes are picked with a min-heap of (key, item) bounded to N
+// entries: a process only enters when it beats the smallest key kept so far,
+// so a scan of P processes costs O(P log N) instead of sorting all of them.
+// item is the table index or a slot in the caller's own result array.
+typedef struct {
+    double key;
+    uint32_t item;
+} proc_rank_t;
+
+static void rank_sift_down(proc_rank_t *h, int n, int i) {
+    for (;;) {
+        int l = 2 * i + 1, r = l + 1, min = i;
+        if (l < n && h[l].key < h[min].key)
+            min = l;
+        if (r < n && h[r].key < h[min].key)
+            min = r;
+        if (min == i)
+            return;
+        proc_rank_t tmp = h[i];
+        h[i] = h[min];
+        h[min] = tmp;
+        i = min;
+    }
+}
+
+// Whether key makes it into a heap of cap entries now holding n.
+static int rank_accepts(const proc_rank_t *h, int n, int cap, double key) {
+    return n < cap || key > h[0].key;
+}
+
+// Add (key, item) to a heap holding *n of cap entries, replacing the
+// smallest entry when it is full. Check rank_accepts() first.
+static void rank_push(proc_rank_t *h, int *n, int cap, double key, uint32_t item) {
+    if (*n == cap) {
+        h[0].key = key;
+        h[0].item = item;
+        rank_sift_down(h, *n, 0);
+        return;
+    }
+    int i = (*n)++;
+    h[i].key = key;
+    h[i].item = item;
+    while (i > 0) {
+        int parent = (i - 1) / 2;
+        if (h[parent].key <= h[i].key)
+            return;
+        proc_rank_t tmp = h[i];
+        h[i] = h[parent];
+        h[parent] = tmp;
+        i = parent;
+    }
+}
+
+// Remove the smallest entry of a heap of *n into *out.
+static void rank_pop(proc_rank_t *h, int *n, proc_rank_t *out) {
+    *out = h[0];
+    h[0] = h[--(*n)];
+    rank_sift_down(h, *n, 0);
+}
+
+// Order a heap of n entries by descending key, in place: pop the minimum to
+// the back until the heap is empty.
+static void rank_sort(proc_rank_t *h, int n) {
+    for (int end = n - 1; end > 0; end--) {
+        proc_rank_t tmp = h[0];
+        h[0] = h[end];
+        h[end] = tmp;
+        rank_sift_down(h, end, 0);
+    }
+}
+
+static void proc_label(char *label, size_t size, const proc_entry_t *e) {
+    snprintf(label, size, "%d:%s", e->pid, e->comm);
+}
+
+// --- CPU ---
+typedef struct {
+    int pid;
+    char comm[20];
+    double cpu;                     // % of one CPU over the interval
+    char label[32];                 // "PID:COMM"
+} proc_top_t;
+
+// Select the (at most) n busiest processes of the table into top, busiest
+// first. Returns how many were selected.
+static int calc_top(const proc_table_t *t, uint32_t gen, double seconds, double hz,
+                    proc_rank_t *rank, proc_top_t *top, int n) {
+    int k = 0;
+    if (seconds <= 0 || n <= 0)
+        return 0;
+    double scale = 100.0 / (seconds * hz);
+    for (uint32_t i = 0; i < t->n; i++) {
+        const proc_entry_t *e = &t->procs[i];
+        if (e->seen != gen || e->cpu <= e->prev_cpu)
+            continue;
+        double cpu = (double)(e->cpu - e->prev_cpu) * scale;
+        if (rank_accepts(rank, k, n, cpu))
+            rank_push(rank, &k, n, cpu, i);
+    }
+    rank_sort(rank, k);
+    for (int i = 0; i < k; i++) {
+        const proc_entry_t *e = &t->procs[rank[i].item];
+        top[i].pid = e->pid;
+        memcpy(top[i].comm, e->comm, sizeof(top[i].comm));
+        top[i].cpu = rank[i].key;
+        proc_label(top[i].label, sizeof(top[i].label), e);
+    }
+    return k;
+}
+
+typedef struct {
+    int top_n;                      // processes to report, 0 = collector off
+    proc_scan_t *scan;
+    uint32_t nprocs;                // processes found by the last scan
+    proc_rank_t *rank;
+    proc_top_t *top;
+    int ntop;
+} proc_state_t;
+
+static void proc_destroy(void *state) {
+    proc_state_t *s = state;
+    scan_release(s->scan);
+    free(s->rank);
+    free(s->top);
+    free(s);
+}
+
+static void *proc_init(const bsdmon_options_t *opts) {
+    proc_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->top_n = opts->top;
+    if (s->top_n == 0)
+        return s;
+    s->rank = calloc((size_t)s->top_n, sizeof(*s->rank));
+    s->top = calloc((size_t)s->top_n, sizeof(*s->top));
+    if (!s->rank || !s->top) {
+        perror("calloc");
+        proc_destroy(s);
+        return NULL;
+    }
+    s->scan = scan_acquire(opts);
+    if (!s->scan) {
+        proc_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+static int proc_sample(void *state) {
+    proc_state_t *s = state;
+    if (s->top_n == 0)
+        return 0;
+    if (scan_sample(s->scan) != 0)
+        return -1;
+    s->nprocs = s->scan->table.n;
+    return 0;
+}
+
+static int proc_compute(void *state) {
+    proc_state_t *s = state;
+    if (s->top_n == 0 || s->scan->nscans < 2)
+        return -1;
+    s->ntop = calc_top(&s->scan->table, s->scan->gen,
+                       timespec_diff(&s->scan->prev_taken, &s->scan->taken), s->scan->proc_hz,
+                       s->rank, s->top, s->top_n);
+    return 0;
+}
+
+// One line per process, busiest first, in % of one CPU like top(1).
+static void proc_render(void *state, FILE *out) {
+    const proc_state_t *s = state;
+    fprintf(out, "Top processes by CPU (of %u, scanned in %.2f ms on %d thread%s):%s\n",
+            s->nprocs, s->scan->wall_ms, s->scan->threads, s->scan->threads == 1 ? "" : "s",
+            s->ntop ? "" : " all idle");
+    for (int i = 0; i < s->ntop; i++)
+        fprintf(out, "  %7d %-16s %6.1f%%\n", s->top[i].pid, s->top[i].comm, s->top[i].cpu);
+}
+
+static void proc_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const proc_state_t *s = state;
+    emit(ctx, "proc_count", "", s->nprocs);
+    emit(ctx, "proc_scan_ms", "", s->scan->wall_ms);
+    emit(ctx, "proc_scan_threads", "", s->scan->threads);
+    for (int i = 0; i < s->ntop; i++)
+        emit(ctx, "proc_cpu_percent", s->top[i].label, s->top[i].cpu);
+}
+
+const collector_t proc_collector = {
+    .name = "proc",
+    .interval_ms = 0,
+    .init = proc_init,
+    .sample = proc_sample,
+    .compute = proc_compute,
+    .render = proc_render,
+    .destroy = proc_destroy,
+    .metrics = proc_metrics,
+};
+
+// --- Memory ---
+// Memory per process is ranked by PSS (resident memory with every shared page
+// divided among the processes mapping it), which only /proc/PID/smaps_rollup
+// reports. That file makes the kernel walk the page tables of the process, so
+// the collector runs every 10 seconds by default and reads it for as few
+// processes as it can: candidates are visited by descending RSS, which the
+// scan already has from stat, and since PSS never exceeds RSS the search
+// stops at the first candidate whose RSS is no larger than the N-th PSS
+// found. /proc/PID/status supplies the split into anonymous, file-backed and
+// shared memory. smaps_rollup needs ptrace access to the process, so without
+// root only the user's own processes are ranked.
+typedef struct {
+    int pid;
+    char comm[20];
+    char label[32];                 // "PID:COMM"
+    double pss, anon, file, shmem, swap;    // bytes
+} proc_mem_t;
+
+#ifdef __linux__
+// Read /proc/PID/NAME into buf (NUL terminated). Returns the length or -1.
+static ssize_t proc_read_file(const proc_scan_t *sc, int pid, const char *name, char *buf,
+                              size_t size) {
+    char path[64];
+    snprintf(path, sizeof(path), "%d/%s", pid, name);
+    int fd = openat(sc->proc_fd, path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    size_t len = 0;
+    while (len < size - PROCFS_PAD - 1) {
+        ssize_t n = read(fd, buf + len, size - PROCFS_PAD - 1 - len);
+        if (n <= 0)
+            break;
+        len += (size_t)n;
+    }
+    close(fd);
+    memset(buf + len, 0, PROCFS_PAD + 1);
+    return len ? (ssize_t)len : -1;
+}
+
+// Value of the "KEY:   123 kB" line of a status or smaps file, in bytes; 0 if
+// missing.
+static double proc_kb_field(const char *buf, const char *key) {
+    unsigned long long kb;
+    return proc_field(buf, key, &kb) ? kb * 1024.0 : 0.0;
+}
+
+static int read_mem(const proc_scan_t *sc, const proc_entry_t *e, proc_mem_t *m) {
+    char buf[4096];
+    if (proc_read_file(sc, e->pid, "smaps_rollup", buf, sizeof(buf)) < 0)
+        return -1;
+    m->pss = proc_kb_field(buf, "Pss");
+    m->swap = proc_kb_field(buf, "Swap");
+    if (proc_read_file(sc, e->pid, "status", buf, sizeof(buf)) < 0)
+        return -1;
+    m->anon = proc_kb_field(buf, "RssAnon");
+    m->file = proc_kb_field(buf, "RssFile");
+    m->shmem = proc_kb_field(buf, "RssShmem");
+    return 0;
+}
+#else
+// FreeBSD has no per-process PSS.
+static int read_mem(const proc_scan_t *sc, const proc_entry_t *e, proc_mem_t *m) {
+    (void)sc;
+    (void)e;
+    (void)m;
+    return -1;
+}
+#endif
+
+typedef struct {
+    int top_n;                      // processes to report, 0 = collector off
+    int scans;                      // runs the scan itself (no CPU or I/O view)
+    proc_scan_t *scan;
+    proc_rank_t *cand;              // candidates, by descending RSS
+    uint32_t cand_cap;
+    proc_rank_t *rank;
+    proc_mem_t *mem;                // rank items index this
+    proc_mem_t *top;                // the result, largest PSS first
+    int ntop;
+    uint32_t nread;                 // smaps_rollup files read by the last sample
+    int sampled;
+} procmem_state_t;
+
+static void procmem_destroy(void *state) {
+    procmem_state_t *s = state;
+    scan_release(s->scan);
+    free(s->cand);
+    free(s->rank);
+    free(s->mem);
+    free(s->top);
+    free(s);
+}
+
+static void *procmem_init(const bsdmon_options_t *opts) {
+    procmem_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->top_n = opts->top_mem;
+    if (s->top_n == 0)
+        return s;
+    s->scans = opts->top == 0 && opts->top_io == 0;
+    s->rank = calloc((size_t)s->top_n, sizeof(*s->rank));
+    s->mem = calloc((size_t)s->top_n, sizeof(*s->mem));
+    s->top = calloc((size_t)s->top_n, sizeof(*s->top));
+    if (!s->rank || !s->mem || !s->top) {
+        perror("calloc");
+        procmem_destroy(s);
+        return NULL;
+    }
+    s->scan = scan_acquire(opts);
+    if (!s->scan) {
+        procmem_destroy(s);
+        return NULL;
+    }
+    return s;
+}
+
+static int procmem_sample(void *state) {
+    procmem_state_t *s = state;
+    if (s->top_n == 0)
+        return 0;
+    s->sampled = 0;
+    if (s->scans && scan_sample(s->scan) != 0)
+        return -1;
+    const proc_table_t *t = &s->scan->table;
+    if (t->n > s->cand_cap) {
+        proc_rank_t *c = realloc(s->cand, t->n * sizeof(*c));
+        if (!c) {
+            perror("realloc");
+            return -1;
+        }
+        s->cand = c;
+        s->cand_cap = t->n;
+    }
+
+    // A min-heap on -RSS pops the largest RSS first.
+    int ncand = 0;
+    for (uint32_t i = 0; i < t->n; i++)
+        if (t->procs[i].seen == s->scan->gen && t->procs[i].rss > 0) {
+            s->cand[ncand].key = -(double)t->procs[i].rss;
+            s->cand[ncand++].item = i;
+        }
+    for (int i = ncand / 2 - 1; i >= 0; i--)
+        rank_sift_down(s->cand, ncand, i);
+
+    double page = (double)sysconf(_SC_PAGESIZE);
+    int k = 0;
+    s->nread = 0;
+    while (ncand > 0) {
+        proc_rank_t c;
+        rank_pop(s->cand, &ncand, &c);
+        if (k == s->top_n && -c.key * page <= s->rank[0].key)
+            break;
+        const proc_entry_t *e = &t->procs[c.item];
+        proc_mem_t m;
+        s->nread++;
+        if (read_mem(s->scan, e, &m) != 0 || !rank_accepts(s->rank, k, s->top_n, m.pss))
+            continue;
+        uint32_t slot = k < s->top_n ? (uint32_t)k : s->rank[0].item;
+        m.pid = e->pid;
+        memcpy(m.comm, e->comm, sizeof(m.comm));
+        proc_label(m.label, sizeof(m.label), e);
+        s->mem[slot] = m;
+        rank_push(s->rank, &k, s->top_n, m.pss, slot);
+    }
+    rank_sort(s->rank, k);
+    for (int i = 0; i < k; i++)
+        s->top[i] = s->mem[s->rank[i].item];
+    s->ntop = k;
+    s->sampled = 1;
+    return 0;
+}
+
+static int procmem_compute(void *state) {
+    procmem_state_t *s = state;
+    return s->top_n && s->sampled ? 0 : -1;
+}
+
+static void procmem_render(void *state, FILE *out) {
+    const procmem_state_t *s = state;
+    fprintf(out, "Top processes by memory (PSS, %u read):%s\n", s->nread,
+            s->ntop ? "" : " none readable");
+    for (int i = 0; i < s->ntop; i++) {
+        const proc_mem_t *m = &s->top[i];
+        fprintf(out, "  %7d %-16s pss %.1f MB (anon %.1f MB file %.1f MB shmem %.1f MB)"
+                " swap %.1f MB\n",
+                m->pid, m->comm, m->pss / MB, m->anon / MB, m->file / MB, m->shmem / MB,
+                m->swap / MB);
+    }
+}
+
+static void procmem_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const procmem_state_t *s = state;
+    for (int i = 0; i < s->ntop; i++) {
+        const proc_mem_t *m = &s->top[i];
+        emit(ctx, "proc_mem_pss_bytes", m->label, m->pss);
+        emit(ctx, "proc_mem_anon_bytes", m->label, m->anon);
+        emit(ctx, "proc_mem_file_bytes", m->label, m->file);
+        emit(ctx, "proc_mem_shmem_bytes", m->label, m->shmem);
+        emit(ctx, "proc_mem_swap_bytes", m->label, m->swap);
+    }
+}
+
+const collector_t procmem_collector = {
+    .name = "procmem",
+    .interval_ms = 10000,
+    .init = procmem_init,
+    .sample = procmem_sample,
+    .compute = procmem_compute,
+    .render = procmem_render,
+    .destroy = procmem_destroy,
+    .metrics = procmem_metrics,
+};
+
+// --- I/O ---
+// Storage I/O per process: the bytes each process made the block layer read
+// and write (page cache hits are not counted) and its read and write
+// syscalls, as rates over the last scan interval. The counters are read by
+// the shared scan, in the same pass and on the same threads as stat. Like
+// CPU time of children, the kernel adds the I/O of a reaped child to its
+// parent, so a shell shows the I/O of a command that just finished.
+typedef struct {
+    int pid;
+    char comm[20];
+    char label[32];                 // "PID:COMM"
+    double rate[PROC_IO_FIELDS];    // per second, PROC_IO_*
+} proc_io_t;
+
+// Select the (at most) n processes moving the most bytes into top, busiest
+// first. Returns how many were selected.
+static int calc_top_io(const proc_table_t *t, uint32_t gen, double seconds, proc_rank_t *rank,
+                       proc_io_t *top, int n) {
+    int k = 0;
+    if (seconds <= 0 || n <= 0)
+        return 0;
+    for (uint32_t i = 0; i < t->n; i++) {
+        const proc_entry_t *e = &t->procs[i];
+        if (e->io_seen != gen || !e->io_delta)
+            continue;
+        unsigned long long bytes = 0;
+        for (int f = PROC_IO_READ; f <= PROC_IO_WRITE; f++)
+            if (e->io[f] > e->prev_io[f])
+                bytes += e->io[f] - e->prev_io[f];
+        if (bytes > 0 && rank_accepts(rank, k, n, (double)bytes))
+            rank_push(rank, &k, n, (double)bytes, i);
+    }
+    rank_sort(rank, k);
+    for (int i = 0; i < k; i++) {
+        const proc_entry_t *e = &t->procs[rank[i].item];
+        top[i].pid = e->pid;
+        memcpy(top[i].comm, e->comm, sizeof(top[i].comm));
+        proc_label(top[i].label, sizeof(top[i].label), e);
+        for (int f = 0; f < PROC_IO_FIELDS; f++)
+            top[i].rate[f] = e->io[f] > e->prev_io[f] ?
+                (double)(e->io[f] - e->prev_io[f]) / seconds : 0.0;
+    }
+    return k;
+}
+
+typedef struct {
+    int top_n;                      // processes to report, 0 = collector off
+    int scans;                      // runs the scan itself (no CPU collector)
+    proc_scan_t *scan;
+    proc_rank_t *rank;
+    proc_io_t *top;
+    int ntop;
+} procio_state_t;
+
+static void procio_destroy(void *state) {
+    procio_state_t *s = state;
+    scan_release(s->scan);
+    free(s->rank);
+    free(s->top);
+    free(s);
+}
+
+static void *procio_init(const bsdmon_options_t *opts) {
+    procio_state_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->top_n = opts->top_io;
+    if (s->top_n == 0)
+        return s;
+    s->scans = opts->top == 0;
+    s->rank = calloc((size_t)s->top_n, sizeof(*s->rank));
+    s->top = calloc((size_t)s->top_n, sizeof(*s->top));
+    if (!s->rank || !s->top) {
+        perror("calloc");
+        procio_destroy(s);
+        return NULL;
+    }
+    s->scan = scan_acquire(opts);
+    if (!s->scan) {
+        procio_destroy(s);
+        return NULL;
+    }
+    s->scan->want_io = 1;
+    return s;
+}
+
+static int procio_sample(void *state) {
+    procio_state_t *s = state;
+    if (s->top_n == 0 || !s->scans)
+        return 0;
+    return scan_sample(s->scan);
+}
+
+static int procio_compute(void *state) {
+    procio_state_t *s = state;
+    if (s->top_n == 0 || s->scan->nscans < 2)
+        return -1;
+    s->ntop = calc_top_io(&s->scan->table, s->scan->gen,
+                          timespec_diff(&s->scan->prev_taken, &s->scan->taken),
+                          s->rank, s->top, s->top_n);
+    return 0;
+}
+
+static void procio_render(void *state, FILE *out) {
+    const procio_state_t *s = state;
+    fprintf(out, "Top processes by I/O:%s\n", s->ntop ? "" : " none");
+    for (int i = 0; i < s->ntop; i++) {
+        const proc_io_t *p = &s->top[i];
+        fprintf(out, "  %7d %-16s read %.2f MB/s write %.2f MB/s (%.1f reads/s, %.1f writes/s)\n",
+                p->pid, p->comm, p->rate[PROC_IO_READ] / MB, p->rate[PROC_IO_WRITE] / MB,
+                p->rate[PROC_IO_SYSCR], p->rate[PROC_IO_SYSCW]);
+    }
+}
+
+static void procio_metrics(void *state, metric_emit_t emit, void *ctx) {
+    const procio_state_t *s = state;
+    for (int i = 0; i < s->ntop; i++) {
+        const proc_io_t *p = &s->top[i];
+        emit(ctx, "proc_io_read_bytes_per_second", p->label, p->rate[PROC_IO_READ]);
+        emit(ctx, "proc_io_write_bytes_per_second", p->label, p->rate[PROC_IO_WRITE]);
+        emit(ctx, "proc_io_read_syscalls_per_second", p->label, p->rate[PROC_IO_SYSCR]);
+        emit(ctx, "proc_io_write_syscalls_per_second", p->label, p->rate[PROC_IO_SYSCW]);
+    }
+}
+
+const collector_t procio_collector = {
+    .name = "procio",
+    .interval_ms = 0,
+    .init = procio_init,
+    .sample = procio_sample,
+    .compute = procio_compute,
+    .render = procio_render,
+    .destroy = procio_destroy,
+    .metrics = procio_metrics,
+};
@@ -0,0 +1,72 @@
+/*
+ * procfs.c - bsdmon: allocation-free reader for /proc files
+ *
+ * See procfs.h. Files are opened once and re-read with pread() from offset 0;
+ * procfs files regenerate their contents on every read from the start.
+ */
+
+#include "procfs.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+// Resize the buffer to hold cap bytes plus the NUL and the SWAR padding.
+static int procfs_reserve(procfs_file_t *f, size_t cap) {
+    char *buf = realloc(f->buf, cap + 1 + PROCFS_PAD);
+    if (!buf)
+        return -1;
+    f->buf = buf;
+    f->cap = cap;
+    return 0;
+}
+
+int procfs_open(procfs_file_t *f, const char *path, size_t initial_cap) {
+    f->fd = open(path, O_RDONLY | O_CLOEXEC);
+    f->buf = NULL;
+    f->len = 0;
+    f->cap = 0;
+    if (f->fd < 0)
+        return -1;
+    if (procfs_reserve(f, initial_cap ? initial_cap : 4096) < 0) {
+        int err = errno;
+        close(f->fd);
+        f->fd = -1;
+        errno = err;
+        return -1;
+    }
+    f->buf[0] = '\0';
+    return 0;
+}
+
+int procfs_read(procfs_file_t *f) {
+    size_t len = 0;
+    for (;;) {
+        if (len == f->cap && procfs_reserve(f, f->cap * 2) < 0)
+            return -1;
+        ssize_t r = pread(f->fd, f->buf + len, f->cap - len, (off_t)len);
+        if (r < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (r == 0)
+            break;
+        len += (size_t)r;
+    }
+    f->len = len;
+    // NUL terminate and zero the padding so SWAR loads see non-digits.
+    memset(f->buf + len, 0, 1 + PROCFS_PAD);
+    return 0;
+}
+
+void procfs_close(procfs_file_t *f) {
+    if (f->fd >= 0)
+        close(f->fd);
+    free(f->buf);
+    f->fd = -1;
+    f->buf = NULL;
+    f->len = 0;
+    f->cap = 0;
+}
@@ -0,0 +1,114 @@
+/*
+ * procfs.h - bsdmon: allocation-free reader and number scanner for /proc files
+ *
+ * A procfs_file_t keeps its file descriptor open for the life of the monitor
+ * and re-reads the whole file from offset 0 with pread() into a buffer that is
+ * reused across samples, so a steady-state read costs one or two syscalls and
+ * no allocation. The buffer only grows if the file outgrows it.
+ *
+ * The parsing helpers work directly on that buffer. Decimal numbers are
+ * scanned eight digits at a time (SWAR) on little-endian targets; the buffer
+ * carries PROCFS_PAD readable bytes past its end so the 8-byte loads never
+ * leave the allocation.
+ */
+
+#ifndef BSDMON_PROCFS_H
+#define BSDMON_PROCFS_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define PROCFS_PAD 8
+
+typedef struct {
+    int fd;
+    char *buf;      // file contents, NUL terminated
+    size_t len;     // bytes read by the last procfs_read()
+    size_t cap;     // usable capacity of buf, excluding the NUL and padding
+} procfs_file_t;
+
+#define PROCFS_FILE_INIT { -1, NULL, 0, 0 }
+
+// Open path and allocate the initial buffer. Returns 0 or -1 with errno set.
+int procfs_open(procfs_file_t *f, const char *path, size_t initial_cap);
+
+// Re-read the whole file into f->buf. Returns 0 or -1 with errno set.
+int procfs_read(procfs_file_t *f);
+
+void procfs_close(procfs_file_t *f);
+
+// Advance past spaces and tabs.
+static inline const char *procfs_skip_blanks(const char *p) {
+    while (*p == ' ' || *p == '\t')
+        p++;
+    return p;
+}
+
+// Advance to the first character of the next line (or the terminating NUL).
+static inline const char *procfs_next_line(const char *p) {
+    const char *nl = strchr(p, '\n');
+    return nl ? nl + 1 : p + strlen(p);
+}
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(__GNUC__)
+// Number of leading ASCII digits in the 8 bytes of v (first byte lowest).
+static inline int procfs_swar_digits(uint64_t v) {
+    uint64_t hi = (v & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL;
+    uint64_t lo = ((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) ^ 0x3030303030303030ULL;
+    uint64_t bad = hi | lo;
+    return bad ? __builtin_ctzll(bad) >> 3 : 8;
+}
+
+// Value of the first n (1..8) digits of v.
+static inline uint64_t procfs_swar_value(uint64_t v, int n) {
+    // Borrows from the subtraction only move towards later bytes, which are
+    // shifted out below, so the digit bytes are exact.
+    v -= 0x3030303030303030ULL;
+    if (n < 8)
+        v <<= 8 * (8 - n);
+    v = (v * 10) + (v >> 8);
+    v = (((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+         (((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return v;
+}
+#endif
+
+// Parse an unsigned decimal number after optional blanks. On success store it
+// in *out, advance *pp past the digits and return 1; otherwise return 0 and
+// leave *pp untouched.
+static inline int procfs_u64(const char **pp, unsigned long long *out) {
+    const char *p = procfs_skip_blanks(*pp);
+    if ((unsigned)(*p - '0') > 9)
+        return 0;
+    unsigned long long v = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ && defined(__GNUC__)
+    for (;;) {
+        uint64_t chunk;
+        memcpy(&chunk, p, sizeof(chunk));
+        int n = procfs_swar_digits(chunk);
+        if (n == 0)
+            break;
+        uint64_t part = procfs_swar_value(chunk, n);
+        if (n == 8) {
+            v = v * 100000000ULL + part;
+            p += 8;
+            continue;
+        }
+        static const uint64_t pow10[8] = {
+            1, 10, 100, 1000, 10000, 100000, 1000000, 10000000
+        };
+        v = v * pow10[n] + part;
+        p += n;
+        break;
+    }
+#else
+    while ((unsigned)(*p - '0') <= 9)
+        v = v * 10 + (unsigned)(*p++ - '0');
+#endif
+    *out = v;
+    *pp = p;
+    return 1;
+}
+
+#endif
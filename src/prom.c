@@ -0,0 +1,621 @@
+/*
+ * prom.c - bsdmon: Prometheus exporter
+ *
+ * See prom.h.
+ */
+
+#include "prom.h"
+#include "series.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <fcntl.h>
+#include <netdb.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#define PROM_PREFIX "bsdmon_"
+#define PROM_MAX_CLIENTS 64
+#define PROM_REQUEST_SIZE 4096
+#define PROM_IDLE_SEC 60            // idle connections are closed after this
+#define PROM_MAX_COLLECTORS 32
+
+typedef struct {
+    const char *collector;
+    int family;
+    int next;                   // next series of the family, -1 at the end
+    int64_t time_ms;
+    double value;
+} prom_series_t;
+
+typedef struct {
+    char *name;
+    const char *label_key;
+    int first, last;            // series in first-seen order
+} prom_family_t;
+
+typedef struct {
+    prom_t *p;
+    int fd;
+    size_t len;
+    time_t active;              // CLOCK_MONOTONIC of the last request or send
+    // The part of a response the socket did not take yet. Further requests
+    // wait in req until it is sent.
+    char *out;
+    size_t out_len, out_sent, out_cap;
+    int closing;                // close once out is sent
+    char req[PROM_REQUEST_SIZE];
+} prom_client_t;
+
+struct prom {
+    reactor_t *reactor;
+    int listen_fd;
+    series_table_t table;
+    prom_series_t *series;      // by series id
+    uint32_t cap;
+    prom_family_t *families;
+    int nfamilies, capfamilies;
+    // Time of the latest run of every collector; series of a collector that
+    // were not part of its latest run are no longer exported.
+    struct {
+        const char *collector;
+        int64_t time_ms;
+    } runs[PROM_MAX_COLLECTORS];
+    int nruns;
+    int dirty;
+    // The pre-rendered response.
+    char header[160];
+    size_t header_len;
+    char *body;
+    size_t body_len, body_cap;
+    int failed;                 // rendering ran out of memory
+    prom_client_t *clients[PROM_MAX_CLIENTS];
+};
+
+// Metrics are emitted with one anonymous label; these name it.
+static const struct {
+    const char *prefix;
+    const char *key;
+} prom_label_keys[] = {
+    { "cpu_state_", "state" },
+    { "cpu_core_",  "cpu" },
+    { "diskio_",    "device" },
+    { "disk_",      "mountpoint" },
+    { "net_",       "interface" },
+    { "proc_",      "process" },
+};
+
+static const char *prom_label_key(const char *name) {
+    for (size_t i = 0; i < sizeof(prom_label_keys) / sizeof(prom_label_keys[0]); i++)
+        if (strncmp(name, prom_label_keys[i].prefix, strlen(prom_label_keys[i].prefix)) == 0)
+            return prom_label_keys[i].key;
+    return "label";
+}
+
+// --- Series ---
+static int prom_family(prom_t *p, const char *name) {
+    for (int i = 0; i < p->nfamilies; i++)
+        if (strcmp(p->families[i].name, name) == 0)
+            return i;
+    if (p->nfamilies == p->capfamilies) {
+        int cap = p->capfamilies ? p->capfamilies * 2 : 32;
+        prom_family_t *f = realloc(p->families, cap * sizeof(*f));
+        if (!f)
+            return -1;
+        p->families = f;
+        p->capfamilies = cap;
+    }
+    prom_family_t *f = &p->families[p->nfamilies];
+    if (!(f->name = strdup(name)))
+        return -1;
+    f->label_key = prom_label_key(name);
+    f->first = f->last = -1;
+    return p->nfamilies++;
+}
+
+static prom_series_t *prom_series(prom_t *p, const char *name, const char *label) {
+    int added;
+    int id = series_get(&p->table, NULL, name, label, &added);
+    if (id < 0)
+        return NULL;
+    if (!added)
+        return &p->series[id];
+    int family = -1;
+    if (p->cap < p->table.cap) {
+        prom_series_t *s = realloc(p->series, p->table.cap * sizeof(*s));
+        if (s) {
+            p->series = s;
+            p->cap = p->table.cap;
+        }
+    }
+    if ((uint32_t)id < p->cap)
+        family = prom_family(p, name);
+    if (family < 0) {
+        series_remove(&p->table, id);
+        return NULL;
+    }
+
+    prom_series_t *s = &p->series[id];
+    s->family = family;
+    s->next = -1;
+    prom_family_t *f = &p->families[family];
+    if (f->last >= 0)
+        p->series[f->last].next = id;
+    else
+        f->first = id;
+    f->last = id;
+    return s;
+}
+
+void prom_set(prom_t *p, int64_t time_ms, const char *collector, const char *name,
+              const char *label, double value) {
+    prom_series_t *s = prom_series(p, name, label);
+    if (!s)
+        return;
+    s->collector = collector;
+    s->time_ms = time_ms;
+    s->value = value;
+    p->dirty = 1;
+
+    int i;
+    for (i = 0; i < p->nruns; i++)
+        if (p->runs[i].collector == collector)
+            break;
+    if (i == p->nruns) {
+        if (i == PROM_MAX_COLLECTORS)
+            return;
+        p->runs[p->nruns++].collector = collector;
+        p->runs[i].time_ms = time_ms;
+    }
+    if (time_ms > p->runs[i].time_ms)
+        p->runs[i].time_ms = time_ms;
+}
+
+void prom_remove(prom_t *p, const char *name, const char *label) {
+    int id = series_find(&p->table, NULL, name, label);
+    if (id < 0)
+        return;
+    prom_family_t *f = &p->families[p->series[id].family];
+    int prev = -1;
+    for (int i = f->first; i != id; i = p->series[i].next)
+        prev = i;
+    if (prev >= 0)
+        p->series[prev].next = p->series[id].next;
+    else
+        f->first = p->series[id].next;
+    if (f->last == id)
+        f->last = prev;
+    series_remove(&p->table, id);
+    p->dirty = 1;
+}
+
+static int prom_current(const prom_t *p, const prom_series_t *s) {
+    for (int i = 0; i < p->nruns; i++)
+        if (p->runs[i].collector == s->collector)
+            return s->time_ms >= p->runs[i].time_ms;
+    return 1;
+}
+
+// --- Rendering ---
+static void prom_reserve(prom_t *p, size_t len) {
+    if (p->body_len + len <= p->body_cap)
+        return;
+    size_t cap = p->body_cap ? p->body_cap : 16384;
+    while (cap < p->body_len + len)
+        cap *= 2;
+    char *body = realloc(p->body, cap);
+    if (!body) {
+        p->failed = 1;
+        return;
+    }
+    p->body = body;
+    p->body_cap = cap;
+}
+
+static void prom_puts(prom_t *p, const char *s, size_t len) {
+    prom_reserve(p, len);
+    if (p->failed)
+        return;
+    memcpy(p->body + p->body_len, s, len);
+    p->body_len += len;
+}
+
+static void prom_printf(prom_t *p, const char *fmt, ...) {
+    char buf[128];
+    va_list ap;
+    va_start(ap, fmt);
+    int len = vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    if (len > 0)
+        prom_puts(p, buf, (size_t)len < sizeof(buf) ? (size_t)len : sizeof(buf) - 1);
+}
+
+// Label values escape backslash, double quote and newline.
+static void prom_put_label(prom_t *p, const char *v) {
+    for (const char *s = v; *s; s++) {
+        if (*s == '\\')
+            prom_puts(p, "\\\\", 2);
+        else if (*s == '"')
+            prom_puts(p, "\\\"", 2);
+        else if (*s == '\n')
+            prom_puts(p, "\\n", 2);
+        else
+            prom_puts(p, s, 1);
+    }
+}
+
+static void prom_put_value(prom_t *p, double v) {
+    if (isnan(v))
+        prom_puts(p, "NaN", 3);
+    else if (isinf(v))
+        prom_puts(p, v > 0 ? "+Inf" : "-Inf", 4);
+    else
+        prom_printf(p, "%.15g", v);
+}
+
+void prom_publish(prom_t *p) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    for (int i = 0; i < PROM_MAX_CLIENTS; i++) {
+        prom_client_t *c = p->clients[i];
+        if (c && now.tv_sec - c->active > PROM_IDLE_SEC) {
+            reactor_remove_fd(p->reactor, c->fd);
+            close(c->fd);
+            free(c->out);
+            free(c);
+            p->clients[i] = NULL;
+        }
+    }
+    if (!p->dirty)
+        return;
+    p->dirty = 0;
+
+    p->body_len = 0;
+    p->failed = 0;
+    for (int i = 0; i < p->nfamilies; i++) {
+        const prom_family_t *f = &p->families[i];
+        int typed = 0;
+        for (int j = f->first; j >= 0; j = p->series[j].next) {
+            const prom_series_t *s = &p->series[j];
+            if (!prom_current(p, s))
+                continue;
+            if (!typed) {
+                prom_printf(p, "# TYPE " PROM_PREFIX "%s gauge\n", f->name);
+                typed = 1;
+            }
+            const char *label = p->table.keys[j].label;
+            prom_puts(p, PROM_PREFIX, sizeof(PROM_PREFIX) - 1);
+            prom_puts(p, f->name, strlen(f->name));
+            if (label[0]) {
+                prom_printf(p, "{%s=\"", f->label_key);
+                prom_put_label(p, label);
+                prom_puts(p, "\"}", 2);
+            }
+            prom_puts(p, " ", 1);
+            prom_put_value(p, s->value);
+            prom_puts(p, "\n", 1);
+        }
+    }
+    if (p->failed)
+        p->body_len = 0;
+    p->header_len = (size_t)snprintf(p->header, sizeof(p->header),
+                                     "HTTP/1.1 200 OK\r\n"
+                                     "Content-Type: text/plain; version=0.0.4; charset=utf-8\r\n"
+                                     "Content-Length: %zu\r\n\r\n",
+                                     p->body_len);
+}
+
+// --- HTTP ---
+static void prom_close_client(prom_client_t *c) {
+    prom_t *p = c->p;
+    for (int i = 0; i < PROM_MAX_CLIENTS; i++)
+        if (p->clients[i] == c)
+            p->clients[i] = NULL;
+    reactor_remove_fd(p->reactor, c->fd);
+    close(c->fd);
+    free(c->out);
+    free(c);
+}
+
+// Send as much of a and b as the socket takes without blocking. Returns the
+// number of bytes sent, or -1 if the connection failed.
+static ssize_t prom_send(int fd, const char *a, size_t alen, const char *b, size_t blen) {
+    struct iovec iov[2] = { { (void *)a, alen }, { (void *)b, blen } };
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = blen ? 2 : 1;
+    ssize_t sent;
+    do
+        sent = sendmsg(fd, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+    while (sent < 0 && errno == EINTR);
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return sent;
+}
+
+// Send a response, keeping what the socket did not take for prom_flush().
+// The response is copied, so it may be re-rendered meanwhile.
+static int prom_respond(prom_client_t *c, const char *a, size_t alen, const char *b,
+                        size_t blen) {
+    ssize_t sent = prom_send(c->fd, a, alen, b, blen);
+    if (sent < 0)
+        return -1;
+    size_t done = (size_t)sent, left = alen + blen - done;
+    if (!left)
+        return 0;
+    if (left > c->out_cap) {
+        char *out = realloc(c->out, left);
+        if (!out)
+            return -1;
+        c->out = out;
+        c->out_cap = left;
+    }
+    if (done < alen) {
+        memcpy(c->out, a + done, alen - done);
+        memcpy(c->out + alen - done, b, blen);
+    } else {
+        memcpy(c->out, b + (done - alen), left);
+    }
+    c->out_len = left;
+    c->out_sent = 0;
+    return reactor_set_fd_events(c->p->reactor, c->fd, REACTOR_WRITE);
+}
+
+// Continue sending the pending response. Returns -1 if the connection failed.
+static int prom_flush(prom_client_t *c) {
+    ssize_t sent = prom_send(c->fd, c->out + c->out_sent, c->out_len - c->out_sent, NULL, 0);
+    if (sent < 0)
+        return -1;
+    c->out_sent += (size_t)sent;
+    if (c->out_sent < c->out_len)
+        return 0;
+    c->out_len = c->out_sent = 0;
+    return reactor_set_fd_events(c->p->reactor, c->fd, REACTOR_READ);
+}
+
+// Answer with an error status and close the connection.
+static int prom_reply_error(prom_client_t *c, const char *status) {
+    char buf[128];
+    int len = snprintf(buf, sizeof(buf),
+                       "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    c->closing = 1;
+    return prom_respond(c, buf, (size_t)len, NULL, 0);
+}
+
+// Answer one request (its header is req[0, len), NUL-terminated and free of
+// other NUL bytes). Returns -1 if the connection failed.
+static int prom_handle(prom_client_t *c, char *req) {
+    prom_t *p = c->p;
+    char *eol = strstr(req, "\r\n");
+    char *target = eol ? memchr(req, ' ', (size_t)(eol - req)) : NULL;
+    char *version = target ? memchr(target + 1, ' ', (size_t)(eol - target - 1)) : NULL;
+    if (!version)
+        return prom_reply_error(c, "400 Bad Request");
+    *eol = '\0';
+    *target++ = '\0';
+    *version++ = '\0';
+    char *method = req;
+    if (strncmp(version, "HTTP/1.", 7) != 0)
+        return prom_reply_error(c, "505 HTTP Version Not Supported");
+    if (strcmp(method, "GET") != 0)
+        return prom_reply_error(c, "405 Method Not Allowed");
+    size_t path_len = strcspn(target, "?");
+    if (path_len != 8 || strncmp(target, "/metrics", 8) != 0)
+        return prom_reply_error(c, "404 Not Found");
+
+    // HTTP/1.1 connections persist unless the client closes them.
+    int keep = strcmp(version, "HTTP/1.1") == 0;
+    for (char *line = eol + 2; *line; ) {
+        char *end = strstr(line, "\r\n");
+        if (end)
+            *end = '\0';
+        if (strncasecmp(line, "Connection:", 11) == 0) {
+            const char *v = line + 11 + strspn(line + 11, " \t");
+            if (strncasecmp(v, "close", 5) == 0)
+                keep = 0;
+        }
+        if (!end)
+            break;
+        line = end + 2;
+    }
+    c->closing = !keep;
+    return prom_respond(c, p->header, p->header_len, p->body, p->body_len);
+}
+
+static char *prom_header_end(char *buf, size_t len) {
+    for (size_t i = 3; i < len; i++)
+        if (buf[i] == '\n' && buf[i - 1] == '\r' && buf[i - 2] == '\n' && buf[i - 3] == '\r')
+            return buf + i + 1;
+    return NULL;
+}
+
+// Answer the complete requests in the buffer, in order, until one of them
+// leaves a response pending. Returns -1 once the connection is to be closed.
+static int prom_process(prom_client_t *c) {
+    char *end;
+    while (!c->out_len && !c->closing && (end = prom_header_end(c->req, c->len))) {
+        size_t used = (size_t)(end - c->req);
+        int status;
+        if (memchr(c->req, '\0', used)) {
+            status = prom_reply_error(c, "400 Bad Request");
+        } else {
+            char saved = *end;
+            *end = '\0';
+            status = prom_handle(c, c->req);
+            *end = saved;
+        }
+        if (status != 0)
+            return -1;
+        memmove(c->req, end, c->len - used);
+        c->len -= used;
+    }
+    if (!c->out_len && !c->closing && c->len == sizeof(c->req) - 1 &&
+        prom_reply_error(c, "431 Request Header Fields Too Large") != 0)
+        return -1;
+    return c->closing && !c->out_len ? -1 : 0;
+}
+
+static void prom_on_client(reactor_t *r, int fd, void *arg) {
+    (void)r;
+    prom_client_t *c = arg;
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // While a response is pending only writability is watched.
+    if (c->out_len) {
+        if (prom_flush(c) != 0) {
+            prom_close_client(c);
+            return;
+        }
+        c->active = now.tv_sec;
+        if (!c->out_len && prom_process(c) != 0)
+            prom_close_client(c);
+        return;
+    }
+
+    ssize_t len = recv(fd, c->req + c->len, sizeof(c->req) - 1 - c->len, 0);
+    if (len < 0 && (errno == EINTR || errno == EAGAIN))
+        return;
+    if (len <= 0) {
+        prom_close_client(c);
+        return;
+    }
+    c->len += (size_t)len;
+    c->active = now.tv_sec;
+    if (prom_process(c) != 0)
+        prom_close_client(c);
+}
+
+static void prom_on_accept(reactor_t *r, int fd, void *arg) {
+    prom_t *p = arg;
+    int cfd = accept(fd, NULL, NULL);
+    if (cfd < 0)
+        return;
+    int slot;
+    for (slot = 0; slot < PROM_MAX_CLIENTS; slot++)
+        if (!p->clients[slot])
+            break;
+    prom_client_t *c = slot < PROM_MAX_CLIENTS ? calloc(1, sizeof(*c)) : NULL;
+    if (!c) {
+        static const char busy[] =
+            "HTTP/1.1 503 Service Unavailable\r\nContent-Length: 0\r\nConnection: close\r\n\r\n";
+        prom_send(cfd, busy, sizeof(busy) - 1, NULL, 0);
+        close(cfd);
+        return;
+    }
+    // Client sockets never block the reactor: what a slow scraper does not
+    // take is kept and sent when the socket becomes writable.
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    fcntl(cfd, F_SETFD, FD_CLOEXEC);
+    fcntl(cfd, F_SETFL, fcntl(cfd, F_GETFL) | O_NONBLOCK);
+    c->p = p;
+    c->fd = cfd;
+    c->active = now.tv_sec;
+    if (reactor_add_fd(r, cfd, prom_on_client, c) != 0) {
+        close(cfd);
+        free(c);
+        return;
+    }
+    p->clients[slot] = c;
+}
+
+static int prom_listen(const char *addr) {
+    char host[256];
+    const char *port = strrchr(addr, ':');
+    const char *h = NULL;
+    if (port) {
+        size_t len = (size_t)(port - addr);
+        if (len >= 2 && addr[0] == '[' && addr[len - 1] == ']') {
+            addr++;
+            len -= 2;
+        }
+        if (len >= sizeof(host)) {
+            fprintf(stderr, "Invalid listen address: %s\n", addr);
+            return -1;
+        }
+        memcpy(host, addr, len);
+        host[len] = '\0';
+        h = len ? host : NULL;
+        port++;
+    } else {
+        port = addr;
+    }
+
+    struct addrinfo hints, *res;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE;
+    int err = getaddrinfo(h, port, &hints, &res);
+    if (err) {
+        fprintf(stderr, "%s: %s\n", addr, gai_strerror(err));
+        return -1;
+    }
+    // Without a host, prefer the IPv6 wildcard, which also accepts IPv4 on
+    // dual-stack systems.
+    const struct addrinfo *ai = res;
+    if (!h)
+        for (const struct addrinfo *i = res; i; i = i->ai_next)
+            if (i->ai_family == AF_INET6) {
+                ai = i;
+                break;
+            }
+    int fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC | SOCK_NONBLOCK,
+                    ai->ai_protocol);
+    int one = 1;
+    if (fd < 0 || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0 ||
+        bind(fd, ai->ai_addr, ai->ai_addrlen) < 0 || listen(fd, 16) < 0) {
+        perror(addr);
+        if (fd >= 0)
+            close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(res);
+    return fd;
+}
+
+prom_t *prom_create(reactor_t *r, const char *addr) {
+    prom_t *p = calloc(1, sizeof(*p));
+    if (!p) {
+        perror("calloc");
+        return NULL;
+    }
+    p->reactor = r;
+    if ((p->listen_fd = prom_listen(addr)) < 0 ||
+        reactor_add_fd(r, p->listen_fd, prom_on_accept, p) != 0) {
+        if (p->listen_fd >= 0)
+            close(p->listen_fd);
+        free(p);
+        return NULL;
+    }
+    // Scrapes before the first sample get an empty body.
+    p->dirty = 1;
+    prom_publish(p);
+    return p;
+}
+
+void prom_destroy(prom_t *p) {
+    if (!p)
+        return;
+    for (int i = 0; i < PROM_MAX_CLIENTS; i++)
+        if (p->clients[i])
+            prom_close_client(p->clients[i]);
+    reactor_remove_fd(p->reactor, p->listen_fd);
+    close(p->listen_fd);
+    for (int i = 0; i < p->nfamilies; i++)
+        free(p->families[i].name);
+    series_table_free(&p->table);
+    free(p->series);
+    free(p->families);
+    free(p->body);
+    free(p);
+}
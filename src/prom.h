@@ -0,0 +1,45 @@
+/*
+ * prom.h - bsdmon: Prometheus exporter
+ *
+ * Serves the latest value of every metric at GET /metrics in the Prometheus
+ * text exposition format (version 0.0.4, which OpenMetrics scrapers accept).
+ * The response is rendered once per scheduler tick that produced new values,
+ * into a buffer reused from tick to tick; a scrape only sends it with one
+ * vectored write of the pre-rendered header and body, so any number of
+ * scrapers cost no extra /proc reads and no formatting.
+ *
+ * Connections are plain HTTP/1.x on the reactor's thread, kept open between
+ * scrapes unless the client asks otherwise. Client sockets are non-blocking:
+ * whatever part of a response a slow scraper does not take at once is copied
+ * and sent as the socket becomes writable, and the requests it pipelined
+ * behind it wait until then.
+ */
+
+#ifndef BSDMON_PROM_H
+#define BSDMON_PROM_H
+
+#include <stdint.h>
+
+#include "reactor.h"
+
+typedef struct prom prom_t;
+
+// Listen on addr, "[HOST:]PORT" (an IPv6 HOST in brackets), all addresses
+// when HOST is omitted.
+prom_t *prom_create(reactor_t *r, const char *addr);
+
+// Update one metric. collector and every series of a collector are tracked so
+// that series a collector stopped emitting (a removed interface or mount)
+// disappear from the output.
+void prom_set(prom_t *p, int64_t time_ms, const char *collector, const char *name,
+              const char *label, double value);
+
+// Stop exporting a series, e.g. once its collector stopped emitting it.
+void prom_remove(prom_t *p, const char *name, const char *label);
+
+// Render the response if anything was set since the last call.
+void prom_publish(prom_t *p);
+
+void prom_destroy(prom_t *p);
+
+#endif
@@ -0,0 +1,473 @@
+/*
+ * reactor.c - bsdmon: single-threaded event loop
+ *
+ * See reactor.h.
+ */
+
+#include "reactor.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+
+#ifdef __FreeBSD__
+#include <sys/types.h>
+#include <sys/event.h>
+#endif
+
+#include "bsdmon.h"
+
+enum {
+    SRC_FD,
+    SRC_DEADLINE,   // one-shot timer
+    SRC_SIGNAL,
+#ifdef __linux__
+    SRC_SIGNALFD,   // the shared signalfd behind all SRC_SIGNAL sources
+#endif
+};
+
+typedef struct reactor_source {
+    int kind;           // SRC_*
+    int fd;             // watched or owned descriptor; signal number for SRC_SIGNAL
+    union {
+        reactor_fd_cb_t fd;
+        reactor_timer_cb_t timer;
+        reactor_signal_cb_t signal;
+    } cb;
+    void *arg;
+    int events;         // REACTOR_READ and REACTOR_WRITE, for SRC_FD
+    int dead;           // removed, freed after the current batch
+#ifdef __FreeBSD__
+    int write_added;    // an EVFILT_WRITE filter exists for fd
+#endif
+    struct reactor_source *next;
+} reactor_source_t;
+
+struct reactor {
+    int fd;             // epoll or kqueue descriptor
+    int running;
+    int ndead;
+    reactor_source_t *sources;
+#ifdef __linux__
+    reactor_source_t *sigsrc;   // SRC_SIGNALFD, created with the first signal
+    sigset_t sigmask;
+#endif
+};
+
+#define REACTOR_BATCH 16
+
+static reactor_source_t *reactor_source_new(reactor_t *r, int kind, int fd, void *arg) {
+    reactor_source_t *src = calloc(1, sizeof(*src));
+    if (!src) {
+        perror("calloc");
+        return NULL;
+    }
+    src->kind = kind;
+    src->fd = fd;
+    src->events = REACTOR_READ;
+    src->arg = arg;
+    src->next = r->sources;
+    r->sources = src;
+    return src;
+}
+
+// Unlink and free a source that was never handed to the kernel.
+static void reactor_source_drop(reactor_t *r, reactor_source_t *src) {
+    r->sources = src->next;
+    free(src);
+}
+
+static reactor_source_t *reactor_fd_source(reactor_t *r, int fd) {
+    for (reactor_source_t *src = r->sources; src; src = src->next)
+        if (src->kind == SRC_FD && src->fd == fd && !src->dead)
+            return src;
+    return NULL;
+}
+
+// A timer from reactor_add_deadline(); its id is kept in fd.
+static reactor_source_t *reactor_deadline_source(reactor_t *r, int timer) {
+    for (reactor_source_t *src = r->sources; src; src = src->next)
+        if (src->kind == SRC_DEADLINE && src->fd == timer && !src->dead)
+            return src;
+    return NULL;
+}
+
+int64_t reactor_now_ms(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (int64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void reactor_reap(reactor_t *r) {
+    for (reactor_source_t **pp = &r->sources; *pp;) {
+        reactor_source_t *src = *pp;
+        if (src->dead) {
+            *pp = src->next;
+            free(src);
+        } else {
+            pp = &src->next;
+        }
+    }
+    r->ndead = 0;
+}
+
+reactor_t *reactor_create(void) {
+    reactor_t *r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+#ifdef __linux__
+    r->fd = epoll_create1(EPOLL_CLOEXEC);
+    sigemptyset(&r->sigmask);
+#else
+    r->fd = kqueue();
+#endif
+    if (r->fd < 0) {
+        perror("reactor");
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+#ifdef __linux__
+static int reactor_epoll(reactor_t *r, int op, reactor_source_t *src) {
+    struct epoll_event ev;
+    memset(&ev, 0, sizeof(ev));
+    ev.events = (src->events & REACTOR_READ ? EPOLLIN : 0) |
+                (src->events & REACTOR_WRITE ? EPOLLOUT : 0);
+    ev.data.ptr = src;
+    return epoll_ctl(r->fd, op, src->fd, &ev);
+}
+
+static int reactor_watch(reactor_t *r, reactor_source_t *src) {
+    return reactor_epoll(r, EPOLL_CTL_ADD, src);
+}
+
+int reactor_add_fd(reactor_t *r, int fd, reactor_fd_cb_t cb, void *arg) {
+    reactor_source_t *src = reactor_source_new(r, SRC_FD, fd, arg);
+    if (!src)
+        return -1;
+    src->cb.fd = cb;
+    if (reactor_watch(r, src) < 0) {
+        perror("epoll_ctl");
+        reactor_source_drop(r, src);
+        return -1;
+    }
+    return 0;
+}
+
+int reactor_set_fd_events(reactor_t *r, int fd, int events) {
+    reactor_source_t *src = reactor_fd_source(r, fd);
+    if (!src)
+        return -1;
+    if (src->events == events)
+        return 0;
+    src->events = events;
+    if (reactor_epoll(r, EPOLL_CTL_MOD, src) < 0) {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+void reactor_remove_fd(reactor_t *r, int fd) {
+    reactor_source_t *src = reactor_fd_source(r, fd);
+    if (src) {
+        epoll_ctl(r->fd, EPOLL_CTL_DEL, fd, NULL);
+        src->dead = 1;
+        r->ndead++;
+    }
+}
+
+int reactor_add_deadline(reactor_t *r, reactor_timer_cb_t cb, void *arg) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd < 0) {
+        perror("timerfd_create");
+        return -1;
+    }
+    reactor_source_t *src = reactor_source_new(r, SRC_DEADLINE, fd, arg);
+    if (!src) {
+        close(fd);
+        return -1;
+    }
+    src->cb.timer = cb;
+    if (reactor_watch(r, src) < 0) {
+        perror("epoll_ctl");
+        reactor_source_drop(r, src);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int reactor_set_deadline(reactor_t *r, int timer, int64_t deadline_ms) {
+    if (!reactor_deadline_source(r, timer))
+        return -1;
+    // A zero it_value would disarm the timer; no real deadline is at 0.
+    struct itimerspec its;
+    memset(&its, 0, sizeof(its));
+    if (deadline_ms < 1)
+        deadline_ms = 1;
+    its.it_value.tv_sec = (time_t)(deadline_ms / 1000);
+    its.it_value.tv_nsec = (long)(deadline_ms % 1000) * 1000000L;
+    if (timerfd_settime(timer, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        perror("timerfd_settime");
+        return -1;
+    }
+    return 0;
+}
+
+int reactor_add_signal(reactor_t *r, int signo, reactor_signal_cb_t cb, void *arg) {
+    // All signals share one signalfd whose mask grows with every registration.
+    sigset_t mask = r->sigmask;
+    sigaddset(&mask, signo);
+    int fd = signalfd(r->sigsrc ? r->sigsrc->fd : -1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (fd < 0) {
+        perror("signalfd");
+        return -1;
+    }
+    if (!r->sigsrc) {
+        reactor_source_t *src = reactor_source_new(r, SRC_SIGNALFD, fd, NULL);
+        if (!src) {
+            close(fd);
+            return -1;
+        }
+        if (reactor_watch(r, src) < 0) {
+            perror("epoll_ctl");
+            reactor_source_drop(r, src);
+            close(fd);
+            return -1;
+        }
+        r->sigsrc = src;
+    }
+    reactor_source_t *src = reactor_source_new(r, SRC_SIGNAL, signo, arg);
+    if (!src)
+        return -1;
+    src->cb.signal = cb;
+    r->sigmask = mask;
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) < 0) {
+        perror("sigprocmask");
+        return -1;
+    }
+    return 0;
+}
+
+static void reactor_dispatch_signals(reactor_t *r) {
+    struct signalfd_siginfo si;
+    while (read(r->sigsrc->fd, &si, sizeof(si)) == (ssize_t)sizeof(si)) {
+        for (reactor_source_t *src = r->sources; src; src = src->next) {
+            if (src->kind == SRC_SIGNAL && src->fd == (int)si.ssi_signo && !src->dead) {
+                src->cb.signal(r, src->fd, src->arg);
+                break;
+            }
+        }
+    }
+}
+
+int reactor_run(reactor_t *r) {
+    struct epoll_event events[REACTOR_BATCH];
+    r->running = 1;
+    while (r->running) {
+        int n = epoll_wait(r->fd, events, REACTOR_BATCH, -1);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            return -1;
+        }
+        for (int i = 0; i < n && r->running; i++) {
+            reactor_source_t *src = events[i].data.ptr;
+            if (src->dead)
+                continue;
+            switch (src->kind) {
+            case SRC_FD:
+                src->cb.fd(r, src->fd, src->arg);
+                break;
+            case SRC_DEADLINE: {
+                uint64_t expirations;
+                if (read(src->fd, &expirations, sizeof(expirations)) == (ssize_t)sizeof(expirations))
+                    src->cb.timer(r, src->arg);
+                break;
+            }
+            case SRC_SIGNALFD:
+                reactor_dispatch_signals(r);
+                break;
+            }
+        }
+        if (r->ndead)
+            reactor_reap(r);
+    }
+    return 0;
+}
+
+void reactor_destroy(reactor_t *r) {
+    if (!r)
+        return;
+    for (reactor_source_t *src = r->sources; src; src = src->next)
+        if (src->kind == SRC_DEADLINE || src->kind == SRC_SIGNALFD)
+            close(src->fd);
+    // Signals stay blocked: one arriving now must not kill the process
+    // halfway through its cleanup.
+    for (reactor_source_t *src = r->sources; src; src = src->next)
+        src->dead = 1;
+    reactor_reap(r);
+    close(r->fd);
+    free(r);
+}
+#endif
+
+#ifdef __FreeBSD__
+static int reactor_change(reactor_t *r, uintptr_t ident, short filter, unsigned short flags,
+                          unsigned fflags, intptr_t data, void *udata) {
+    struct kevent kev;
+    EV_SET(&kev, ident, filter, flags, fflags, data, udata);
+    return kevent(r->fd, &kev, 1, NULL, 0, NULL);
+}
+
+int reactor_add_fd(reactor_t *r, int fd, reactor_fd_cb_t cb, void *arg) {
+    reactor_source_t *src = reactor_source_new(r, SRC_FD, fd, arg);
+    if (!src)
+        return -1;
+    src->cb.fd = cb;
+    if (reactor_change(r, (uintptr_t)fd, EVFILT_READ, EV_ADD, 0, 0, src) < 0) {
+        perror("kevent");
+        reactor_source_drop(r, src);
+        return -1;
+    }
+    return 0;
+}
+
+// The write filter is added the first time it is wanted and then only
+// enabled and disabled.
+int reactor_set_fd_events(reactor_t *r, int fd, int events) {
+    reactor_source_t *src = reactor_fd_source(r, fd);
+    if (!src)
+        return -1;
+    int changed = src->events ^ events;
+    if ((changed & REACTOR_READ) &&
+        reactor_change(r, (uintptr_t)fd, EVFILT_READ,
+                       events & REACTOR_READ ? EV_ENABLE : EV_DISABLE, 0, 0, src) < 0) {
+        perror("kevent");
+        return -1;
+    }
+    if ((changed & REACTOR_WRITE) &&
+        reactor_change(r, (uintptr_t)fd, EVFILT_WRITE,
+                       events & REACTOR_WRITE ? EV_ADD | EV_ENABLE : EV_DISABLE, 0, 0, src) < 0) {
+        perror("kevent");
+        return -1;
+    }
+    if (events & REACTOR_WRITE)
+        src->write_added = 1;
+    src->events = events;
+    return 0;
+}
+
+void reactor_remove_fd(reactor_t *r, int fd) {
+    reactor_source_t *src = reactor_fd_source(r, fd);
+    if (src) {
+        reactor_change(r, (uintptr_t)fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+        if (src->write_added)
+            reactor_change(r, (uintptr_t)fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+        src->dead = 1;
+        r->ndead++;
+    }
+}
+
+// NOTE_ABSTIME timers run on CLOCK_REALTIME, so deadlines are armed as
+// relative one-shot timers instead.
+int reactor_add_deadline(reactor_t *r, reactor_timer_cb_t cb, void *arg) {
+    static int ids;
+    reactor_source_t *src = reactor_source_new(r, SRC_DEADLINE, ids++, arg);
+    if (!src)
+        return -1;
+    src->cb.timer = cb;
+    return src->fd;
+}
+
+int reactor_set_deadline(reactor_t *r, int timer, int64_t deadline_ms) {
+    reactor_source_t *src = reactor_deadline_source(r, timer);
+    if (!src)
+        return -1;
+    int64_t delay = deadline_ms - reactor_now_ms();
+    if (reactor_change(r, (uintptr_t)src, EVFILT_TIMER, EV_ADD | EV_ONESHOT, NOTE_MSECONDS,
+                       (intptr_t)(delay > 0 ? delay : 0), src) < 0) {
+        perror("kevent");
+        return -1;
+    }
+    return 0;
+}
+
+int reactor_add_signal(reactor_t *r, int signo, reactor_signal_cb_t cb, void *arg) {
+    reactor_source_t *src = reactor_source_new(r, SRC_SIGNAL, signo, arg);
+    if (!src)
+        return -1;
+    src->cb.signal = cb;
+    // EVFILT_SIGNAL still records ignored signals.
+    if (reactor_change(r, (uintptr_t)signo, EVFILT_SIGNAL, EV_ADD, 0, 0, src) < 0) {
+        perror("kevent");
+        reactor_source_drop(r, src);
+        return -1;
+    }
+    signal(signo, SIG_IGN);
+    return 0;
+}
+
+int reactor_run(reactor_t *r) {
+    struct kevent events[REACTOR_BATCH];
+    r->running = 1;
+    while (r->running) {
+        int n = kevent(r->fd, NULL, 0, events, REACTOR_BATCH, NULL);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("kevent");
+            return -1;
+        }
+        for (int i = 0; i < n && r->running; i++) {
+            reactor_source_t *src = events[i].udata;
+            if (src->dead)
+                continue;
+            switch (src->kind) {
+            case SRC_FD:
+                src->cb.fd(r, src->fd, src->arg);
+                break;
+            case SRC_DEADLINE:
+                src->cb.timer(r, src->arg);
+                break;
+            case SRC_SIGNAL:
+                src->cb.signal(r, src->fd, src->arg);
+                break;
+            }
+        }
+        if (r->ndead)
+            reactor_reap(r);
+    }
+    return 0;
+}
+
+void reactor_destroy(reactor_t *r) {
+    if (!r)
+        return;
+    for (reactor_source_t *src = r->sources; src; src = src->next)
+        src->dead = 1;
+    reactor_reap(r);
+    close(r->fd);
+    free(r);
+}
+#endif
+
+void reactor_stop(reactor_t *r) {
+    r->running = 0;
+}
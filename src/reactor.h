@@ -0,0 +1,71 @@
+/*
+ * reactor.h - bsdmon: single-threaded event loop
+ *
+ * A reactor_t waits on every event source of the process at once: one-shot
+ * timers, signals and readable or writable file descriptors (netlink and
+ * routing sockets, client connections). Between events the
+ * process sleeps in one blocking call. On Linux it is an epoll set over
+ * timerfd, signalfd and the registered descriptors; on FreeBSD a kqueue with
+ * EVFILT_TIMER, EVFILT_SIGNAL and EVFILT_READ and EVFILT_WRITE.
+ *
+ * Signals handled by the reactor are blocked (Linux) or ignored (FreeBSD) for
+ * normal delivery, so register them before starting any threads.
+ */
+
+#ifndef BSDMON_REACTOR_H
+#define BSDMON_REACTOR_H
+
+#include <stdint.h>
+
+typedef struct reactor reactor_t;
+
+// Called when fd is ready for one of the events it is watched for.
+typedef void (*reactor_fd_cb_t)(reactor_t *r, int fd, void *arg);
+// Called when a timer's deadline has passed.
+typedef void (*reactor_timer_cb_t)(reactor_t *r, void *arg);
+// Called when signo was received.
+typedef void (*reactor_signal_cb_t)(reactor_t *r, int signo, void *arg);
+
+reactor_t *reactor_create(void);
+
+// Watch fd for readability. The caller keeps ownership of fd.
+int reactor_add_fd(reactor_t *r, int fd, reactor_fd_cb_t cb, void *arg);
+
+enum {
+    REACTOR_READ = 1,
+    REACTOR_WRITE = 2,
+};
+
+// Change what fd is watched for: REACTOR_READ, REACTOR_WRITE or both.
+// reactor_add_fd() starts with REACTOR_READ.
+int reactor_set_fd_events(reactor_t *r, int fd, int events);
+
+// Stop watching fd. Safe to call from a callback.
+void reactor_remove_fd(reactor_t *r, int fd);
+
+// Add a one-shot timer, disarmed until reactor_set_deadline(). Returns a
+// timer id, or -1.
+int reactor_add_deadline(reactor_t *r, reactor_timer_cb_t cb, void *arg);
+
+// Arm a timer from reactor_add_deadline() to fire once at deadline_ms on the
+// clock of reactor_now_ms(), replacing the previous deadline. A deadline that
+// has passed fires right away.
+int reactor_set_deadline(reactor_t *r, int timer, int64_t deadline_ms);
+
+// CLOCK_MONOTONIC in milliseconds.
+int64_t reactor_now_ms(void);
+
+// Handle signo through the reactor instead of its default action.
+int reactor_add_signal(reactor_t *r, int signo, reactor_signal_cb_t cb, void *arg);
+
+// Dispatch events until reactor_stop() is called. Returns 0, or -1 if waiting
+// for events failed.
+int reactor_run(reactor_t *r);
+
+void reactor_stop(reactor_t *r);
+
+// Close the reactor's own descriptors and free it. Signals registered with
+// the reactor keep their blocked or ignored disposition.
+void reactor_destroy(reactor_t *r);
+
+#endif
@@ -0,0 +1,162 @@
+/*
+ * rollup.c - bsdmon: downsampled metric tiers
+ *
+ * See rollup.h.
+ */
+
+#include "rollup.h"
+#include "series.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const char *const rollup_tier_names[ROLLUP_TIERS] = { "1m", "1h" };
+const int64_t rollup_tier_ms[ROLLUP_TIERS] = { 60 * 1000, 3600 * 1000 };
+
+typedef struct {
+    rollup_bucket_t open[ROLLUP_TIERS];  // count == 0 when empty
+    int gone;                   // removed once its open minute has ended
+} rollup_series_t;
+
+struct rollup {
+    rollup_emit_t emit;
+    void *ctx;
+    series_table_t table;
+    rollup_series_t *series;    // by series id
+    uint32_t cap;
+};
+
+// The series id of name{label}, or -1 when out of memory.
+static int rollup_series(rollup_t *r, const char *name, const char *label) {
+    int added;
+    int id = series_get(&r->table, NULL, name, label, &added);
+    if (id < 0 || !added)
+        return id;
+    if (r->cap < r->table.cap) {
+        rollup_series_t *p = realloc(r->series, r->table.cap * sizeof(*p));
+        if (!p) {
+            series_remove(&r->table, id);
+            return -1;
+        }
+        r->series = p;
+        r->cap = r->table.cap;
+    }
+    memset(&r->series[id], 0, sizeof(r->series[id]));
+    return id;
+}
+
+static int64_t rollup_align(int64_t t, int64_t width) {
+    int64_t q = t / width;
+    if (t < 0 && q * width != t)
+        q--;
+    return q * width;
+}
+
+// Fold src (a finished bucket or a single sample) into the open bucket of
+// the given tier, first finishing the open one if src starts a new interval.
+static void rollup_fold(rollup_t *r, int id, int tier, const rollup_bucket_t *src) {
+    rollup_bucket_t *b = &r->series[id].open[tier];
+    int64_t start = rollup_align(src->start_ms, rollup_tier_ms[tier]);
+    if (b->count && b->start_ms != start) {
+        rollup_bucket_t done = *b;
+        const series_key_t *k = &r->table.keys[id];
+        b->count = 0;
+        r->emit(r->ctx, tier, k->name, k->label, &done);
+        if (tier + 1 < ROLLUP_TIERS)
+            rollup_fold(r, id, tier + 1, &done);
+    }
+    if (!b->count) {
+        *b = *src;
+        b->start_ms = start;
+        return;
+    }
+    if (src->min < b->min)
+        b->min = src->min;
+    if (src->max > b->max)
+        b->max = src->max;
+    b->sum += src->sum;
+    b->count += src->count;
+    b->last = src->last;
+}
+
+void rollup_add(rollup_t *r, int64_t time_ms, const char *name, const char *label, double value) {
+    int id = rollup_series(r, name, label);
+    if (id < 0)
+        return;
+    rollup_bucket_t sample = { time_ms, value, value, value, value, 1 };
+    r->series[id].gone = 0;
+    rollup_fold(r, id, ROLLUP_1M, &sample);
+}
+
+// Finish the open buckets of one series.
+static void rollup_finish(rollup_t *r, int id) {
+    const series_key_t *k = &r->table.keys[id];
+    for (int tier = 0; tier < ROLLUP_TIERS; tier++) {
+        rollup_bucket_t *b = &r->series[id].open[tier];
+        if (!b->count)
+            continue;
+        rollup_bucket_t done = *b;
+        b->count = 0;
+        r->emit(r->ctx, tier, k->name, k->label, &done);
+        // The open hour already includes the minutes finished before; add
+        // the partial minute too.
+        if (tier + 1 < ROLLUP_TIERS)
+            rollup_fold(r, id, tier + 1, &done);
+    }
+}
+
+void rollup_remove(rollup_t *r, const char *name, const char *label) {
+    int id = series_find(&r->table, NULL, name, label);
+    if (id >= 0)
+        r->series[id].gone = 1;
+}
+
+void rollup_advance(rollup_t *r, int64_t now_ms) {
+    for (uint32_t id = 0; id < r->table.n; id++) {
+        if (!series_live(&r->table, id))
+            continue;
+        const series_key_t *k = &r->table.keys[id];
+        for (int tier = 0; tier < ROLLUP_TIERS; tier++) {
+            rollup_bucket_t *b = &r->series[id].open[tier];
+            if (!b->count || b->start_ms + rollup_tier_ms[tier] > now_ms)
+                continue;
+            rollup_bucket_t done = *b;
+            b->count = 0;
+            r->emit(r->ctx, tier, k->name, k->label, &done);
+            if (tier + 1 < ROLLUP_TIERS)
+                rollup_fold(r, (int)id, tier + 1, &done);
+        }
+        // A removed series leaves with its partial hour once no later
+        // minute can come, so the tiers stay in time order.
+        if (r->series[id].gone && !r->series[id].open[ROLLUP_1M].count) {
+            rollup_finish(r, (int)id);
+            series_remove(&r->table, (int)id);
+        }
+    }
+}
+
+void rollup_flush(rollup_t *r) {
+    for (uint32_t id = 0; id < r->table.n; id++)
+        if (series_live(&r->table, id))
+            rollup_finish(r, (int)id);
+}
+
+rollup_t *rollup_create(rollup_emit_t emit, void *ctx) {
+    rollup_t *r = calloc(1, sizeof(*r));
+    if (!r) {
+        perror("calloc");
+        return NULL;
+    }
+    r->emit = emit;
+    r->ctx = ctx;
+    return r;
+}
+
+void rollup_destroy(rollup_t *r) {
+    if (!r)
+        return;
+    series_table_free(&r->table);
+    free(r->series);
+    free(r);
+}
@@ -0,0 +1,65 @@
+/*
+ * rollup.h - bsdmon: downsampled metric tiers
+ *
+ * Samples are folded into fixed-width buckets as they arrive: every series
+ * has one open one-minute bucket, and each finished minute is folded into
+ * the open one-hour bucket. A bucket keeps min, max, sum, count and last,
+ * which is all that is needed to merge it into the next tier, so no raw
+ * samples are kept. Finished buckets are handed to a callback (normally to be
+ * appended to a per-tier store, see store.h), so long-range queries read a
+ * few points per hour instead of every sample.
+ *
+ * A bucket is finished by the first sample of its series past its end or by
+ * rollup_advance(), whichever comes first. Calling rollup_advance() on every
+ * tick finishes the buckets of series that paused or went away on time, so
+ * each tier hands out its buckets in start time order.
+ */
+
+#ifndef BSDMON_ROLLUP_H
+#define BSDMON_ROLLUP_H
+
+#include <stdint.h>
+
+enum {
+    ROLLUP_1M,
+    ROLLUP_1H,
+    ROLLUP_TIERS
+};
+
+extern const char *const rollup_tier_names[ROLLUP_TIERS];   // "1m", "1h"
+extern const int64_t rollup_tier_ms[ROLLUP_TIERS];
+
+typedef struct {
+    int64_t start_ms;       // bucket start, aligned to the tier width
+    double min, max;
+    double sum;
+    double last;
+    uint64_t count;
+} rollup_bucket_t;
+
+// Called for every finished bucket.
+typedef void (*rollup_emit_t)(void *ctx, int tier, const char *name, const char *label,
+                              const rollup_bucket_t *b);
+
+typedef struct rollup rollup_t;
+
+rollup_t *rollup_create(rollup_emit_t emit, void *ctx);
+
+// Fold one sample into the open buckets of its series, finishing those whose
+// interval ended.
+void rollup_add(rollup_t *r, int64_t time_ms, const char *name, const char *label, double value);
+
+// Forget a series, e.g. once its collector stopped emitting it. Its open
+// buckets are finished, and the series dropped, by rollup_advance() once its
+// minute has ended; a sample in the meantime keeps it.
+void rollup_remove(rollup_t *r, const char *name, const char *label);
+
+// Finish every open bucket whose interval ended by now_ms (CLOCK_REALTIME).
+void rollup_advance(rollup_t *r, int64_t now_ms);
+
+// Finish every open bucket, e.g. before exiting.
+void rollup_flush(rollup_t *r);
+
+void rollup_destroy(rollup_t *r);
+
+#endif
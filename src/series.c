@@ -0,0 +1,139 @@
+/*
+ * series.c - bsdmon: metric series table
+ *
+ * See series.h.
+ */
+
+#include "series.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+uint32_t series_hash(const char *name, const char *label) {
+    uint32_t h = 2166136261u;   // FNV-1a
+    for (const char *p = name; *p; p++)
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    h *= 16777619u;             // the NUL after name
+    for (const char *p = label; *p; p++)
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    return h * 16777619u;
+}
+
+static int series_match(const series_key_t *k, uint32_t hash, const char *collector,
+                        const char *name, const char *label) {
+    return k->hash == hash && k->collector == collector && strcmp(k->name, name) == 0 &&
+           strcmp(k->label, label) == 0;
+}
+
+// Slot of the series, or of the empty slot ending its probe sequence.
+static uint32_t series_slot(const series_table_t *t, uint32_t hash, const char *collector,
+                            const char *name, const char *label) {
+    uint32_t mask = t->nslots - 1, i = hash & mask;
+    while (t->slots[i] && !series_match(&t->keys[t->slots[i] - 1], hash, collector, name, label))
+        i = (i + 1) & mask;
+    return i;
+}
+
+static int series_rehash(series_table_t *t, uint32_t nslots) {
+    uint32_t *slots = calloc(nslots, sizeof(*slots));
+    if (!slots)
+        return -1;
+    for (uint32_t id = 0; id < t->n; id++) {
+        if (!t->keys[id].name)
+            continue;
+        uint32_t j = t->keys[id].hash & (nslots - 1);
+        while (slots[j])
+            j = (j + 1) & (nslots - 1);
+        slots[j] = id + 1;
+    }
+    free(t->slots);
+    t->slots = slots;
+    t->nslots = nslots;
+    return 0;
+}
+
+int series_find(const series_table_t *t, const char *collector, const char *name,
+                const char *label) {
+    if (!t->nslots)
+        return -1;
+    uint32_t i = series_slot(t, series_hash(name, label), collector, name, label);
+    return t->slots[i] ? (int)t->slots[i] - 1 : -1;
+}
+
+int series_get(series_table_t *t, const char *collector, const char *name, const char *label,
+               int *added) {
+    uint32_t hash = series_hash(name, label);
+    *added = 0;
+    if (t->nslots) {
+        uint32_t i = series_slot(t, hash, collector, name, label);
+        if (t->slots[i])
+            return (int)t->slots[i] - 1;
+    }
+
+    // Keep the table at most half full.
+    if ((t->live + 1) * 2 > t->nslots && series_rehash(t, t->nslots ? t->nslots * 2 : 64) != 0)
+        return -1;
+    if (!t->nfree && t->n == t->cap) {
+        uint32_t cap = t->cap ? t->cap * 2 : 32;
+        series_key_t *keys = realloc(t->keys, cap * sizeof(*keys));
+        if (keys)
+            t->keys = keys;
+        uint32_t *free_ids = keys ? realloc(t->free_ids, cap * sizeof(*free_ids)) : NULL;
+        if (!free_ids)
+            return -1;
+        t->free_ids = free_ids;
+        t->cap = cap;
+    }
+    size_t name_len = strlen(name), label_len = strlen(label);
+    char *key = malloc(name_len + label_len + 2);
+    if (!key)
+        return -1;
+    memcpy(key, name, name_len + 1);
+    memcpy(key + name_len + 1, label, label_len + 1);
+
+    uint32_t id = t->nfree ? t->free_ids[--t->nfree] : t->n++;
+    series_key_t *k = &t->keys[id];
+    k->name = key;
+    k->label = key + name_len + 1;
+    k->collector = collector;
+    k->hash = hash;
+    t->slots[series_slot(t, hash, collector, name, label)] = id + 1;
+    t->live++;
+    *added = 1;
+    return (int)id;
+}
+
+void series_remove(series_table_t *t, int id) {
+    if (id < 0 || !series_live(t, (uint32_t)id))
+        return;
+    series_key_t *k = &t->keys[id];
+    uint32_t mask = t->nslots - 1, hole = k->hash & mask;
+    while (t->slots[hole] != (uint32_t)id + 1)
+        hole = (hole + 1) & mask;
+    free(k->name);
+    k->name = NULL;
+    k->label = NULL;
+    t->free_ids[t->nfree++] = (uint32_t)id;
+    t->live--;
+
+    // Move back every entry of the run after the hole that may sit in it:
+    // those whose home slot is not cyclically in (hole, i].
+    t->slots[hole] = 0;
+    for (uint32_t i = (hole + 1) & mask; t->slots[i]; i = (i + 1) & mask) {
+        uint32_t home = t->keys[t->slots[i] - 1].hash & mask;
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            t->slots[hole] = t->slots[i];
+            t->slots[i] = 0;
+            hole = i;
+        }
+    }
+}
+
+void series_table_free(series_table_t *t) {
+    for (uint32_t id = 0; id < t->n; id++)
+        free(t->keys[id].name);
+    free(t->keys);
+    free(t->free_ids);
+    free(t->slots);
+    memset(t, 0, sizeof(*t));
+}
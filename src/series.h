@@ -0,0 +1,63 @@
+/*
+ * series.h - bsdmon: metric series table
+ *
+ * Everything that keeps state per metric series (the history, rollups,
+ * change detection, the exporters) looks series up by name and label, and
+ * some also by the collector that emits them. A series_table_t maps those to
+ * small integer ids; its owner keeps the per-series state in arrays indexed
+ * by id, sized to the table's cap. Ids are handed out in order and those of
+ * removed series are reused, so the arrays stay as large as the number of
+ * series alive at once, not the number ever seen.
+ *
+ * The index is open-addressed with linear probing over a power-of-two slot
+ * array kept at most half full. Removal shifts the entries that follow back
+ * into the hole instead of leaving tombstones, so probes never lengthen.
+ */
+
+#ifndef BSDMON_SERIES_H
+#define BSDMON_SERIES_H
+
+#include <stdint.h>
+
+typedef struct {
+    char *name;             // "name\0label", NULL while the id is free
+    const char *label;      // points into name
+    const char *collector;  // compared by pointer; NULL when not keyed by it
+    uint32_t hash;
+} series_key_t;
+
+typedef struct {
+    series_key_t *keys;     // by id
+    uint32_t n;             // ids handed out; the ones below n may be free
+    uint32_t cap;           // ids allocated
+    uint32_t live;          // series in the table
+    uint32_t *free_ids;     // removed ids, reused last-in first-out
+    uint32_t nfree;
+    uint32_t *slots;        // id + 1, 0 when empty
+    uint32_t nslots;        // power of two
+} series_table_t;
+
+// FNV-1a over "name\0label\0", the bytes of a store dictionary key.
+uint32_t series_hash(const char *name, const char *label);
+
+// Id of the series, or -1 if it is not in the table.
+int series_find(const series_table_t *t, const char *collector, const char *name,
+                const char *label);
+
+// Id of the series, adding it (and setting *added) if it is new. Returns -1
+// when out of memory. collector may be NULL.
+int series_get(series_table_t *t, const char *collector, const char *name, const char *label,
+               int *added);
+
+// Remove a series; its id goes to the next series added.
+void series_remove(series_table_t *t, int id);
+
+// Whether id names a series in the table.
+static inline int series_live(const series_table_t *t, uint32_t id) {
+    return id < t->n && t->keys[id].name;
+}
+
+// Free the table's memory; it is empty and usable again afterwards.
+void series_table_free(series_table_t *t);
+
+#endif
@@ -0,0 +1,183 @@
+/*
+ * shm.c - bsdmon: shared-memory export, writer side
+ *
+ * See shm.h and bsdmon_shm.h.
+ */
+
+#include "shm.h"
+#include "bsdmon_shm.h"
+#include "series.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+_Static_assert(sizeof(bsdmon_shm_t) == 64, "shm header layout");
+_Static_assert(sizeof(bsdmon_shm_metric_t) == 128, "shm slot layout");
+
+#define SHM_SIZE (sizeof(bsdmon_shm_t) + BSDMON_SHM_CAPACITY * sizeof(bsdmon_shm_metric_t))
+
+struct shm_export {
+    char *name;
+    bsdmon_shm_t *shm;
+    int warned;                 // full region already reported
+    int64_t time_ms;            // latest sample time set
+    // Private index of the published slots, so updates never scan the
+    // shared region; a series id is its slot.
+    series_table_t table;
+    // Values are staged here while the collectors run and copied to the
+    // region by shm_export_publish(), so readers only ever wait for the
+    // copies, never for a sample.
+    bsdmon_shm_metric_t *staged;    // BSDMON_SHM_CAPACITY slots
+    uint32_t count;                 // slots in use, as published in the header
+    uint8_t *dirty;                 // slot changed since the last publish
+    uint32_t *changed;              // the dirty slots, in the order they changed
+    uint32_t nchanged;
+};
+
+static void shm_touch(shm_export_t *x, int index) {
+    if (x->dirty[index])
+        return;
+    x->dirty[index] = 1;
+    x->changed[x->nchanged++] = (uint32_t)index;
+}
+
+static bsdmon_shm_metric_t *shm_slot(shm_export_t *x, const char *name, const char *label) {
+    int index = series_find(&x->table, NULL, name, label);
+    if (index >= 0) {
+        shm_touch(x, index);
+        return &x->staged[index];
+    }
+
+    if (strlen(name) >= BSDMON_SHM_NAME_SIZE || strlen(label) >= BSDMON_SHM_LABEL_SIZE)
+        return NULL;
+    if (x->table.live == BSDMON_SHM_CAPACITY) {
+        if (!x->warned) {
+            fprintf(stderr, "Shared-memory export full; new metrics are not exported\n");
+            x->warned = 1;
+        }
+        return NULL;
+    }
+    int added;
+    if ((index = series_get(&x->table, NULL, name, label, &added)) < 0)
+        return NULL;
+    shm_touch(x, index);
+    bsdmon_shm_metric_t *m = &x->staged[index];
+    strcpy(m->name, name);
+    strcpy(m->label, label);
+    if ((uint32_t)index >= x->count)
+        x->count = (uint32_t)index + 1;
+    return m;
+}
+
+void shm_export_set(shm_export_t *x, int64_t time_ms, const char *name, const char *label,
+                    double value) {
+    bsdmon_shm_metric_t *m = shm_slot(x, name, label);
+    if (!m)
+        return;
+    m->time_ms = time_ms;
+    m->value = value;
+    if (time_ms > x->time_ms)
+        x->time_ms = time_ms;
+}
+
+void shm_export_remove(shm_export_t *x, const char *name, const char *label) {
+    int index = series_find(&x->table, NULL, name, label);
+    if (index < 0)
+        return;
+    shm_touch(x, index);
+    memset(&x->staged[index], 0, sizeof(x->staged[index]));
+    series_remove(&x->table, index);
+}
+
+// The write section: seq is odd only while the changed slots are copied.
+void shm_export_publish(shm_export_t *x) {
+    if (!x->nchanged)
+        return;
+    uint64_t seq = atomic_load_explicit(&x->shm->seq, memory_order_relaxed);
+    atomic_store_explicit(&x->shm->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    for (uint32_t i = 0; i < x->nchanged; i++) {
+        uint32_t index = x->changed[i];
+        x->shm->metrics[index] = x->staged[index];
+        x->dirty[index] = 0;
+    }
+    x->shm->count = x->count;
+    x->shm->time_ms = x->time_ms;
+    atomic_store_explicit(&x->shm->seq, seq + 2, memory_order_release);
+    x->nchanged = 0;
+}
+
+// Create and map a fresh object. Readers that mapped a stale one keep it;
+// a new object makes sure no reader ever sees its slots reassigned.
+static bsdmon_shm_t *shm_map_new(const char *name) {
+    if (shm_unlink(name) != 0 && errno != ENOENT) {
+        perror(name);
+        return NULL;
+    }
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0644);
+    if (fd < 0) {
+        perror(name);
+        return NULL;
+    }
+    void *p = MAP_FAILED;
+    if (ftruncate(fd, (off_t)SHM_SIZE) == 0)
+        p = mmap(NULL, SHM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+        perror(name);
+        shm_unlink(name);
+    }
+    close(fd);
+    return p == MAP_FAILED ? NULL : p;
+}
+
+static void shm_export_free(shm_export_t *x) {
+    if (!x)
+        return;
+    series_table_free(&x->table);
+    free(x->staged);
+    free(x->dirty);
+    free(x->changed);
+    free(x->name);
+    free(x);
+}
+
+shm_export_t *shm_export_create(const char *name) {
+    shm_export_t *x = calloc(1, sizeof(*x));
+    if (!x || !(x->name = strdup(name)) ||
+        !(x->staged = calloc(BSDMON_SHM_CAPACITY, sizeof(*x->staged))) ||
+        !(x->dirty = calloc(BSDMON_SHM_CAPACITY, sizeof(*x->dirty))) ||
+        !(x->changed = calloc(BSDMON_SHM_CAPACITY, sizeof(*x->changed)))) {
+        perror("calloc");
+        shm_export_free(x);
+        return NULL;
+    }
+    if (!(x->shm = shm_map_new(name))) {
+        shm_export_free(x);
+        return NULL;
+    }
+
+    // The object starts zeroed; the magic goes last so readers never accept
+    // a half-initialized header.
+    x->shm->version = BSDMON_SHM_VERSION;
+    x->shm->size = (uint32_t)SHM_SIZE;
+    x->shm->capacity = BSDMON_SHM_CAPACITY;
+    atomic_store_explicit(&x->shm->pid, (uint32_t)getpid(), memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    x->shm->magic = BSDMON_SHM_MAGIC;
+    return x;
+}
+
+void shm_export_destroy(shm_export_t *x) {
+    if (!x)
+        return;
+    shm_export_publish(x);
+    atomic_store_explicit(&x->shm->pid, 0, memory_order_relaxed);
+    munmap(x->shm, SHM_SIZE);
+    shm_unlink(x->name);
+    shm_export_free(x);
+}
@@ -0,0 +1,35 @@
+/*
+ * shm.h - bsdmon: shared-memory export, writer side
+ *
+ * Publishes the latest value of every metric in the region described by
+ * bsdmon_shm.h, which is also the header consumers use to read it. Values
+ * set between two shm_export_publish() calls are staged in private memory
+ * and become visible to readers together, in one short copy.
+ */
+
+#ifndef BSDMON_SHM_EXPORT_H
+#define BSDMON_SHM_EXPORT_H
+
+#include <stdint.h>
+
+typedef struct shm_export shm_export_t;
+
+// Create the shared-memory object name (replacing a stale one left by a
+// process that did not exit cleanly).
+shm_export_t *shm_export_create(const char *name);
+
+// Update one metric. Metrics whose name or label do not fit a slot, or that
+// arrive after every slot is taken, are not exported.
+void shm_export_set(shm_export_t *x, int64_t time_ms, const char *name, const char *label,
+                    double value);
+
+// Empty the slot of a metric that went away; a new metric may take it.
+void shm_export_remove(shm_export_t *x, const char *name, const char *label);
+
+// Make the values set since the last call visible to readers.
+void shm_export_publish(shm_export_t *x);
+
+// Unlink the object; readers still mapping it see the writer as gone.
+void shm_export_destroy(shm_export_t *x);
+
+#endif
@@ -0,0 +1,434 @@
+/*
+ * store.c - bsdmon: persistent metric store
+ *
+ * See store.h.
+ */
+
+#include "store.h"
+#include "series.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define STORE_MAGIC "BSDMTSDB"
+#define STORE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;   // sizeof(store_record_t) of the writer
+    uint64_t size;          // file size
+    int64_t base_ms;        // time of dt_ms == 0
+    int64_t last_ms;        // time of the newest record
+    uint64_t nrecords;      // committed records
+    uint32_t nseries;
+    uint32_t nindex;
+} store_header_t;
+
+typedef struct {
+    uint32_t used;
+    uint32_t hash;
+    char key[STORE_KEY_SIZE];
+} store_series_slot_t;
+
+typedef struct {
+    uint32_t dt_ms;
+    uint32_t record;
+} store_index_t;
+
+#define STORE_SERIES_OFF 4096u
+#define STORE_INDEX_OFF (STORE_SERIES_OFF + STORE_MAX_SERIES * sizeof(store_series_slot_t))
+#define STORE_INDEX_MAX 2048u
+#define STORE_DATA_OFF (STORE_INDEX_OFF + STORE_INDEX_MAX * sizeof(store_index_t))
+#define STORE_CAPACITY ((STORE_SEGMENT_SIZE - STORE_DATA_OFF) / sizeof(store_record_t))
+
+_Static_assert(sizeof(store_header_t) <= STORE_SERIES_OFF, "header exceeds its page");
+_Static_assert(sizeof(store_series_slot_t) == 128, "series slot layout");
+_Static_assert(sizeof(store_record_t) == 16, "record layout");
+_Static_assert(STORE_DATA_OFF % 4096 == 0, "data must be page aligned");
+_Static_assert(STORE_CAPACITY / STORE_INDEX_STRIDE < STORE_INDEX_MAX, "index too small");
+
+struct store_segment {
+    char *map;              // the whole file, shared
+    char name[32];
+};
+
+struct store {
+    int dirfd;
+    int lockfd;
+    size_t budget;              // bytes of segments on disk
+    store_segment_t *segs;      // oldest first; the last one is appended to
+    size_t nsegs, cap;
+    int readonly;               // opened with STORE_READONLY
+    int warned;                 // a series could not be stored
+};
+
+static store_header_t *seg_header(const store_segment_t *seg) {
+    return (store_header_t *)seg->map;
+}
+
+static store_series_slot_t *seg_series(const store_segment_t *seg) {
+    return (store_series_slot_t *)(seg->map + STORE_SERIES_OFF);
+}
+
+static store_index_t *seg_index(const store_segment_t *seg) {
+    return (store_index_t *)(seg->map + STORE_INDEX_OFF);
+}
+
+static store_record_t *seg_records(const store_segment_t *seg) {
+    return (store_record_t *)(seg->map + STORE_DATA_OFF);
+}
+
+int64_t store_segment_base(const store_segment_t *seg) {
+    return seg_header(seg)->base_ms;
+}
+
+void store_segment_series(const store_segment_t *seg, uint32_t id, const char **name,
+                          const char **label) {
+    const store_series_slot_t *slot = &seg_series(seg)[id % STORE_MAX_SERIES];
+    *name = slot->key;
+    *label = slot->key + strlen(slot->key) + 1;
+}
+
+// --- Segment files ---
+static int seg_map(store_segment_t *seg, int fd, int readonly) {
+    seg->map = mmap(NULL, STORE_SEGMENT_SIZE, PROT_READ | (readonly ? 0 : PROT_WRITE),
+                    MAP_SHARED, fd, 0);
+    if (seg->map == MAP_FAILED) {
+        seg->map = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+static void seg_unmap(store_segment_t *seg) {
+    if (seg->map)
+        munmap(seg->map, STORE_SEGMENT_SIZE);
+    seg->map = NULL;
+}
+
+static int seg_valid(const store_segment_t *seg) {
+    const store_header_t *h = seg_header(seg);
+    return memcmp(h->magic, STORE_MAGIC, sizeof(h->magic)) == 0 &&
+           h->version == STORE_VERSION && h->record_size == sizeof(store_record_t) &&
+           h->size == STORE_SEGMENT_SIZE && h->nrecords <= STORE_CAPACITY &&
+           h->nindex <= STORE_INDEX_MAX;
+}
+
+static int seg_name_cmp(const void *a, const void *b) {
+    return strcmp(((const store_segment_t *)a)->name, ((const store_segment_t *)b)->name);
+}
+
+static int store_push(store_t *s, const store_segment_t *seg) {
+    if (s->nsegs == s->cap) {
+        size_t cap = s->cap ? s->cap * 2 : 16;
+        store_segment_t *p = realloc(s->segs, cap * sizeof(*p));
+        if (!p)
+            return -1;
+        s->segs = p;
+        s->cap = cap;
+    }
+    s->segs[s->nsegs++] = *seg;
+    return 0;
+}
+
+// Map every segment of the directory; files with a foreign or damaged header
+// are left alone.
+static int store_scan(store_t *s) {
+    int fd = dup(s->dirfd);
+    DIR *dir = fd >= 0 ? fdopendir(fd) : NULL;
+    if (!dir) {
+        if (fd >= 0)
+            close(fd);
+        return -1;
+    }
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        size_t len = strlen(de->d_name);
+        if (len < 5 || len >= sizeof(((store_segment_t *)0)->name) ||
+            strcmp(de->d_name + len - 4, ".seg") != 0)
+            continue;
+        int sfd = openat(s->dirfd, de->d_name,
+                         (s->readonly ? O_RDONLY : O_RDWR) | O_CLOEXEC | O_NOFOLLOW);
+        struct stat st;
+        store_segment_t seg;
+        memset(&seg, 0, sizeof(seg));
+        memcpy(seg.name, de->d_name, len + 1);
+        if (sfd >= 0 && fstat(sfd, &st) == 0 && st.st_size == STORE_SEGMENT_SIZE &&
+            seg_map(&seg, sfd, s->readonly) == 0) {
+            if (!seg_valid(&seg) || store_push(s, &seg) != 0)
+                seg_unmap(&seg);
+        }
+        if (sfd >= 0)
+            close(sfd);
+    }
+    closedir(dir);
+    qsort(s->segs, s->nsegs, sizeof(*s->segs), seg_name_cmp);
+    return 0;
+}
+
+#define STORE_PAGES(bytes) (((bytes) + 4095) / 4096 * 4096)
+
+// Bytes a segment takes on disk. The files are sparse, so only the pages
+// written so far count: the header, the dictionary (hashing spreads keys
+// over all of it), the index and the records. A segment started because its
+// dictionary filled up costs its records, not its full size.
+static size_t seg_footprint(const store_segment_t *seg) {
+    const store_header_t *h = seg_header(seg);
+    return STORE_INDEX_OFF + STORE_PAGES((size_t)h->nindex * sizeof(store_index_t)) +
+           STORE_PAGES((size_t)h->nrecords * sizeof(store_record_t));
+}
+
+// Delete the oldest segments until the rest, plus a whole new segment when
+// adding one, fit in the budget. The newest segment is always kept.
+static void store_trim(store_t *s, int adding) {
+    size_t used = adding ? STORE_SEGMENT_SIZE : 0;
+    for (size_t i = 0; i < s->nsegs; i++)
+        used += seg_footprint(&s->segs[i]);
+    size_t drop = 0;
+    while (used > s->budget && drop + 1 < s->nsegs)
+        used -= seg_footprint(&s->segs[drop++]);
+    for (size_t i = 0; i < drop; i++) {
+        seg_unmap(&s->segs[i]);
+        unlinkat(s->dirfd, s->segs[i].name, 0);
+    }
+    memmove(s->segs, s->segs + drop, (s->nsegs - drop) * sizeof(*s->segs));
+    s->nsegs -= drop;
+}
+
+// Whether the directory has a file of that name.
+static int store_has(const store_t *s, const char *name) {
+    struct stat st;
+    return fstatat(s->dirfd, name, &st, AT_SYMLINK_NOFOLLOW) == 0;
+}
+
+// Start a new segment whose base time is base_ms. The file is sized and its
+// header written under a temporary name, then renamed into place.
+static store_segment_t *store_new_segment(store_t *s, int64_t base_ms) {
+    store_trim(s, 1);
+    store_segment_t seg;
+    memset(&seg, 0, sizeof(seg));
+    // A segment whose dictionary filled up may be followed by one with the
+    // same base time; suffixes sort after the plain name.
+    snprintf(seg.name, sizeof(seg.name), "%016lld.seg", (long long)base_ms);
+    for (unsigned n = 1; store_has(s, seg.name); n++) {
+        if (n > 999)
+            return NULL;
+        snprintf(seg.name, sizeof(seg.name), "%016lld_%03u.seg", (long long)base_ms, n);
+    }
+    char tmp[40];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", seg.name);
+    int fd = openat(s->dirfd, tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd < 0)
+        return NULL;
+    if (ftruncate(fd, STORE_SEGMENT_SIZE) != 0 || seg_map(&seg, fd, 0) != 0) {
+        close(fd);
+        unlinkat(s->dirfd, tmp, 0);
+        return NULL;
+    }
+    close(fd);
+    store_header_t *h = seg_header(&seg);
+    memcpy(h->magic, STORE_MAGIC, sizeof(h->magic));
+    h->version = STORE_VERSION;
+    h->record_size = sizeof(store_record_t);
+    h->size = STORE_SEGMENT_SIZE;
+    h->base_ms = base_ms;
+    h->last_ms = base_ms;
+    if (renameat(s->dirfd, tmp, s->dirfd, seg.name) != 0) {
+        seg_unmap(&seg);
+        unlinkat(s->dirfd, tmp, 0);
+        return NULL;
+    }
+    if (store_push(s, &seg) != 0) {
+        seg_unmap(&seg);
+        unlinkat(s->dirfd, seg.name, 0);
+        return NULL;
+    }
+    // The previous segment is complete; start writing it back.
+    if (s->nsegs > 1)
+        msync(s->segs[s->nsegs - 2].map, STORE_SEGMENT_SIZE, MS_ASYNC);
+    return &s->segs[s->nsegs - 1];
+}
+
+store_t *store_open(const char *dir, size_t budget, int flags) {
+    int readonly = flags & STORE_READONLY;
+    if (!readonly && mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        perror(dir);
+        return NULL;
+    }
+    store_t *s = calloc(1, sizeof(*s));
+    if (!s) {
+        perror("calloc");
+        return NULL;
+    }
+    s->lockfd = -1;
+    s->readonly = readonly;
+    s->budget = budget;
+    s->dirfd = open(dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (s->dirfd < 0) {
+        perror(dir);
+        free(s);
+        return NULL;
+    }
+    if (!readonly) {
+        s->lockfd = openat(s->dirfd, "lock", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+        if (s->lockfd < 0 || flock(s->lockfd, LOCK_EX | LOCK_NB) != 0) {
+            fprintf(stderr, "Store %s is in use by another process\n", dir);
+            store_close(s);
+            return NULL;
+        }
+    }
+    if (store_scan(s) != 0) {
+        perror(dir);
+        store_close(s);
+        return NULL;
+    }
+    if (!readonly)
+        store_trim(s, 0);
+    return s;
+}
+
+// --- Appending ---
+// Find or add the series in the segment's dictionary. Returns its id, -1 if
+// the key is too long or -2 if the dictionary is full. The dictionary lives in
+// the file, so it has its own fixed-size probing; the hash is the one of the
+// in-memory series tables.
+static int seg_series_id(const store_segment_t *seg, const char *name, const char *label) {
+    char key[STORE_KEY_SIZE];
+    size_t name_len = strlen(name), label_len = strlen(label);
+    size_t len = name_len + label_len + 2;
+    if (len > sizeof(key))
+        return -1;
+    memcpy(key, name, name_len + 1);
+    memcpy(key + name_len + 1, label, label_len + 1);
+    uint32_t hash = series_hash(name, label);
+    store_series_slot_t *slots = seg_series(seg);
+    for (uint32_t i = 0, j = hash % STORE_MAX_SERIES; i < STORE_MAX_SERIES;
+         i++, j = (j + 1) % STORE_MAX_SERIES) {
+        store_series_slot_t *slot = &slots[j];
+        if (!slot->used) {
+            // Keep the dictionary at most three quarters full.
+            store_header_t *h = seg_header(seg);
+            if (h->nseries * 4 >= STORE_MAX_SERIES * 3)
+                return -2;
+            memcpy(slot->key, key, len);
+            slot->hash = hash;
+            slot->used = 1;
+            h->nseries++;
+            return (int)j;
+        }
+        if (slot->hash == hash && memcmp(slot->key, key, len) == 0)
+            return (int)j;
+    }
+    return -2;
+}
+
+int store_append(store_t *s, int64_t time_ms, const char *name, const char *label,
+                 double value) {
+    if (s->readonly)
+        return -1;
+    store_segment_t *seg = s->nsegs ? &s->segs[s->nsegs - 1] : NULL;
+    if (seg) {
+        const store_header_t *h = seg_header(seg);
+        // A new segment when full, when the time no longer fits the 32-bit
+        // offset, or when it is older than the segment's latest record (the
+        // clock went back), since reads rely on records in time order.
+        if (h->nrecords == STORE_CAPACITY || time_ms < h->last_ms ||
+            time_ms - h->base_ms > (int64_t)UINT32_MAX)
+            seg = NULL;
+    }
+    if (!seg && !(seg = store_new_segment(s, time_ms)))
+        return -1;
+    int id = seg_series_id(seg, name, label);
+    // Series come and go (processes), so a full dictionary mostly holds ones
+    // that are gone; a new segment starts with an empty one.
+    if (id == -2 && seg_header(seg)->nrecords) {
+        if (!(seg = store_new_segment(s, time_ms)))
+            return -1;
+        id = seg_series_id(seg, name, label);
+    }
+    if (id < 0) {
+        if (!s->warned) {
+            fprintf(stderr, "Store: cannot record %s{%s}; series key too long\n", name, label);
+            s->warned = 1;
+        }
+        return -1;
+    }
+    store_header_t *h = seg_header(seg);
+    uint32_t dt = (uint32_t)(time_ms - h->base_ms);
+    if (h->nrecords % STORE_INDEX_STRIDE == 0) {
+        store_index_t *ix = &seg_index(seg)[h->nindex++];
+        ix->dt_ms = dt;
+        ix->record = (uint32_t)h->nrecords;
+    }
+    store_record_t *r = &seg_records(seg)[h->nrecords];
+    r->dt_ms = dt;
+    r->series = (uint32_t)id;
+    r->value = value;
+    // The record is complete before it is counted, so a reader of the
+    // mapping never sees a partial one.
+    __atomic_store_n(&h->nrecords, h->nrecords + 1, __ATOMIC_RELEASE);
+    h->last_ms = time_ms;
+    return 0;
+}
+
+// --- Reading ---
+// First record of the segment with dt >= from, using the index to skip
+// ahead and a linear scan within one stride.
+static size_t seg_lower_bound(const store_segment_t *seg, uint32_t from) {
+    const store_header_t *h = seg_header(seg);
+    const store_index_t *ix = seg_index(seg);
+    size_t lo = 0, hi = h->nindex;
+    while (lo < hi) {
+        size_t mid = (lo + hi) / 2;
+        if (ix[mid].dt_ms < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    size_t i = lo ? ix[lo - 1].record : 0;
+    const store_record_t *recs = seg_records(seg);
+    while (i < h->nrecords && recs[i].dt_ms < from)
+        i++;
+    return i;
+}
+
+void store_read(const store_t *s, int64_t from_ms, int64_t to_ms, store_visit_t fn, void *ctx) {
+    for (size_t k = 0; k < s->nsegs; k++) {
+        const store_segment_t *seg = &s->segs[k];
+        const store_header_t *h = seg_header(seg);
+        uint64_t n = __atomic_load_n(&h->nrecords, __ATOMIC_ACQUIRE);
+        if (n == 0 || h->last_ms < from_ms || h->base_ms > to_ms)
+            continue;
+        uint32_t from = from_ms > h->base_ms ? (uint32_t)(from_ms - h->base_ms) : 0;
+        int64_t to = to_ms - h->base_ms;
+        size_t first = seg_lower_bound(seg, from), last = first;
+        const store_record_t *recs = seg_records(seg);
+        while (last < n && recs[last].dt_ms <= to)
+            last++;
+        if (last > first && fn(ctx, seg, recs + first, last - first) != 0)
+            return;
+    }
+}
+
+void store_close(store_t *s) {
+    if (!s)
+        return;
+    for (size_t i = 0; i < s->nsegs; i++)
+        seg_unmap(&s->segs[i]);
+    free(s->segs);
+    if (s->lockfd >= 0)
+        close(s->lockfd);
+    if (s->dirfd >= 0)
+        close(s->dirfd);
+    free(s);
+}
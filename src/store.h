@@ -0,0 +1,78 @@
+/*
+ * store.h - bsdmon: persistent metric store
+ *
+ * Sampled metrics are appended to fixed-size segment files in a directory,
+ * one file per time range, named after the time of their first record. A
+ * segment is used through mmap() only: its header, series dictionary and
+ * time index are plain structs at fixed offsets and the records are a packed
+ * array, so opening the store maps the files and reads nothing, and range
+ * reads hand out pointers straight into the mapping.
+ *
+ *   offset 0       store_header_t (one page)
+ *   series         STORE_MAX_SERIES open-addressed slots; a record's series
+ *                  id is its slot number
+ *   index          time of every STORE_INDEX_STRIDE-th record
+ *   data           store_record_t[], in append (time) order
+ *
+ * When the newest segment fills up (its records, or its series dictionary as
+ * processes come and go) a new one is started, and the oldest are deleted to
+ * keep the directory within its size budget. Segment files are sparse, so
+ * the budget counts the pages a segment has written, not its file size: a
+ * segment cut short by a full dictionary costs what it holds, and retention
+ * follows the number of records rather than how often series change.
+ */
+
+#ifndef BSDMON_STORE_H
+#define BSDMON_STORE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STORE_SEGMENT_SIZE (16u << 20)
+#define STORE_MAX_SERIES 1024
+#define STORE_KEY_SIZE 120          // "name\0label\0", longer keys are dropped
+#define STORE_INDEX_STRIDE 512
+
+typedef struct {
+    uint32_t dt_ms;         // milliseconds since the segment's base time
+    uint32_t series;        // slot in the segment's series dictionary
+    double value;
+} store_record_t;
+
+typedef struct store store_t;
+typedef struct store_segment store_segment_t;
+
+// Called with a run of consecutive records of one segment, all inside the
+// requested range. Return non-zero to stop.
+typedef int (*store_visit_t)(void *ctx, const store_segment_t *seg,
+                             const store_record_t *recs, size_t n);
+
+// Map the segments for reading only, without locking the directory, so a
+// store can be queried while another process appends to it.
+#define STORE_READONLY 1
+
+// Open (creating it if needed) the store in dir, keeping at most budget bytes
+// of written segment pages (the segment being appended to counts in full). The directory is locked against other writers unless flags
+// has STORE_READONLY.
+store_t *store_open(const char *dir, size_t budget, int flags);
+
+// Append one sample. Samples should arrive in time order: one older than the
+// latest in the newest segment starts a new segment. Returns -1 if it could
+// not be stored.
+int store_append(store_t *s, int64_t time_ms, const char *name, const char *label,
+                 double value);
+
+// Visit every record with a time in [from_ms, to_ms], oldest first.
+void store_read(const store_t *s, int64_t from_ms, int64_t to_ms, store_visit_t fn, void *ctx);
+
+// Base time of a segment; a record's time is base + dt_ms.
+int64_t store_segment_base(const store_segment_t *seg);
+
+// Name and label of a series id within a segment. Ids range over
+// [0, STORE_MAX_SERIES); unused ones have an empty name.
+void store_segment_series(const store_segment_t *seg, uint32_t id, const char **name,
+                          const char **label);
+
+void store_close(store_t *s);
+
+#endif
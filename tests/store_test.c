@@ -0,0 +1,95 @@
+/*
+ * store_test.c - bsdmon: store retention under series churn
+ *
+ * Appends more distinct series than one segment's dictionary holds, as
+ * per-process metrics do over time, and checks that the oldest samples are
+ * still there: segments cut short by a full dictionary must not push old
+ * data out of the size budget.
+ */
+
+#include "store.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define TEST_SERIES 5000
+#define TEST_BUDGET (64u << 20)
+
+typedef struct {
+    size_t records;
+    int first_found;            // the sample of series 0
+} visit_t;
+
+static int visit(void *ctx, const store_segment_t *seg, const store_record_t *recs, size_t n) {
+    visit_t *v = ctx;
+    for (size_t i = 0; i < n; i++) {
+        const char *name, *label;
+        store_segment_series(seg, recs[i].series, &name, &label);
+        if (strcmp(name, "proc_cpu_percent") == 0 && strcmp(label, "0:test") == 0 &&
+            recs[i].value == 0)
+            v->first_found = 1;
+    }
+    v->records += n;
+    return 0;
+}
+
+static int check(const char *dir, int flags, const char *when) {
+    store_t *s = store_open(dir, TEST_BUDGET, flags);
+    if (!s) {
+        fprintf(stderr, "%s: cannot open the store\n", when);
+        return -1;
+    }
+    visit_t v = { 0, 0 };
+    store_read(s, 0, 1000 + TEST_SERIES, visit, &v);
+    store_close(s);
+    if (v.records != TEST_SERIES || !v.first_found) {
+        fprintf(stderr, "%s: read %zu of %d records, oldest %s\n", when, v.records,
+                TEST_SERIES, v.first_found ? "found" : "missing");
+        return -1;
+    }
+    return 0;
+}
+
+static void remove_dir(const char *dir) {
+    DIR *d = opendir(dir);
+    if (d) {
+        struct dirent *de;
+        char path[4096];
+        while ((de = readdir(d)))
+            if (strcmp(de->d_name, ".") != 0 && strcmp(de->d_name, "..") != 0) {
+                snprintf(path, sizeof(path), "%s/%s", dir, de->d_name);
+                unlink(path);
+            }
+        closedir(d);
+    }
+    rmdir(dir);
+}
+
+int main(void) {
+    char dir[] = "/tmp/bsdmon-store-test.XXXXXX";
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+    int status = EXIT_FAILURE;
+    store_t *s = store_open(dir, TEST_BUDGET, 0);
+    if (s) {
+        char label[32];
+        int ok = 1;
+        for (int i = 0; i < TEST_SERIES && ok; i++) {
+            snprintf(label, sizeof(label), "%d:test", i);
+            ok = store_append(s, 1000 + i, "proc_cpu_percent", label, i) == 0;
+        }
+        store_close(s);
+        if (!ok)
+            fprintf(stderr, "append failed\n");
+        else if (check(dir, 0, "reopened") == 0 &&
+                 check(dir, STORE_READONLY, "read-only") == 0)
+            status = EXIT_SUCCESS;
+    }
+    remove_dir(dir);
+    return status;
+}